@@ -0,0 +1,511 @@
+// bench-container: time the containers against each other, or fuzz them against Vector.
+//
+// Usage: bench-container [-l] [-f <seed> <iterations>]
+//
+// Without -f, every operation is timed for each container, element size and length, and printed
+// as nanoseconds per operation. -l leaves out the 65536 element runs. With -f, random operations
+// are applied to a Deque, a SmallVector and a typed vector, and to a Vector beside each, and the contents are
+// compared after every step.
+
+#include <pch.h>
+
+#include "../container/deque.h"
+#include "../container/small_vector.h"
+#include "../container/typed_vector.h"
+#include "../container/vector.h"
+
+#include <time.h>
+
+// Largest element benchmarked.
+#define BENCH_MAX_ELEM 256
+
+// Operations timed per run, spread over as many rounds as it takes, unless time runs out first.
+#define BENCH_TARGET_OPS (1U << 21)
+
+// Time spent on a run at most, O(n) operations on long containers would take minutes otherwise.
+#define BENCH_MAX_RUN_NS 200000000ULL
+
+// Operations per round on a full container, some are O(n) so a round does a few.
+#define BENCH_MIDDLE_OPS 256
+
+typedef enum BenchContainer
+{
+    BENCH_VECTOR,
+    BENCH_DEQUE,
+    BENCH_SMALL_VECTOR,
+    BENCH_TYPED_VECTOR,
+    BENCH_CONTAINERS
+} BenchContainer;
+
+static const char *const container_names[BENCH_CONTAINERS] = { "vector", "deque", "small_vector", "typed_vector" };
+
+// Elements of the typed vectors, one type per benchmarked size.
+typedef struct Elem8 { unsigned char bytes[8]; } Elem8;
+typedef struct Elem64 { unsigned char bytes[64]; } Elem64;
+typedef struct Elem256 { unsigned char bytes[256]; } Elem256;
+
+VECTOR_DEFINE(Elem8Vector, Elem8)
+VECTOR_DEFINE(Elem64Vector, Elem64)
+VECTOR_DEFINE(Elem256Vector, Elem256)
+
+// One of the containers, the benchmarks pick the member by BenchContainer.
+typedef struct BenchSubject
+{
+    BenchContainer kind;
+    size_t elem_size;
+    Vector vector;
+    Deque deque;
+    SmallVector small;
+    Elem8Vector typed8;
+    Elem64Vector typed64;
+    Elem256Vector typed256;
+} BenchSubject;
+
+// Call a function of the typed vector of the subject's element size.
+#define BENCH_TYPED( subject, Op, ... )                                 \
+    do                                                                  \
+    {                                                                   \
+        if ((subject)->elem_size == 8)                                  \
+            Elem8Vector_##Op(&(subject)->typed8, __VA_ARGS__);          \
+        else if ((subject)->elem_size == 64)                            \
+            Elem64Vector_##Op(&(subject)->typed64, __VA_ARGS__);        \
+        else                                                            \
+            Elem256Vector_##Op(&(subject)->typed256, __VA_ARGS__);      \
+    } while (0)
+
+// Keeps the compiler from dropping reads whose result is unused.
+static
+volatile uint64_t sink;
+
+static
+uint64_t
+NowNs( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, good enough for picking operations and indices.
+static
+uint64_t
+Random( uint64_t *state )
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static
+void
+Subject_Create( BenchSubject *subject, BenchContainer kind, size_t elem_size )
+{
+    subject->kind = kind;
+    subject->elem_size = elem_size;
+    subject->vector = Vector_CreateS(elem_size, NULL);
+    subject->deque = Deque_CreateS(elem_size);
+    subject->small = SmallVector_CreateS(elem_size);
+    subject->typed8 = Elem8Vector_CreateS();
+    subject->typed64 = Elem64Vector_CreateS();
+    subject->typed256 = Elem256Vector_CreateS();
+}
+
+static
+void
+Subject_Destroy( BenchSubject *subject )
+{
+    Vector_DestroyS(&subject->vector);
+    Deque_DestroyS(&subject->deque);
+    SmallVector_DestroyS(&subject->small);
+    Elem8Vector_DestroyS(&subject->typed8);
+    Elem64Vector_DestroyS(&subject->typed64);
+    Elem256Vector_DestroyS(&subject->typed256);
+}
+
+static
+size_t
+Subject_Length( const BenchSubject *subject )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: return subject->vector.length;
+    case BENCH_DEQUE: return subject->deque.length;
+    case BENCH_SMALL_VECTOR: return subject->small.length;
+    default: return subject->typed8.length + subject->typed64.length + subject->typed256.length;
+    }
+}
+
+static
+void
+Subject_Push( BenchSubject *subject, const void *elem )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: Vector_Push(&subject->vector, elem); break;
+    case BENCH_DEQUE: Deque_Push(&subject->deque, elem); break;
+    case BENCH_SMALL_VECTOR: SmallVector_Push(&subject->small, elem); break;
+    default: BENCH_TYPED(subject, Push, elem); break;
+    }
+}
+
+static
+void
+Subject_Pop( BenchSubject *subject, void *elem )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: Vector_Pop(&subject->vector, elem); break;
+    case BENCH_DEQUE: Deque_Pop(&subject->deque, elem); break;
+    case BENCH_SMALL_VECTOR: SmallVector_Pop(&subject->small, elem); break;
+    default: BENCH_TYPED(subject, Pop, elem); break;
+    }
+}
+
+// False if the container has no cheap way to do it, the benchmark is skipped then.
+static
+bool
+Subject_PopFront( BenchSubject *subject, void *elem )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: Vector_Pop_Front(&subject->vector, elem); return true;
+    case BENCH_DEQUE: Deque_Pop_Front(&subject->deque, elem); return true;
+    default: return false;
+    }
+}
+
+static
+bool
+Subject_PushFront( BenchSubject *subject, const void *elem )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: Vector_Push_Front(&subject->vector, elem); return true;
+    case BENCH_DEQUE: Deque_Push_Front(&subject->deque, elem); return true;
+    default: return false;
+    }
+}
+
+static
+void
+Subject_Delete( BenchSubject *subject, size_t index )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: Vector_Delete(&subject->vector, index); break;
+    case BENCH_DEQUE: Deque_Delete(&subject->deque, index); break;
+    case BENCH_SMALL_VECTOR: SmallVector_Delete(&subject->small, index); break;
+    default: BENCH_TYPED(subject, Delete, index); break;
+    }
+}
+
+static
+bool
+Subject_Insert( BenchSubject *subject, size_t index, const void *elem )
+{
+    if (subject->kind != BENCH_VECTOR)
+        return false;
+    Vector_Insert(&subject->vector, index, elem);
+    return true;
+}
+
+static
+void *
+Subject_PtrAt( BenchSubject *subject, size_t index )
+{
+    switch (subject->kind)
+    {
+    case BENCH_VECTOR: return Vector_PtrAt(&subject->vector, index);
+    case BENCH_DEQUE: return Deque_PtrAt(&subject->deque, index);
+    case BENCH_SMALL_VECTOR: return SmallVector_PtrAt(&subject->small, index);
+    default:
+        if (subject->elem_size == 8)
+            return Elem8Vector_At(&subject->typed8, index);
+        if (subject->elem_size == 64)
+            return Elem64Vector_At(&subject->typed64, index);
+        return Elem256Vector_At(&subject->typed256, index);
+    }
+}
+
+static
+void
+Subject_Fill( BenchSubject *subject, size_t length, const void *elem )
+{
+    while (Subject_Length(subject) < length)
+        Subject_Push(subject, elem);
+}
+
+typedef enum BenchOp
+{
+    // Push to length, then pop back to empty, on a fresh container.
+    BENCH_PUSH_POP,
+    // Push back and pop from the front of a full container, a queue at that depth.
+    BENCH_FIFO,
+    // Push to the front and pop back of a full container.
+    BENCH_PUSH_FRONT,
+    // Delete and push back in the middle of a full container.
+    BENCH_DELETE_MIDDLE,
+    // Insert and pop back in the middle of a full container.
+    BENCH_INSERT_MIDDLE,
+    // Read random indices of a full container.
+    BENCH_PTR_AT,
+    BENCH_OPS
+} BenchOp;
+
+static const char *const op_names[BENCH_OPS] = { "push_pop", "fifo", "push_front", "delete_middle", "insert_middle", "ptr_at" };
+
+// Run an operation, returning nanoseconds per operation or a negative number if it is not supported.
+static
+double
+RunOp( BenchOp op, BenchContainer kind, size_t elem_size, size_t length )
+{
+    unsigned char elem[BENCH_MAX_ELEM] = { 1 };
+    BenchSubject subject;
+    Subject_Create(&subject, kind, elem_size);
+
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    size_t ops = 0;
+    uint64_t elapsed = 0;
+    bool supported = true;
+
+    // Containers holding their length for the whole run are filled untimed.
+    if (op != BENCH_PUSH_POP)
+        Subject_Fill(&subject, length, elem);
+
+    while (supported && ops < BENCH_TARGET_OPS && elapsed < BENCH_MAX_RUN_NS)
+    {
+        uint64_t start = NowNs();
+        switch (op)
+        {
+        case BENCH_PUSH_POP:
+            for (size_t i = 0; i < length; i++)
+                Subject_Push(&subject, elem);
+            for (size_t i = 0; i < length; i++)
+                Subject_Pop(&subject, elem);
+            ops += length * 2;
+            break;
+        case BENCH_FIFO:
+            for (size_t i = 0; supported && i < BENCH_MIDDLE_OPS; i++)
+            {
+                Subject_Push(&subject, elem);
+                supported = Subject_PopFront(&subject, elem);
+            }
+            ops += BENCH_MIDDLE_OPS * 2;
+            break;
+        case BENCH_PUSH_FRONT:
+            for (size_t i = 0; supported && i < BENCH_MIDDLE_OPS; i++)
+            {
+                supported = Subject_PushFront(&subject, elem);
+                Subject_Pop(&subject, elem);
+            }
+            ops += BENCH_MIDDLE_OPS * 2;
+            break;
+        case BENCH_DELETE_MIDDLE:
+            for (size_t i = 0; i < BENCH_MIDDLE_OPS; i++)
+            {
+                Subject_Delete(&subject, length / 2);
+                Subject_Push(&subject, elem);
+            }
+            ops += BENCH_MIDDLE_OPS * 2;
+            break;
+        case BENCH_INSERT_MIDDLE:
+            for (size_t i = 0; supported && i < BENCH_MIDDLE_OPS; i++)
+            {
+                supported = Subject_Insert(&subject, length / 2, elem);
+                Subject_Pop(&subject, elem);
+            }
+            ops += BENCH_MIDDLE_OPS * 2;
+            break;
+        default:
+        {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < length; i++)
+                sum += *(unsigned char *)Subject_PtrAt(&subject, Random(&state) % length);
+            sink += sum;
+            ops += length;
+            break;
+        }
+        }
+        elapsed += NowNs() - start;
+    }
+
+    Subject_Destroy(&subject);
+    return supported ? (double)elapsed / (double)ops : -1.0;
+}
+
+static
+void
+Bench( bool large )
+{
+    static const size_t elem_sizes[] = { 8, 64, 256 };
+    static const size_t lengths[] = { 16, 1024, 65536 };
+
+    printf("%-14s %5s %6s", "op", "elem", "length");
+    for (int kind = 0; kind < BENCH_CONTAINERS; kind++)
+        printf(" %14s", container_names[kind]);
+    printf("\n");
+
+    for (int op = 0; op < BENCH_OPS; op++)
+        for (size_t e = 0; e < sizeof(elem_sizes) / sizeof(elem_sizes[0]); e++)
+            for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+            {
+                if (!large && lengths[l] > 1024)
+                    continue;
+                printf("%-14s %5zu %6zu", op_names[op], elem_sizes[e], lengths[l]);
+                for (int kind = 0; kind < BENCH_CONTAINERS; kind++)
+                {
+                    double ns = RunOp((BenchOp)op, (BenchContainer)kind, elem_sizes[e], lengths[l]);
+                    if (ns < 0.0)
+                        printf(" %14s", "-");
+                    else
+                        printf(" %11.2f ns", ns);
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+}
+
+// Compare a container against its reference, element by element.
+static
+bool
+Same( BenchSubject *subject, const Vector *reference )
+{
+    if (Subject_Length(subject) != reference->length)
+        return false;
+    for (size_t i = 0; i < reference->length; i++)
+        if (memcmp(Subject_PtrAt(subject, i), Vector_PtrAt(reference, i), reference->elem_size))
+            return false;
+    return true;
+}
+
+static
+bool
+Fuzz( BenchContainer kind, uint64_t seed, unsigned long iterations )
+{
+    // Typed vectors only exist for the benchmarked sizes, the last three.
+    static const size_t elem_sizes[] = { 1, 24, 8, 64, 256 };
+    uint64_t state = seed ? seed : 1;
+    size_t sizes = sizeof(elem_sizes) / sizeof(elem_sizes[0]);
+    size_t elem_size = kind == BENCH_TYPED_VECTOR ? elem_sizes[sizes - 3 + Random(&state) % 3] : elem_sizes[Random(&state) % sizes];
+
+    BenchSubject subject;
+    Subject_Create(&subject, kind, elem_size);
+    Vector reference = Vector_CreateS(elem_size, NULL);
+    unsigned char elem[BENCH_MAX_ELEM], got[BENCH_MAX_ELEM], expected[BENCH_MAX_ELEM];
+    bool ok = true;
+
+    for (unsigned long i = 0; ok && i < iterations; i++)
+    {
+        // Elements tell apart where they came from, so misplaced ones are caught.
+        for (size_t b = 0; b < elem_size; b++)
+            elem[b] = (unsigned char)(i + b * 31);
+
+        // Alternate growing and shrinking phases, so that growth and wrapping around get exercised.
+        size_t length = reference.length;
+        unsigned long op = Random(&state) % 8;
+        if ((i / 4096UL) % 2UL == 0UL && (op == 5 || op == 6))
+            op = 0;
+        const char *name = "";
+        switch (op)
+        {
+        case 0:
+        case 1:
+            name = "push";
+            Subject_Push(&subject, elem);
+            Vector_Push(&reference, elem);
+            break;
+        case 2:
+            name = "pop";
+            memset(got, 0, elem_size);
+            memset(expected, 0, elem_size);
+            Subject_Pop(&subject, got);
+            Vector_Pop(&reference, expected);
+            ok = !memcmp(got, expected, elem_size);
+            break;
+        case 3:
+            name = "push_front";
+            if (Subject_PushFront(&subject, elem))
+                Vector_Push_Front(&reference, elem);
+            break;
+        case 4:
+            name = "pop_front";
+            memset(got, 0, elem_size);
+            memset(expected, 0, elem_size);
+            if (Subject_PopFront(&subject, got))
+            {
+                Vector_Pop_Front(&reference, expected);
+                ok = !memcmp(got, expected, elem_size);
+            }
+            break;
+        case 5:
+        case 6:
+        {
+            // Past the end as well, which must do nothing.
+            size_t index = Random(&state) % (length + 2);
+            name = "delete";
+            Subject_Delete(&subject, index);
+            Vector_Delete(&reference, index);
+            break;
+        }
+        default:
+            // Now and then, start over from empty so short lengths get their share.
+            if (Random(&state) % 64)
+                continue;
+            name = "clear";
+            if (kind == BENCH_DEQUE)
+                Deque_Clear(&subject.deque);
+            else if (kind == BENCH_SMALL_VECTOR)
+                SmallVector_Clear(&subject.small);
+            else
+            {
+                Elem8Vector_Clear(&subject.typed8);
+                Elem64Vector_Clear(&subject.typed64);
+                Elem256Vector_Clear(&subject.typed256);
+            }
+            Vector_Clear(&reference);
+            break;
+        }
+
+        if (ok)
+            ok = Same(&subject, &reference);
+        if (!ok)
+            fprintf(stderr, "%s: mismatch after %s at iteration %lu, length %zu, element size %zu.\n",
+                    container_names[kind], name, i, length, elem_size);
+    }
+
+    if (ok)
+        printf("%s: %lu iterations with %zu byte elements, ended at length %zu.\n",
+               container_names[kind], iterations, elem_size, reference.length);
+    Vector_DestroyS(&reference);
+    Subject_Destroy(&subject);
+    return ok;
+}
+
+int
+main( int argc, char **argv )
+{
+    if (argc == 4 && !strcmp(argv[1], "-f"))
+    {
+        char *end = NULL;
+        uint64_t seed = strtoull(argv[2], &end, 0);
+        unsigned long iterations = *end ? 0 : strtoul(argv[3], &end, 0);
+        if (*end || !iterations)
+        {
+            fprintf(stderr, "Invalid seed or iterations.\n");
+            return 2;
+        }
+        bool ok = Fuzz(BENCH_DEQUE, seed, iterations);
+        ok = Fuzz(BENCH_SMALL_VECTOR, seed, iterations) && ok;
+        ok = Fuzz(BENCH_TYPED_VECTOR, seed, iterations) && ok;
+        return ok ? 0 : 1;
+    }
+    if (argc == 1 || (argc == 2 && !strcmp(argv[1], "-l")))
+    {
+        Bench(argc == 1);
+        return 0;
+    }
+
+    fprintf(stderr, "Usage: %s [-l] [-f <seed> <iterations>]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,311 @@
+// bench-tls: time HTTPS handshakes and responses against a running instance over loopback.
+//
+// Usage: bench-tls [-p] [-n <handshakes>] [-r <requests>] <ipv4> <port>
+//
+// Makes n connections with a full handshake and one request each, then n more resuming the session of
+// the first, and prints how many per second and how many were resumed. Then requests the page r times
+// over one connection, pipelined, and prints the responses and megabytes per second. -p skips the
+// handshakes and talks plain HTTP instead, to compare the same instance's tls: listener against its tcp: one:
+//
+//     blackhole2 -l tls:127.0.0.1:8443 -l tcp:127.0.0.1:8080 --tls-cert res/tls/test_cert.pem
+//                --tls-key res/tls/test_key.pem page.html
+//     bench-tls 127.0.0.1 8443
+//     bench-tls -p 127.0.0.1 8080
+//
+// Certificates are not verified, it's meant for the test certificate of res/tls.
+// Build it alone with -lssl -lcrypto.
+
+#include <pch.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Requests written before their responses are read.
+#define BENCH_PIPELINE 16
+
+#define BENCH_REQUEST "GET / HTTP/1.1\r\nHost: bench\r\n\r\n"
+
+// A connection, with or without TLS.
+typedef struct BenchConnection
+{
+    int fd;
+    SSL *ssl;
+} BenchConnection;
+
+static
+uint64_t
+NowNs( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static
+int
+Connect( const struct sockaddr_in *addr )
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){ 1 }, sizeof(int));
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connect and do the handshake, resuming session if given. Returns false on error.
+static
+bool
+Open( BenchConnection *connection, SSL_CTX *ctx, const struct sockaddr_in *addr, SSL_SESSION *session )
+{
+    connection->ssl = NULL;
+    connection->fd = Connect(addr);
+    if (connection->fd == -1)
+        return false;
+    if (!ctx)
+        return true;
+
+    connection->ssl = SSL_new(ctx);
+    if (!connection->ssl || SSL_set_fd(connection->ssl, connection->fd) != 1 ||
+        (session && SSL_set_session(connection->ssl, session) != 1) || SSL_connect(connection->ssl) != 1)
+    {
+        SSL_free(connection->ssl);
+        connection->ssl = NULL;
+        close(connection->fd);
+        return false;
+    }
+    return true;
+}
+
+static
+void
+Close( BenchConnection *connection )
+{
+    if (connection->ssl)
+    {
+        SSL_shutdown(connection->ssl);
+        SSL_free(connection->ssl);
+    }
+    close(connection->fd);
+}
+
+static
+bool
+WriteAll( BenchConnection *connection, const char *bytes, size_t size )
+{
+    while (size)
+    {
+        ssize_t written = connection->ssl ? SSL_write(connection->ssl, bytes, (int)size) : send(connection->fd, bytes, size, MSG_NOSIGNAL);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static
+ssize_t
+Read( BenchConnection *connection, char *buffer, size_t size )
+{
+    return connection->ssl ? SSL_read(connection->ssl, buffer, (int)size) : recv(connection->fd, buffer, size, 0);
+}
+
+// Read one response to learn its size, assuming every response to the request has the same one.
+static
+size_t
+ResponseSize( BenchConnection *connection )
+{
+    char buffer[16384];
+    size_t length = 0;
+    while (length < sizeof(buffer) - 1)
+    {
+        ssize_t received = Read(connection, buffer + length, sizeof(buffer) - 1 - length);
+        if (received <= 0)
+            return 0;
+        length += (size_t)received;
+        buffer[length] = '\0';
+
+        char *head_end = strstr(buffer, "\r\n\r\n");
+        if (!head_end)
+            continue;
+        const char *content_length = strstr(buffer, "Content-Length: ");
+        if (!content_length || content_length > head_end)
+            return 0;
+        size_t size = (size_t)(head_end + 4 - buffer) + strtoul(content_length + 16, NULL, 10);
+        // The response may run past the buffer, read the rest of it away.
+        for (size_t left = size > length ? size - length : 0; left; )
+        {
+            received = Read(connection, buffer, left < sizeof(buffer) ? left : sizeof(buffer));
+            if (received <= 0)
+                return 0;
+            left -= (size_t)received;
+        }
+        return size;
+    }
+    return 0;
+}
+
+// Time count connections, each resuming session if given, with a handshake and one request like a reconnecting client.
+// The request also takes the session tickets of TLS 1.3 in, which come after the handshake.
+// Returns the last session, NULL on error.
+static
+SSL_SESSION *
+BenchHandshakes( SSL_CTX *ctx, const struct sockaddr_in *addr, size_t count, SSL_SESSION *session )
+{
+    SSL_SESSION *last = NULL;
+    size_t resumed = 0;
+    uint64_t start = NowNs();
+    for (size_t i = 0; i < count; i++)
+    {
+        BenchConnection connection;
+        if (!Open(&connection, ctx, addr, session))
+        {
+            fprintf(stderr, "Handshake %zu failed.\n", i);
+            ERR_print_errors_fp(stderr);
+            SSL_SESSION_free(last);
+            return NULL;
+        }
+        if (!WriteAll(&connection, BENCH_REQUEST, sizeof(BENCH_REQUEST) - 1) || !ResponseSize(&connection))
+        {
+            fprintf(stderr, "Request %zu failed.\n", i);
+            Close(&connection);
+            SSL_SESSION_free(last);
+            return NULL;
+        }
+        resumed += SSL_session_reused(connection.ssl);
+        SSL_SESSION_free(last);
+        last = SSL_get1_session(connection.ssl);
+        Close(&connection);
+    }
+    double seconds = (double)(NowNs() - start) / 1e9;
+    printf("%s handshakes: %zu connections in %.3f s, %.0f/s, %zu resumed, %s\n", session ? "resumed" : "full", count, seconds,
+           (double)count / seconds, resumed, SSL_SESSION_get_protocol_version(last) == TLS1_3_VERSION ? "TLS 1.3" : "TLS 1.2");
+    return last;
+}
+
+static
+bool
+BenchResponses( SSL_CTX *ctx, const struct sockaddr_in *addr, size_t count, SSL_SESSION *session )
+{
+    BenchConnection connection;
+    if (!Open(&connection, ctx, addr, session))
+    {
+        fprintf(stderr, "Failed to connect.\n");
+        return false;
+    }
+
+    size_t response_size = 0;
+    if (!WriteAll(&connection, BENCH_REQUEST, sizeof(BENCH_REQUEST) - 1) || !(response_size = ResponseSize(&connection)))
+    {
+        fprintf(stderr, "Failed to read the first response.\n");
+        Close(&connection);
+        return false;
+    }
+
+    char requests[(sizeof(BENCH_REQUEST) - 1) * BENCH_PIPELINE];
+    for (size_t i = 0; i < BENCH_PIPELINE; i++)
+        memcpy(requests + (sizeof(BENCH_REQUEST) - 1) * i, BENCH_REQUEST, sizeof(BENCH_REQUEST) - 1);
+
+    static char buffer[1 << 16];
+    uint64_t start = NowNs();
+    for (size_t done = 0; done < count; )
+    {
+        size_t batch = count - done < BENCH_PIPELINE ? count - done : BENCH_PIPELINE;
+        if (!WriteAll(&connection, requests, (sizeof(BENCH_REQUEST) - 1) * batch))
+        {
+            fprintf(stderr, "Failed to write requests.\n");
+            Close(&connection);
+            return false;
+        }
+        for (size_t left = response_size * batch; left; )
+        {
+            ssize_t received = Read(&connection, buffer, left < sizeof(buffer) ? left : sizeof(buffer));
+            if (received <= 0)
+            {
+                fprintf(stderr, "Connection ended after %zu responses.\n", done);
+                Close(&connection);
+                return false;
+            }
+            left -= (size_t)received;
+        }
+        done += batch;
+    }
+    double seconds = (double)(NowNs() - start) / 1e9;
+    printf("responses: %zu of %zu bytes in %.3f s, %.0f/s, %.1f MB/s\n", count, response_size, seconds,
+           (double)count / seconds, (double)(count * response_size) / seconds / 1e6);
+    Close(&connection);
+    return true;
+}
+
+int
+main( int argc, char **argv )
+{
+    bool plain = false;
+    unsigned long handshakes = 1000, requests = 100000;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "pn:r:")) != -1)
+    {
+        char *end = NULL;
+        switch (opt)
+        {
+            case 'p':
+                plain = true;
+                break;
+            case 'n':
+                handshakes = strtoul(optarg, &end, 10);
+                break;
+            case 'r':
+                requests = strtoul(optarg, &end, 10);
+                break;
+            default:
+                end = "";
+                break;
+        }
+        if (end && (*end || !handshakes || !requests))
+            optind = argc;
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    char *end = NULL;
+    unsigned long port = argc - optind == 2 ? strtoul(argv[optind + 1], &end, 10) : 0;
+    if (!port || *end || port > UINT16_MAX || inet_pton(AF_INET, argv[optind], &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Usage: %s [-p] [-n <handshakes>] [-r <requests>] <ipv4> <port>\n", argv[0]);
+        return 2;
+    }
+    addr.sin_port = htons((uint16_t)port);
+
+    if (plain)
+        return BenchResponses(NULL, &addr, requests, NULL) ? 0 : 1;
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx)
+    {
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+    bool ok = false;
+    SSL_SESSION *session = BenchHandshakes(ctx, &addr, handshakes, NULL);
+    if (session)
+    {
+        SSL_SESSION *resumed = BenchHandshakes(ctx, &addr, handshakes, session);
+        ok = resumed && BenchResponses(ctx, &addr, requests, resumed);
+        SSL_SESSION_free(resumed);
+        SSL_SESSION_free(session);
+    }
+    SSL_CTX_free(ctx);
+    return ok ? 0 : 1;
+}
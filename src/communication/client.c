@@ -0,0 +1,59 @@
+#include "client.h"
+
+#include "../main/access_log.h"
+#include "../main/events.h"
+
+#include <netinet/in.h>
+
+void
+Client_SetPeer( Client *client, const struct sockaddr_storage *addr )
+{
+    memset(client->addr, 0, sizeof(client->addr));
+    client->port = 0;
+    if (addr->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        client->addr[10] = client->addr[11] = 0xFF;
+        memcpy(client->addr + 12, &in->sin_addr, 4);
+        client->port = ntohs(in->sin_port);
+    }
+    else if (addr->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        memcpy(client->addr, &in6->sin6_addr, 16);
+        client->port = ntohs(in6->sin6_port);
+    }
+}
+
+ClientExtras *
+Client_Extras( Client *client )
+{
+    if (!client->extras)
+    {
+        client->extras = calloc(1, sizeof(ClientExtras));
+        if (client->extras)
+        {
+            client->extras->access_pending = Vector_CreateS(sizeof(AccessRecord), NULL);
+            client->extras->events = Deque_CreateS(sizeof(EventBuffer *));
+        }
+    }
+    return client->extras;
+}
+
+void
+Client_FreeExtras( Client *client )
+{
+    if (!client->extras)
+        return;
+    Vector_DestroyS(&client->extras->access_pending);
+    EventBuffer *event = NULL;
+    while (Deque_Pop_Front(&client->extras->events, &event))
+        Events_Release(event);
+    Deque_DestroyS(&client->extras->events);
+#ifdef BH2_TLS
+    Tls_Free(client->extras->tls);
+#endif
+    Http2_Close(client->extras->h2);
+    free(client->extras);
+    client->extras = NULL;
+}
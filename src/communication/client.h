@@ -5,12 +5,120 @@
 
 #include <sys/socket.h>
 
+#include "http2.h"
+#include "rate_limit.h"
+#include "response.h"
+#include "tls.h"
+#include "../container/deque.h"
+#include "../container/typed_vector.h"
+#include "../container/vector.h"
+
+// Most runs of different responses a client may have waiting.
+// When they are used up, the client's further requests stay in its receive buffer until some are written.
+#define BH2_CLIENT_OUT_RUNS 4
+
+// Consecutive waiting responses of the same kind, as pipelined requests usually are.
+typedef struct ResponseRun
+{
+    ResponseKind kind;
+    // If taken from closing_responses.
+    bool closing;
+    uint32_t count;
+} ResponseRun;
+
+// State of a client that only some features use. Only the clients that need it get it, see Client_Extras().
+typedef struct ClientExtras
+{
+    // Access records of the waiting responses as AccessRecord, completed when each one is written.
+    // Only used while the access log is open.
+    Vector access_pending;
+    // Records at the front of access_pending already written to the log.
+    size_t access_done;
+    // Number of the connection in the capture, when it was accepted, and if its CAPTURE_OPEN is recorded.
+    // Only used while capturing.
+    uint32_t capture_id;
+    bool capture_opened;
+    uint64_t capture_accepted;
+    // Values of the first waiting response while it's partly written from a template,
+    // the rest of it must be filled with the same ones.
+    TemplateValues out_values;
+    // Events waiting to be written to a subscriber as EventBuffer *, bytes of the first one already written,
+    // and the unwritten bytes of all of them.
+    Deque events;
+    size_t events_offset;
+    size_t events_backlog;
+    // HTTPS handshake in progress, NULL once it's done or for plain clients.
+    TlsHandshake *tls;
+    // HTTP/2 session, NULL for HTTP/1 clients.
+    Http2Session *h2;
+    // The RESPONSE_PARTIAL run waiting, a client has one at most. Made by Response_Partial().
+    Response partial;
+} ClientExtras;
+
 typedef struct Client
 {
     int socket_fd;
-    socklen_t addr_len;
-    struct sockaddr_storage addr;
+    // Peer port and address, IPv4 addresses are mapped into IPv6 (::ffff:a.b.c.d). All zero for unix sockets.
     uint16_t port;
+    uint8_t addr[16];
+    // Rate limit accounting of the peer address, NULL if not tracked.
+    RateLimitSlot *rate_slot;
+    // Pooled receive buffer, only attached while the client has an incomplete request.
+    char *recv_buf;
+    // Bytes of the incomplete request held in recv_buf.
+    size_t recv_len;
+    // Request body bytes still to be skipped.
+    size_t recv_skip;
+    // Responses waiting to be written, in order.
+    ResponseRun out_runs[BH2_CLIENT_OUT_RUNS];
+    size_t out_runs_len;
+    // Bytes of the first waiting response already written.
+    size_t out_offset;
+    // When it was put in the writing schedule, only kept while tracing.
+    uint64_t trace_scheduled;
+    // NULL until a feature needs it.
+    ClientExtras *extras;
+    // If reading is paused until the waiting responses are written.
+    bool recv_paused;
+    // If the client is in the data thread's writing schedule.
+    bool out_scheduled;
+    // If the connection ends after the waiting responses.
+    bool out_close;
+    // If the connection is an event stream, it takes no more requests then.
+    bool subscribed;
+    // If the connection speaks HTTP/2, its session is in the extras. Responses are written from there, not out_runs.
+    bool http2;
 } Client;
 
+///
+/// \brief Set the peer of a client
+///
+/// \param client Client to set
+/// \param addr Address the client was accepted from
+///
+void
+Client_SetPeer( Client *client, const struct sockaddr_storage *addr );
+
+///
+/// \brief Get the extras of a client
+///
+/// Allocate them on first use.
+///
+/// \param client Client
+///
+/// \return The extras, NULL if out of memory.
+///
+ClientExtras *
+Client_Extras( Client *client );
+
+///
+/// \brief Free the extras of a client
+///
+/// \param client Client, whose extras may be NULL
+///
+void
+Client_FreeExtras( Client *client );
+
+VECTOR_DEFINE(ClientVector, Client)
+
 #endif // !BH2_CONNECTION_CLIENT_H
@@ -0,0 +1,184 @@
+// accept4()
+#define _GNU_SOURCE
+
+#include "handoff.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Header of the message carrying the sockets.
+typedef struct HandoffHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+} HandoffHeader;
+
+static
+const char HANDOFF_MAGIC[4] = { 'B', 'H', '2', 'H' };
+
+static
+const uint32_t HANDOFF_VERSION = 1;
+
+// Successor's reply once it holds the sockets.
+static
+const char HANDOFF_ACK = 'K';
+
+// How long either side waits for the other.
+static
+const int HANDOFF_TIMEOUT_MS = 2000;
+
+static
+bool
+FillAddress( const char *path, struct sockaddr_un *addr )
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static
+bool
+WaitReadable( int fd )
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, HANDOFF_TIMEOUT_MS) == 1;
+}
+
+int
+Handoff_Listen( const char *path )
+{
+    struct sockaddr_un addr;
+    if (!FillAddress(path, &addr))
+        return -1;
+
+    int handoff_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (handoff_socket == -1)
+        return -1;
+
+    unlink(path);
+    if (bind(handoff_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(handoff_socket, 1) == -1)
+    {
+        close(handoff_socket);
+        return -1;
+    }
+
+    return handoff_socket;
+}
+
+int
+Handoff_Receive( const char *path, Vector *fds )
+{
+    struct sockaddr_un addr;
+    if (!FillAddress(path, &addr))
+        return -1;
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn == -1)
+        return -1;
+
+    if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        // Nobody to take over from.
+        int err = errno;
+        close(conn);
+        errno = err;
+        return err == ENOENT || err == ECONNREFUSED ? 0 : -1;
+    }
+
+    HandoffHeader header = { 0 };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * BH2_HANDOFF_MAX_FDS)];
+    struct msghdr msg =
+    {
+        .msg_iov = &(struct iovec){ .iov_base = &header, .iov_len = sizeof(header) },
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    if (!WaitReadable(conn) || recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(header))
+    {
+        close(conn);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    int received = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *cmsg_fds = (const int *)CMSG_DATA(cmsg);
+        for (size_t i = 0; i < count; i++, received++)
+        {
+            int fd = 0;
+            memcpy(&fd, cmsg_fds + i, sizeof(int));
+            Vector_Push(fds, &fd);
+        }
+    }
+
+    if (memcmp(header.magic, HANDOFF_MAGIC, sizeof(HANDOFF_MAGIC)) || header.version != HANDOFF_VERSION
+        || header.count != (uint32_t)received || (msg.msg_flags & MSG_CTRUNC))
+    {
+        for (size_t i = fds->length - received; i < fds->length; i++)
+            close(*(int *)Vector_PtrAt(fds, i));
+        fds->length -= received;
+        close(conn);
+        errno = EPROTO;
+        return -1;
+    }
+
+    // Let the old instance go.
+    send(conn, &HANDOFF_ACK, 1, MSG_NOSIGNAL);
+    close(conn);
+
+    return received;
+}
+
+bool
+Handoff_Send( int handoff_socket, const int *fds, size_t count )
+{
+    if (count > BH2_HANDOFF_MAX_FDS)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    int conn = accept4(handoff_socket, NULL, NULL, SOCK_CLOEXEC);
+    if (conn == -1)
+        return false;
+
+    HandoffHeader header = { .version = HANDOFF_VERSION, .count = (uint32_t)count };
+    memcpy(header.magic, HANDOFF_MAGIC, sizeof(HANDOFF_MAGIC));
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * BH2_HANDOFF_MAX_FDS)] = { 0 };
+    struct msghdr msg =
+    {
+        .msg_iov = &(struct iovec){ .iov_base = &header, .iov_len = sizeof(header) },
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * count)
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    char ack = 0;
+    bool taken = sendmsg(conn, &msg, MSG_NOSIGNAL) == sizeof(header)
+                 && WaitReadable(conn)
+                 && recv(conn, &ack, 1, 0) == 1
+                 && ack == HANDOFF_ACK;
+    close(conn);
+
+    return taken;
+}
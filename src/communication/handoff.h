@@ -0,0 +1,61 @@
+#ifndef BH2_COMMUNICATION_HANDOFF_H
+#define BH2_COMMUNICATION_HANDOFF_H
+
+#include <pch.h>
+
+#include "../container/vector.h"
+
+/*
+
+    Handing the listening sockets over to a newer instance, so upgrading never refuses a connection.
+
+    The running instance listens on a unix socket. A new instance connects to it, and receives the
+    listening sockets through SCM_RIGHTS. Once the new instance acknowledges them, the old one
+    stops accepting, drains its clients and ends, while the new one accepts on the same sockets
+    without binding them again.
+
+*/
+
+// Most listening sockets handed over at once.
+#define BH2_HANDOFF_MAX_FDS 64
+
+///
+/// \brief Listen for a successor
+///
+/// Create the unix socket that newer instances connect to. A stale socket file is replaced.
+///
+/// \param path Path of the unix socket
+///
+/// \return Listening socket, -1 on error.
+///
+int
+Handoff_Listen( const char *path );
+
+///
+/// \brief Take sockets over
+///
+/// Connect to the instance listening on the unix socket, and receive its listening sockets.
+///
+/// \param path Path of the unix socket
+/// \param fds Vector of int, retrieves the received sockets
+///
+/// \return Number of sockets received, 0 if no instance is listening, -1 on error.
+///
+int
+Handoff_Receive( const char *path, Vector *fds );
+
+///
+/// \brief Hand sockets over
+///
+/// Accept a successor on the unix socket and send it the sockets, waiting for its acknowledgement.
+///
+/// \param handoff_socket Socket created by \a Handoff_Listen()
+/// \param fds Sockets to hand over
+/// \param count Number of sockets, no more than \a BH2_HANDOFF_MAX_FDS
+///
+/// \return true if the successor has taken the sockets.
+///
+bool
+Handoff_Send( int handoff_socket, const int *fds, size_t count );
+
+#endif // !BH2_COMMUNICATION_HANDOFF_H
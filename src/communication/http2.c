@@ -0,0 +1,1375 @@
+#include "http2.h"
+
+#include "../container/deque.h"
+#include "../container/typed_vector.h"
+
+#define BH2_HTTP2_FRAME_HEADER_SIZE 9
+
+// Largest frame payload taken from clients, SETTINGS_MAX_FRAME_SIZE is left at its default.
+#define BH2_HTTP2_MAX_FRAME_PAYLOAD 16384
+
+// Flow control window of a connection and of new streams until the client's SETTINGS say otherwise,
+// and the largest one allowed.
+#define BH2_HTTP2_DEFAULT_WINDOW 65535
+#define BH2_HTTP2_MAX_WINDOW 0x7FFFFFFF
+
+// Frame bytes kept in the frame itself, enough for any control frame the server sends.
+#define BH2_HTTP2_FRAME_INLINE 24
+
+// Room for decoding a header field, Huffman strings grow by up to 8/5 and names may be copied out of the table.
+#define BH2_HTTP2_DECODE_SCRATCH (BH2_HTTP2_MAX_HEADER_BLOCK * 8 / 5 + BH2_HTTP2_HEADER_TABLE_SIZE)
+
+// Longest :path kept.
+#define BH2_HTTP2_MAX_PATH 8192
+
+typedef enum Http2FrameType
+{
+    HTTP2_FRAME_DATA = 0x0,
+    HTTP2_FRAME_HEADERS = 0x1,
+    HTTP2_FRAME_PRIORITY = 0x2,
+    HTTP2_FRAME_RST_STREAM = 0x3,
+    HTTP2_FRAME_SETTINGS = 0x4,
+    HTTP2_FRAME_PUSH_PROMISE = 0x5,
+    HTTP2_FRAME_PING = 0x6,
+    HTTP2_FRAME_GOAWAY = 0x7,
+    HTTP2_FRAME_WINDOW_UPDATE = 0x8,
+    HTTP2_FRAME_CONTINUATION = 0x9
+} Http2FrameType;
+
+#define BH2_HTTP2_FLAG_END_STREAM 0x1
+#define BH2_HTTP2_FLAG_ACK 0x1
+#define BH2_HTTP2_FLAG_END_HEADERS 0x4
+#define BH2_HTTP2_FLAG_PADDED 0x8
+#define BH2_HTTP2_FLAG_PRIORITY 0x20
+
+typedef enum Http2Setting
+{
+    HTTP2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    HTTP2_SETTINGS_ENABLE_PUSH = 0x2,
+    HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    HTTP2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    HTTP2_SETTINGS_MAX_FRAME_SIZE = 0x5
+} Http2Setting;
+
+typedef enum Http2Error
+{
+    HTTP2_NO_ERROR = 0x0,
+    HTTP2_PROTOCOL_ERROR = 0x1,
+    HTTP2_INTERNAL_ERROR = 0x2,
+    HTTP2_FLOW_CONTROL_ERROR = 0x3,
+    HTTP2_FRAME_SIZE_ERROR = 0x6,
+    HTTP2_REFUSED_STREAM = 0x7,
+    HTTP2_COMPRESSION_ERROR = 0x9,
+    HTTP2_ENHANCE_YOUR_CALM = 0xB
+} Http2Error;
+
+// Answer to an upgrading request, before the server's SETTINGS.
+static
+const char HTTP2_SWITCHING_PROTOCOLS[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                         "Connection: Upgrade\r\n"
+                                         "Upgrade: h2c\r\n\r\n";
+
+// A prebuilt response: its header block, and the body its DATA frames point into.
+typedef struct Http2Response
+{
+    uint8_t block[BH2_HTTP2_MAX_RESPONSE_BLOCK];
+    size_t block_size;
+    const char *body;
+    size_t body_size;
+    uint16_t status;
+} Http2Response;
+
+// A queued frame: its header, or the whole of a control frame, then the payload it points to.
+typedef struct Http2Frame
+{
+    const char *payload;
+    size_t payload_size;
+    // Stream the frame belongs to, and if it's the last of its response.
+    uint32_t stream_id;
+    bool ends_stream;
+    bool data;
+    uint8_t head_size;
+    uint8_t head[BH2_HTTP2_FRAME_INLINE];
+} Http2Frame;
+
+// A response in progress, until its last frame is written.
+typedef struct Http2Stream
+{
+    uint32_t id;
+    ResponseKind kind;
+    // Window the client gives the stream.
+    int64_t window;
+    // If HEADERS is queued, the body bytes queued as DATA, and if the last frame is queued.
+    bool headers_queued;
+    bool queued;
+    size_t body_offset;
+    AccessRecord access;
+} Http2Stream;
+
+VECTOR_DEFINE(Http2StreamVector, Http2Stream)
+
+// An entry of the HPACK dynamic table, its name and value back to back in the table's bytes.
+typedef struct Http2TableEntry
+{
+    uint16_t offset;
+    uint16_t name_len;
+    uint16_t value_len;
+} Http2TableEntry;
+
+struct Http2Session
+{
+    // Frames queued as Http2Frame, bytes of the first one already written, and bytes of all of them unwritten.
+    Deque frames;
+    size_t frame_offset;
+    size_t queued_bytes;
+    Http2StreamVector streams;
+    // Windows the client gives the connection and new streams, and the largest frame it takes.
+    int64_t window;
+    int64_t initial_window;
+    size_t max_frame_size;
+    // Highest stream the client has opened.
+    uint32_t last_stream_id;
+    // If the preface of an upgraded connection is still to come, and if the client's first SETTINGS came.
+    bool preface_pending;
+    bool settings_received;
+    // If either side went away, no more streams are taken. Failed sessions only write what's queued.
+    bool going_away;
+    bool failed;
+    // HPACK dynamic table of the requests, entries oldest first. Each one accounts 32 bytes more than it holds.
+    Http2TableEntry entries[BH2_HTTP2_HEADER_TABLE_SIZE / 32];
+    size_t entries_len;
+    size_t table_size;
+    size_t table_max;
+    size_t table_used;
+    char table_bytes[BH2_HTTP2_HEADER_TABLE_SIZE];
+};
+
+// HPACK static table.
+typedef struct Http2StaticEntry
+{
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+} Http2StaticEntry;
+
+#define BH2_HTTP2_STATIC_ENTRY(name, value) { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+
+static
+const Http2StaticEntry HTTP2_STATIC_TABLE[] =
+{
+    BH2_HTTP2_STATIC_ENTRY(":authority", ""),
+    BH2_HTTP2_STATIC_ENTRY(":method", "GET"),
+    BH2_HTTP2_STATIC_ENTRY(":method", "POST"),
+    BH2_HTTP2_STATIC_ENTRY(":path", "/"),
+    BH2_HTTP2_STATIC_ENTRY(":path", "/index.html"),
+    BH2_HTTP2_STATIC_ENTRY(":scheme", "http"),
+    BH2_HTTP2_STATIC_ENTRY(":scheme", "https"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "200"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "204"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "206"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "304"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "400"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "404"),
+    BH2_HTTP2_STATIC_ENTRY(":status", "500"),
+    BH2_HTTP2_STATIC_ENTRY("accept-charset", ""),
+    BH2_HTTP2_STATIC_ENTRY("accept-encoding", "gzip, deflate"),
+    BH2_HTTP2_STATIC_ENTRY("accept-language", ""),
+    BH2_HTTP2_STATIC_ENTRY("accept-ranges", ""),
+    BH2_HTTP2_STATIC_ENTRY("accept", ""),
+    BH2_HTTP2_STATIC_ENTRY("access-control-allow-origin", ""),
+    BH2_HTTP2_STATIC_ENTRY("age", ""),
+    BH2_HTTP2_STATIC_ENTRY("allow", ""),
+    BH2_HTTP2_STATIC_ENTRY("authorization", ""),
+    BH2_HTTP2_STATIC_ENTRY("cache-control", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-disposition", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-encoding", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-language", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-length", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-location", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-range", ""),
+    BH2_HTTP2_STATIC_ENTRY("content-type", ""),
+    BH2_HTTP2_STATIC_ENTRY("cookie", ""),
+    BH2_HTTP2_STATIC_ENTRY("date", ""),
+    BH2_HTTP2_STATIC_ENTRY("etag", ""),
+    BH2_HTTP2_STATIC_ENTRY("expect", ""),
+    BH2_HTTP2_STATIC_ENTRY("expires", ""),
+    BH2_HTTP2_STATIC_ENTRY("from", ""),
+    BH2_HTTP2_STATIC_ENTRY("host", ""),
+    BH2_HTTP2_STATIC_ENTRY("if-match", ""),
+    BH2_HTTP2_STATIC_ENTRY("if-modified-since", ""),
+    BH2_HTTP2_STATIC_ENTRY("if-none-match", ""),
+    BH2_HTTP2_STATIC_ENTRY("if-range", ""),
+    BH2_HTTP2_STATIC_ENTRY("if-unmodified-since", ""),
+    BH2_HTTP2_STATIC_ENTRY("last-modified", ""),
+    BH2_HTTP2_STATIC_ENTRY("link", ""),
+    BH2_HTTP2_STATIC_ENTRY("location", ""),
+    BH2_HTTP2_STATIC_ENTRY("max-forwards", ""),
+    BH2_HTTP2_STATIC_ENTRY("proxy-authenticate", ""),
+    BH2_HTTP2_STATIC_ENTRY("proxy-authorization", ""),
+    BH2_HTTP2_STATIC_ENTRY("range", ""),
+    BH2_HTTP2_STATIC_ENTRY("referer", ""),
+    BH2_HTTP2_STATIC_ENTRY("refresh", ""),
+    BH2_HTTP2_STATIC_ENTRY("retry-after", ""),
+    BH2_HTTP2_STATIC_ENTRY("server", ""),
+    BH2_HTTP2_STATIC_ENTRY("set-cookie", ""),
+    BH2_HTTP2_STATIC_ENTRY("strict-transport-security", ""),
+    BH2_HTTP2_STATIC_ENTRY("transfer-encoding", ""),
+    BH2_HTTP2_STATIC_ENTRY("user-agent", ""),
+    BH2_HTTP2_STATIC_ENTRY("vary", ""),
+    BH2_HTTP2_STATIC_ENTRY("via", ""),
+    BH2_HTTP2_STATIC_ENTRY("www-authenticate", "")
+};
+
+#define BH2_HTTP2_STATIC_TABLE_LEN (sizeof(HTTP2_STATIC_TABLE) / sizeof(HTTP2_STATIC_TABLE[0]))
+
+// Code lengths of the HPACK Huffman code by symbol, 256 being EOS. The code is canonical,
+// so the codes themselves follow from the lengths.
+static
+const uint8_t HUFFMAN_LENGTHS[257] =
+{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+#define BH2_HTTP2_HUFFMAN_MAX_LENGTH 30
+
+// Canonical decoding: the first code of every length, how many codes have it,
+// and where their symbols start in huffman_symbols, which is sorted by length then symbol.
+static
+uint32_t huffman_first[BH2_HTTP2_HUFFMAN_MAX_LENGTH + 1];
+static
+uint16_t huffman_count[BH2_HTTP2_HUFFMAN_MAX_LENGTH + 1];
+static
+uint16_t huffman_offset[BH2_HTTP2_HUFFMAN_MAX_LENGTH + 1];
+static
+uint16_t huffman_symbols[257];
+
+// Prebuilt responses, indexed by ResponseKind.
+static
+Http2Response http2_responses[RESPONSE_KIND_COUNT];
+
+// Header blocks spread over CONTINUATION frames, put back together.
+static
+uint8_t block_scratch[BH2_HTTP2_MAX_HEADER_BLOCK];
+
+// Name and value of the header field being decoded.
+static
+char decode_scratch[BH2_HTTP2_DECODE_SCRATCH];
+
+// :path of the last request.
+static
+char request_path[BH2_HTTP2_MAX_PATH];
+
+static
+uint32_t
+ReadUint32( const uint8_t *bytes )
+{
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+static
+void
+WriteUint32( uint8_t *bytes, uint32_t value )
+{
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+static
+void
+WriteFrameHeader( uint8_t *head, size_t size, Http2FrameType type, uint8_t flags, uint32_t stream_id )
+{
+    head[0] = (uint8_t)(size >> 16);
+    head[1] = (uint8_t)(size >> 8);
+    head[2] = (uint8_t)size;
+    head[3] = (uint8_t)type;
+    head[4] = flags;
+    WriteUint32(head + 5, stream_id);
+}
+
+// ------------------- Response encoding ---------------------
+
+static
+void
+BuildHuffman( void )
+{
+    memset(huffman_count, 0, sizeof(huffman_count));
+    for (size_t symbol = 0; symbol < 257; symbol++)
+        huffman_count[HUFFMAN_LENGTHS[symbol]]++;
+
+    uint16_t next[BH2_HTTP2_HUFFMAN_MAX_LENGTH + 1] = { 0 };
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    for (size_t length = 1; length <= BH2_HTTP2_HUFFMAN_MAX_LENGTH; length++)
+    {
+        huffman_first[length] = code;
+        huffman_offset[length] = next[length] = offset;
+        offset += huffman_count[length];
+        code = (code + huffman_count[length]) << 1;
+    }
+    for (size_t symbol = 0; symbol < 257; symbol++)
+        huffman_symbols[next[HUFFMAN_LENGTHS[symbol]]++] = (uint16_t)symbol;
+}
+
+// Append an HPACK integer, its first byte starting with the bits of first above the prefix.
+static
+bool
+EncodeInteger( Http2Response *response, uint8_t first, unsigned prefix_bits, size_t value )
+{
+    size_t max_prefix = ((size_t)1 << prefix_bits) - 1;
+    if (response->block_size >= sizeof(response->block))
+        return false;
+    if (value < max_prefix)
+    {
+        response->block[response->block_size++] = first | (uint8_t)value;
+        return true;
+    }
+    response->block[response->block_size++] = first | (uint8_t)max_prefix;
+    for (value -= max_prefix; ; value >>= 7)
+    {
+        if (response->block_size >= sizeof(response->block))
+            return false;
+        response->block[response->block_size++] = (uint8_t)(value & 0x7F) | (value >= 0x80 ? 0x80 : 0);
+        if (value < 0x80)
+            return true;
+    }
+}
+
+// Append a string literal, never Huffman coded.
+static
+bool
+EncodeString( Http2Response *response, const char *text, size_t text_len )
+{
+    if (!EncodeInteger(response, 0x00, 7, text_len) || sizeof(response->block) - response->block_size < text_len)
+        return false;
+    memcpy(response->block + response->block_size, text, text_len);
+    response->block_size += text_len;
+    return true;
+}
+
+// Append a header field, indexed if the static table has it, otherwise as a literal
+// that never goes into the client's dynamic table, so the block is the same on every stream.
+static
+bool
+EncodeField( Http2Response *response, const char *name, size_t name_len, const char *value, size_t value_len )
+{
+    size_t name_index = 0;
+    for (size_t i = 0; i < BH2_HTTP2_STATIC_TABLE_LEN; i++)
+    {
+        const Http2StaticEntry *entry = &HTTP2_STATIC_TABLE[i];
+        if (entry->name_len != name_len || memcmp(entry->name, name, name_len))
+            continue;
+        if (entry->value_len == value_len && !memcmp(entry->value, value, value_len))
+            return EncodeInteger(response, 0x80, 7, i + 1);
+        if (!name_index)
+            name_index = i + 1;
+    }
+    if (name_index)
+        return EncodeInteger(response, 0x00, 4, name_index) && EncodeString(response, value, value_len);
+    return EncodeInteger(response, 0x00, 4, 0) && EncodeString(response, name, name_len) && EncodeString(response, value, value_len);
+}
+
+// Encode the header of a prebuilt response, dropping the fields HTTP/2 has no use for.
+static
+bool
+BuildResponse( const Response *source, Http2Response *response )
+{
+    *response = (Http2Response){ .status = source->status };
+    char status[8];
+    int status_len = snprintf(status, sizeof(status), "%u", source->status);
+    if (!EncodeField(response, ":status", sizeof(":status") - 1, status, (size_t)status_len))
+        return false;
+
+    // Header fields follow the status line, up to the empty line.
+    const char *line = memchr(source->head, '\n', source->head_size);
+    const char *end = source->head + source->head_size;
+    if (!line)
+        return false;
+    for (line++; line < end; )
+    {
+        const char *lf = memchr(line, '\n', end - line);
+        if (!lf)
+            return false;
+        size_t line_len = lf - line;
+        if (line_len && line[line_len - 1] == '\r')
+            line_len--;
+        if (!line_len)
+        {
+            line = lf + 1;
+            break;
+        }
+
+        const char *colon = memchr(line, ':', line_len);
+        if (!colon)
+            return false;
+        char name[64];
+        size_t name_len = colon - line;
+        if (name_len >= sizeof(name))
+            return false;
+        for (size_t i = 0; i < name_len; i++)
+            name[i] = (char)tolower((unsigned char)line[i]);
+        const char *value = colon + 1;
+        size_t value_len = line + line_len - value;
+        while (value_len && *value == ' ')
+        {
+            value++;
+            value_len--;
+        }
+
+        // Connection-specific fields are not allowed, and streams are not answered partially.
+        bool dropped = (name_len == sizeof("connection") - 1 && !memcmp(name, "connection", name_len)) ||
+                       (name_len == sizeof("keep-alive") - 1 && !memcmp(name, "keep-alive", name_len)) ||
+                       (name_len == sizeof("accept-ranges") - 1 && !memcmp(name, "accept-ranges", name_len));
+        if (!dropped && !EncodeField(response, name, name_len, value, value_len))
+            return false;
+        line = lf + 1;
+    }
+
+    // The body is what follows the header in one piece, or where it's kept apart.
+    response->body = line;
+    response->body_size = end - line;
+    if (source->body_size)
+    {
+        response->body = source->body;
+        response->body_size = source->body_size;
+    }
+    return true;
+}
+
+bool
+Http2_Init( void )
+{
+    BuildHuffman();
+    for (size_t kind = 0; kind < RESPONSE_KIND_COUNT; kind++)
+    {
+        // Their bodies change or never end, the page answers them. So it does ranges of itself.
+        if (kind == RESPONSE_MEMORY || kind == RESPONSE_EVENTS || kind == RESPONSE_PARTIAL)
+            continue;
+        if (responses[kind].template || !BuildResponse(&responses[kind], &http2_responses[kind]))
+            return false;
+    }
+    http2_responses[RESPONSE_MEMORY] = http2_responses[RESPONSE_PAGE];
+    http2_responses[RESPONSE_EVENTS] = http2_responses[RESPONSE_PAGE];
+    http2_responses[RESPONSE_PARTIAL] = http2_responses[RESPONSE_PAGE];
+    return true;
+}
+
+// ------------------- Frame queue ---------------------------
+
+static
+bool
+PushFrame( Http2Session *session, const Http2Frame *frame )
+{
+    if (!Deque_Push(&session->frames, frame))
+        return false;
+    session->queued_bytes += frame->head_size + frame->payload_size;
+    return true;
+}
+
+// Break the connection. GOAWAY tells the client why, and the streams not queued yet are dropped.
+static
+Http2Result
+Fail( Http2Session *session, Http2Error error )
+{
+    if (!session->failed)
+    {
+        Http2Frame frame = { .head_size = BH2_HTTP2_FRAME_HEADER_SIZE + 8 };
+        WriteFrameHeader(frame.head, 8, HTTP2_FRAME_GOAWAY, 0, 0);
+        WriteUint32(frame.head + 9, session->last_stream_id);
+        WriteUint32(frame.head + 13, error);
+        PushFrame(session, &frame);
+        session->failed = true;
+        session->going_away = true;
+        Http2StreamVector_Clear(&session->streams);
+    }
+    return HTTP2_FAILED;
+}
+
+// Queue a control frame with its payload inline.
+// A client making the server queue too many of them without reading is dropped.
+static
+bool
+QueueControl( Http2Session *session, Http2FrameType type, uint8_t flags, uint32_t stream_id, const uint8_t *payload, size_t payload_size )
+{
+    if (session->frames.length >= BH2_HTTP2_MAX_FRAMES)
+    {
+        Fail(session, HTTP2_ENHANCE_YOUR_CALM);
+        return false;
+    }
+    Http2Frame frame = { .head_size = (uint8_t)(BH2_HTTP2_FRAME_HEADER_SIZE + payload_size) };
+    WriteFrameHeader(frame.head, payload_size, type, flags, stream_id);
+    if (payload_size)
+        memcpy(frame.head + BH2_HTTP2_FRAME_HEADER_SIZE, payload, payload_size);
+    if (!PushFrame(session, &frame))
+    {
+        Fail(session, HTTP2_INTERNAL_ERROR);
+        return false;
+    }
+    return true;
+}
+
+static
+bool
+QueueWindowUpdate( Http2Session *session, uint32_t stream_id, size_t increment )
+{
+    uint8_t payload[4];
+    WriteUint32(payload, (uint32_t)increment);
+    return QueueControl(session, HTTP2_FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+static
+bool
+QueueReset( Http2Session *session, uint32_t stream_id, Http2Error error )
+{
+    uint8_t payload[4];
+    WriteUint32(payload, error);
+    return QueueControl(session, HTTP2_FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+static
+Http2Stream *
+FindStream( Http2Session *session, uint32_t stream_id, size_t *index )
+{
+    for (size_t i = 0; i < session->streams.length; i++)
+    {
+        Http2Stream *stream = Http2StreamVector_At(&session->streams, i);
+        if (stream->id == stream_id)
+        {
+            if (index)
+                *index = i;
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+Http2Session *
+Http2_Open( bool upgraded )
+{
+    Http2Session *session = calloc(1, sizeof(Http2Session));
+    if (!session)
+        return NULL;
+    session->frames = Deque_CreateS(sizeof(Http2Frame));
+    session->streams = Http2StreamVector_CreateS();
+    session->window = session->initial_window = BH2_HTTP2_DEFAULT_WINDOW;
+    session->max_frame_size = BH2_HTTP2_MAX_FRAME_PAYLOAD;
+    session->table_max = BH2_HTTP2_HEADER_TABLE_SIZE;
+
+    if (upgraded)
+    {
+        // The upgrading request is stream 1, and the client sends its preface once it has read the 101.
+        Http2Frame switching = { .payload = HTTP2_SWITCHING_PROTOCOLS, .payload_size = sizeof(HTTP2_SWITCHING_PROTOCOLS) - 1 };
+        PushFrame(session, &switching);
+        session->last_stream_id = 1;
+        session->preface_pending = true;
+    }
+
+    uint8_t settings[6] = { 0, HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS };
+    WriteUint32(settings + 2, BH2_HTTP2_MAX_STREAMS);
+    QueueControl(session, HTTP2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+    if (session->failed)
+    {
+        Http2_Close(session);
+        return NULL;
+    }
+    return session;
+}
+
+// Apply the parameters of a SETTINGS payload. Returns the error they are, HTTP2_NO_ERROR if none.
+static
+Http2Error
+ApplySettings( Http2Session *session, const uint8_t *payload, size_t size )
+{
+    if (size % 6)
+        return HTTP2_FRAME_SIZE_ERROR;
+    for (size_t i = 0; i < size; i += 6)
+    {
+        uint16_t id = (uint16_t)(payload[i] << 8 | payload[i + 1]);
+        uint32_t value = ReadUint32(payload + i + 2);
+        switch (id)
+        {
+            case HTTP2_SETTINGS_ENABLE_PUSH:
+                if (value > 1)
+                    return HTTP2_PROTOCOL_ERROR;
+                break;
+            case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if (value > BH2_HTTP2_MAX_WINDOW)
+                    return HTTP2_FLOW_CONTROL_ERROR;
+                // Streams in progress take the difference, which may not take a window past the largest one.
+                int64_t delta = (int64_t)value - session->initial_window;
+                for (size_t s = 0; s < session->streams.length; s++)
+                    if (Http2StreamVector_At(&session->streams, s)->window + delta > BH2_HTTP2_MAX_WINDOW)
+                        return HTTP2_FLOW_CONTROL_ERROR;
+                for (size_t s = 0; s < session->streams.length; s++)
+                    Http2StreamVector_At(&session->streams, s)->window += delta;
+                session->initial_window = value;
+                break;
+            }
+            case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+                if (value < BH2_HTTP2_MAX_FRAME_PAYLOAD || value > 0xFFFFFF)
+                    return HTTP2_PROTOCOL_ERROR;
+                session->max_frame_size = value;
+                break;
+            default:
+                // Responses never use the client's dynamic table, the server never pushes, and the rest are of no concern.
+                break;
+        }
+    }
+    return HTTP2_NO_ERROR;
+}
+
+// Value of a base64url character, -1 if it's none.
+static
+int
+Base64UrlValue( char c )
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '-')
+        return 62;
+    if (c == '_')
+        return 63;
+    return -1;
+}
+
+bool
+Http2_ApplyUpgradeSettings( Http2Session *session, const char *value, size_t value_len )
+{
+    // Six bytes per setting, a client has no reason to send more than a few.
+    uint8_t payload[96];
+    size_t size = 0;
+    uint32_t bits = 0;
+    unsigned bit_count = 0;
+    while (value_len && value[value_len - 1] == '=')
+        value_len--;
+    for (size_t i = 0; i < value_len; i++)
+    {
+        int digit = Base64UrlValue(value[i]);
+        if (digit < 0)
+            return false;
+        bits = bits << 6 | (uint32_t)digit;
+        bit_count += 6;
+        if (bit_count >= 8)
+        {
+            if (size == sizeof(payload))
+                return false;
+            bit_count -= 8;
+            payload[size++] = (uint8_t)(bits >> bit_count);
+        }
+    }
+    // The 101 acknowledges them, no SETTINGS ACK follows.
+    return ApplySettings(session, payload, size) == HTTP2_NO_ERROR;
+}
+
+// ------------------- Header decoding -----------------------
+
+static
+bool
+DecodeInteger( const uint8_t **pos, const uint8_t *end, unsigned prefix_bits, size_t *value )
+{
+    if (*pos >= end)
+        return false;
+    size_t max_prefix = ((size_t)1 << prefix_bits) - 1;
+    size_t decoded = *(*pos)++ & max_prefix;
+    if (decoded == max_prefix)
+    {
+        for (unsigned shift = 0; ; shift += 7)
+        {
+            // Nothing in a header block needs more than 28 bits.
+            if (*pos >= end || shift > 21)
+                return false;
+            uint8_t byte = *(*pos)++;
+            decoded += (size_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+    }
+    *value = decoded;
+    return true;
+}
+
+static
+bool
+DecodeHuffman( const uint8_t *bytes, size_t length, char *out, size_t room, size_t *out_len )
+{
+    uint32_t code = 0;
+    size_t bits = 0, decoded = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            code = code << 1 | ((bytes[i] >> bit) & 1);
+            bits++;
+            // Codes of a length are consecutive from its first one, and longer codes start above them.
+            uint32_t rank = code - huffman_first[bits];
+            if (code >= huffman_first[bits] && rank < huffman_count[bits])
+            {
+                uint16_t symbol = huffman_symbols[huffman_offset[bits] + rank];
+                if (symbol == 256 || decoded == room)
+                    return false;
+                out[decoded++] = (char)symbol;
+                code = 0;
+                bits = 0;
+            }
+            else if (bits == BH2_HTTP2_HUFFMAN_MAX_LENGTH)
+                return false;
+        }
+    }
+    // What's left is padding, the start of EOS: less than a byte, all ones.
+    if (bits > 7 || code != ((uint32_t)1 << bits) - 1)
+        return false;
+    *out_len = decoded;
+    return true;
+}
+
+static
+bool
+DecodeString( const uint8_t **pos, const uint8_t *end, char *out, size_t room, size_t *out_len )
+{
+    if (*pos >= end)
+        return false;
+    bool huffman = **pos & 0x80;
+    size_t length = 0;
+    if (!DecodeInteger(pos, end, 7, &length) || length > (size_t)(end - *pos))
+        return false;
+    if (huffman)
+    {
+        if (!DecodeHuffman(*pos, length, out, room, out_len))
+            return false;
+    }
+    else
+    {
+        if (length > room)
+            return false;
+        memcpy(out, *pos, length);
+        *out_len = length;
+    }
+    *pos += length;
+    return true;
+}
+
+// Get a field of the static or dynamic table by its HPACK index.
+static
+bool
+LookUpField( const Http2Session *session, size_t index, const char **name, size_t *name_len, const char **value, size_t *value_len )
+{
+    if (!index)
+        return false;
+    if (index <= BH2_HTTP2_STATIC_TABLE_LEN)
+    {
+        const Http2StaticEntry *entry = &HTTP2_STATIC_TABLE[index - 1];
+        *name = entry->name;
+        *name_len = entry->name_len;
+        *value = entry->value;
+        *value_len = entry->value_len;
+        return true;
+    }
+    // Dynamic entries are numbered from the newest.
+    index -= BH2_HTTP2_STATIC_TABLE_LEN + 1;
+    if (index >= session->entries_len)
+        return false;
+    const Http2TableEntry *entry = &session->entries[session->entries_len - 1 - index];
+    *name = session->table_bytes + entry->offset;
+    *name_len = entry->name_len;
+    *value = *name + entry->name_len;
+    *value_len = entry->value_len;
+    return true;
+}
+
+// Evict the oldest entries until the table has room for size more.
+static
+void
+EvictFields( Http2Session *session, size_t size )
+{
+    size_t evicted = 0, evicted_bytes = 0;
+    while (evicted < session->entries_len && session->table_size + size > session->table_max)
+    {
+        const Http2TableEntry *entry = &session->entries[evicted++];
+        evicted_bytes += entry->name_len + entry->value_len;
+        session->table_size -= entry->name_len + entry->value_len + 32;
+    }
+    if (!evicted)
+        return;
+
+    session->entries_len -= evicted;
+    memmove(session->entries, session->entries + evicted, sizeof(Http2TableEntry) * session->entries_len);
+    for (size_t i = 0; i < session->entries_len; i++)
+        session->entries[i].offset -= (uint16_t)evicted_bytes;
+    session->table_used -= evicted_bytes;
+    memmove(session->table_bytes, session->table_bytes + evicted_bytes, session->table_used);
+}
+
+static
+void
+InsertField( Http2Session *session, const char *name, size_t name_len, const char *value, size_t value_len )
+{
+    size_t size = name_len + value_len + 32;
+    EvictFields(session, size);
+    // A field larger than the whole table just empties it.
+    if (size > session->table_max)
+        return;
+
+    Http2TableEntry *entry = &session->entries[session->entries_len++];
+    *entry = (Http2TableEntry){ .offset = (uint16_t)session->table_used, .name_len = (uint16_t)name_len, .value_len = (uint16_t)value_len };
+    memcpy(session->table_bytes + session->table_used, name, name_len);
+    memcpy(session->table_bytes + session->table_used + name_len, value, value_len);
+    session->table_used += name_len + value_len;
+    session->table_size += size;
+}
+
+// Keep what the request needs of a header field.
+static
+void
+TakeField( Http2Request *request, const char *name, size_t name_len, const char *value, size_t value_len, size_t max_path_len )
+{
+    if (name_len == sizeof(":method") - 1 && !memcmp(name, ":method", name_len))
+    {
+        request->has_method = true;
+        if (value_len == 3 && !memcmp(value, "GET", 3))
+            request->method = REQUEST_METHOD_GET;
+        else if (value_len == 4 && !memcmp(value, "HEAD", 4))
+            request->method = REQUEST_METHOD_HEAD;
+        else if (value_len == 7 && !memcmp(value, "OPTIONS", 7))
+            request->method = REQUEST_METHOD_OPTIONS;
+        else
+            request->method = REQUEST_METHOD_OTHER;
+    }
+    else if (name_len == sizeof(":path") - 1 && !memcmp(name, ":path", name_len))
+    {
+        if (value_len > max_path_len || value_len > sizeof(request_path))
+        {
+            request->path = NULL;
+            request->path_too_long = true;
+            return;
+        }
+        memcpy(request_path, value, value_len);
+        request->path = request_path;
+        request->path_len = value_len;
+        request->path_too_long = false;
+    }
+}
+
+static
+bool
+DecodeHeaderBlock( Http2Session *session, const uint8_t *block, size_t size, size_t max_path_len, Http2Request *request )
+{
+    const uint8_t *pos = block, *end = block + size;
+    // Table size updates only come before the first field.
+    bool field_decoded = false;
+    while (pos < end)
+    {
+        uint8_t first = *pos;
+        const char *name = NULL, *value = NULL;
+        size_t name_len = 0, value_len = 0, index = 0;
+        if (first & 0x80)
+        {
+            // Indexed field.
+            if (!DecodeInteger(&pos, end, 7, &index) || !LookUpField(session, index, &name, &name_len, &value, &value_len))
+                return false;
+        }
+        else if ((first & 0xE0) == 0x20)
+        {
+            // Table size update, up to what the server allows.
+            if (field_decoded || !DecodeInteger(&pos, end, 5, &index) || index > BH2_HTTP2_HEADER_TABLE_SIZE)
+                return false;
+            session->table_max = index;
+            EvictFields(session, 0);
+            continue;
+        }
+        else
+        {
+            // Literal, added to the table or not. Its name is copied out of the table before anything is evicted.
+            bool indexing = (first & 0xC0) == 0x40;
+            if (!DecodeInteger(&pos, end, indexing ? 6 : 4, &index))
+                return false;
+            if (index)
+            {
+                const char *indexed_value = NULL;
+                size_t indexed_value_len = 0;
+                if (!LookUpField(session, index, &name, &name_len, &indexed_value, &indexed_value_len))
+                    return false;
+                memcpy(decode_scratch, name, name_len);
+            }
+            else if (!DecodeString(&pos, end, decode_scratch, sizeof(decode_scratch), &name_len))
+                return false;
+            name = decode_scratch;
+            if (!DecodeString(&pos, end, decode_scratch + name_len, sizeof(decode_scratch) - name_len, &value_len))
+                return false;
+            value = decode_scratch + name_len;
+            if (indexing)
+                InsertField(session, name, name_len, value, value_len);
+        }
+        field_decoded = true;
+        TakeField(request, name, name_len, value, value_len, max_path_len);
+    }
+    return true;
+}
+
+// ------------------- Frame reading -------------------------
+
+// Read a header block starting with the HEADERS frame at bytes, with its CONTINUATION frames, and decode it.
+// span retrieves the bytes of its frames, 0 if they are not all here yet.
+static
+Http2Result
+ReadHeaderBlock( Http2Session *session, const uint8_t *bytes, size_t length, size_t max_path_len, size_t *span, Http2Request *request )
+{
+    *span = 0;
+    size_t size = (size_t)bytes[0] << 16 | (size_t)bytes[1] << 8 | bytes[2];
+    uint8_t flags = bytes[4];
+    uint32_t stream_id = ReadUint32(bytes + 5) & 0x7FFFFFFF;
+    const uint8_t *fragment = bytes + BH2_HTTP2_FRAME_HEADER_SIZE;
+    size_t fragment_size = size;
+    if (!stream_id)
+        return Fail(session, HTTP2_PROTOCOL_ERROR);
+    if (flags & BH2_HTTP2_FLAG_PADDED)
+    {
+        if (!fragment_size || fragment[0] >= fragment_size)
+            return Fail(session, HTTP2_PROTOCOL_ERROR);
+        fragment_size -= 1 + fragment[0];
+        fragment++;
+    }
+    if (flags & BH2_HTTP2_FLAG_PRIORITY)
+    {
+        if (fragment_size < 5)
+            return Fail(session, HTTP2_PROTOCOL_ERROR);
+        fragment += 5;
+        fragment_size -= 5;
+    }
+
+    const uint8_t *block = fragment;
+    size_t block_size = fragment_size, offset = BH2_HTTP2_FRAME_HEADER_SIZE + size;
+    if (!(flags & BH2_HTTP2_FLAG_END_HEADERS))
+    {
+        // Put the fragments back together once they are all here.
+        if (fragment_size > sizeof(block_scratch))
+            return Fail(session, HTTP2_ENHANCE_YOUR_CALM);
+        memcpy(block_scratch, fragment, fragment_size);
+        block = block_scratch;
+        for (bool ended = false; !ended; )
+        {
+            if (length - offset < BH2_HTTP2_FRAME_HEADER_SIZE)
+                return HTTP2_NEED_MORE;
+            const uint8_t *frame = bytes + offset;
+            size_t continuation_size = (size_t)frame[0] << 16 | (size_t)frame[1] << 8 | frame[2];
+            if (frame[3] != HTTP2_FRAME_CONTINUATION || (ReadUint32(frame + 5) & 0x7FFFFFFF) != stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (continuation_size > BH2_HTTP2_MAX_FRAME_PAYLOAD)
+                return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+            if (block_size + continuation_size > sizeof(block_scratch) || offset > 2 * BH2_HTTP2_MAX_HEADER_BLOCK)
+                return Fail(session, HTTP2_ENHANCE_YOUR_CALM);
+            if (length - offset < BH2_HTTP2_FRAME_HEADER_SIZE + continuation_size)
+                return HTTP2_NEED_MORE;
+            memcpy(block_scratch + block_size, frame + BH2_HTTP2_FRAME_HEADER_SIZE, continuation_size);
+            block_size += continuation_size;
+            offset += BH2_HTTP2_FRAME_HEADER_SIZE + continuation_size;
+            ended = frame[4] & BH2_HTTP2_FLAG_END_HEADERS;
+        }
+    }
+    *span = offset;
+
+    // Every block is decoded, even the ones ignored, or the dynamic table would be off.
+    *request = (Http2Request){ .stream_id = stream_id };
+    if (!DecodeHeaderBlock(session, block, block_size, max_path_len, request))
+        return Fail(session, HTTP2_COMPRESSION_ERROR);
+
+    // Client streams are odd. Blocks on streams already opened are trailers, and streams opened
+    // after going away are ignored.
+    if (!(stream_id & 1))
+        return Fail(session, HTTP2_PROTOCOL_ERROR);
+    if (stream_id <= session->last_stream_id)
+        return HTTP2_NEED_MORE;
+    session->last_stream_id = stream_id;
+    return session->going_away ? HTTP2_NEED_MORE : HTTP2_REQUEST;
+}
+
+// Take the unsent frames of a stream the client reset out of the queue, giving their window back.
+static
+void
+DropStreamFrames( Http2Session *session, uint32_t stream_id )
+{
+    // The first frame may be partly written.
+    for (size_t i = session->frame_offset ? 1 : 0; i < session->frames.length; )
+    {
+        Http2Frame *frame = Deque_PtrAt(&session->frames, i);
+        if (frame->stream_id != stream_id)
+        {
+            i++;
+            continue;
+        }
+        if (frame->data)
+            session->window += frame->payload_size;
+        session->queued_bytes -= frame->head_size + frame->payload_size;
+        Deque_Delete(&session->frames, i);
+    }
+}
+
+// Process a complete frame other than HEADERS.
+static
+Http2Result
+ProcessFrame( Http2Session *session, const uint8_t *frame, size_t size )
+{
+    uint8_t type = frame[3], flags = frame[4];
+    uint32_t stream_id = ReadUint32(frame + 5) & 0x7FFFFFFF;
+    const uint8_t *payload = frame + BH2_HTTP2_FRAME_HEADER_SIZE;
+    size_t index = 0;
+    Http2Stream *stream = NULL;
+
+    switch (type)
+    {
+        case HTTP2_FRAME_DATA:
+            // Bodies are read away, and the windows they took given back right away.
+            if (!stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (size && !QueueWindowUpdate(session, 0, size))
+                return HTTP2_FAILED;
+            if (size && !(flags & BH2_HTTP2_FLAG_END_STREAM) && !QueueWindowUpdate(session, stream_id, size))
+                return HTTP2_FAILED;
+            break;
+        case HTTP2_FRAME_PRIORITY:
+            if (!stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (size != 5)
+                return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+            break;
+        case HTTP2_FRAME_RST_STREAM:
+            if (!stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (size != 4)
+                return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+            if ((stream = FindStream(session, stream_id, &index)))
+            {
+                Http2StreamVector_Delete(&session->streams, index);
+                DropStreamFrames(session, stream_id);
+            }
+            break;
+        case HTTP2_FRAME_SETTINGS:
+        {
+            if (stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (flags & BH2_HTTP2_FLAG_ACK)
+            {
+                if (size)
+                    return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+                break;
+            }
+            Http2Error error = ApplySettings(session, payload, size);
+            if (error != HTTP2_NO_ERROR)
+                return Fail(session, error);
+            session->settings_received = true;
+            if (!QueueControl(session, HTTP2_FRAME_SETTINGS, BH2_HTTP2_FLAG_ACK, 0, NULL, 0))
+                return HTTP2_FAILED;
+            break;
+        }
+        case HTTP2_FRAME_PING:
+            if (stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (size != 8)
+                return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+            if (!(flags & BH2_HTTP2_FLAG_ACK) && !QueueControl(session, HTTP2_FRAME_PING, BH2_HTTP2_FLAG_ACK, 0, payload, 8))
+                return HTTP2_FAILED;
+            break;
+        case HTTP2_FRAME_GOAWAY:
+            if (stream_id)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (size < 8)
+                return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+            // The streams in progress are still answered.
+            session->going_away = true;
+            break;
+        case HTTP2_FRAME_WINDOW_UPDATE:
+        {
+            if (size != 4)
+                return Fail(session, HTTP2_FRAME_SIZE_ERROR);
+            uint32_t increment = ReadUint32(payload) & 0x7FFFFFFF;
+            if (!increment)
+                return Fail(session, HTTP2_PROTOCOL_ERROR);
+            if (!stream_id)
+            {
+                session->window += increment;
+                if (session->window > BH2_HTTP2_MAX_WINDOW)
+                    return Fail(session, HTTP2_FLOW_CONTROL_ERROR);
+            }
+            else if ((stream = FindStream(session, stream_id, NULL)))
+            {
+                stream->window += increment;
+                if (stream->window > BH2_HTTP2_MAX_WINDOW)
+                    return Fail(session, HTTP2_FLOW_CONTROL_ERROR);
+            }
+            break;
+        }
+        case HTTP2_FRAME_PUSH_PROMISE:
+        case HTTP2_FRAME_CONTINUATION:
+            // Clients don't push, and CONTINUATION is only taken right after its HEADERS.
+            return Fail(session, HTTP2_PROTOCOL_ERROR);
+        default:
+            // Unknown frames are ignored.
+            break;
+    }
+    return HTTP2_NEED_MORE;
+}
+
+Http2Result
+Http2_Receive( Http2Session *session, const char *bytes, size_t length, size_t max_path_len, size_t *used, Http2Request *request )
+{
+    const uint8_t *input = (const uint8_t *)bytes;
+    size_t consumed = 0;
+    *used = 0;
+    if (session->failed)
+    {
+        *used = length;
+        return HTTP2_FAILED;
+    }
+
+    if (session->preface_pending)
+    {
+        size_t compared = length < BH2_HTTP2_PREFACE_SIZE ? length : BH2_HTTP2_PREFACE_SIZE;
+        if (memcmp(bytes, BH2_HTTP2_PREFACE, compared))
+        {
+            *used = length;
+            return Fail(session, HTTP2_PROTOCOL_ERROR);
+        }
+        if (compared < BH2_HTTP2_PREFACE_SIZE)
+            return HTTP2_NEED_MORE;
+        session->preface_pending = false;
+        consumed = BH2_HTTP2_PREFACE_SIZE;
+    }
+
+    Http2Result result = HTTP2_NEED_MORE;
+    while (length - consumed >= BH2_HTTP2_FRAME_HEADER_SIZE && result == HTTP2_NEED_MORE)
+    {
+        const uint8_t *frame = input + consumed;
+        size_t size = (size_t)frame[0] << 16 | (size_t)frame[1] << 8 | frame[2];
+        if (size > BH2_HTTP2_MAX_FRAME_PAYLOAD)
+            result = Fail(session, HTTP2_FRAME_SIZE_ERROR);
+        else if (!session->settings_received && frame[3] != HTTP2_FRAME_SETTINGS)
+            // The preface ends with the client's SETTINGS.
+            result = Fail(session, HTTP2_PROTOCOL_ERROR);
+        else if (length - consumed < BH2_HTTP2_FRAME_HEADER_SIZE + size)
+            break;
+        else if (frame[3] == HTTP2_FRAME_HEADERS)
+        {
+            size_t span = 0;
+            result = ReadHeaderBlock(session, frame, length - consumed, max_path_len, &span, request);
+            if (!span && result == HTTP2_NEED_MORE)
+                break;
+            consumed += span;
+        }
+        else
+        {
+            result = ProcessFrame(session, frame, size);
+            consumed += BH2_HTTP2_FRAME_HEADER_SIZE + size;
+        }
+    }
+
+    // Nothing more is read off a failed session.
+    *used = result == HTTP2_FAILED ? length : consumed;
+    return result;
+}
+
+// ------------------- Responses -----------------------------
+
+bool
+Http2_Respond( Http2Session *session, uint32_t stream_id, ResponseKind kind, const AccessRecord *access )
+{
+    if (session->failed)
+        return false;
+    if (session->streams.length >= BH2_HTTP2_MAX_STREAMS)
+    {
+        QueueReset(session, stream_id, HTTP2_REFUSED_STREAM);
+        return false;
+    }
+    Http2Stream stream = { .id = stream_id, .kind = kind, .window = session->initial_window, .access = *access };
+    Http2StreamVector_Push(&session->streams, &stream);
+    return true;
+}
+
+void
+Http2_QueueFrames( Http2Session *session )
+{
+    // A frame per stream each round, so a long response doesn't hold the others up.
+    // Half the queue is left for control frames.
+    for (bool progress = true; progress; )
+    {
+        progress = false;
+        for (size_t i = 0; i < session->streams.length && session->frames.length < BH2_HTTP2_MAX_FRAMES / 2; i++)
+        {
+            Http2Stream *stream = Http2StreamVector_At(&session->streams, i);
+            if (stream->queued)
+                continue;
+            const Http2Response *response = &http2_responses[stream->kind];
+            Http2Frame frame = { .stream_id = stream->id, .head_size = BH2_HTTP2_FRAME_HEADER_SIZE };
+
+            if (!stream->headers_queued)
+            {
+                // The prebuilt block fits in a frame of any size.
+                frame.payload = (const char *)response->block;
+                frame.payload_size = response->block_size;
+                frame.ends_stream = !response->body_size;
+                WriteFrameHeader(frame.head, response->block_size, HTTP2_FRAME_HEADERS,
+                                 BH2_HTTP2_FLAG_END_HEADERS | (frame.ends_stream ? BH2_HTTP2_FLAG_END_STREAM : 0), stream->id);
+                stream->headers_queued = true;
+            }
+            else
+            {
+                // DATA as far as the windows of both the connection and the stream allow.
+                int64_t window = session->window < stream->window ? session->window : stream->window;
+                if (window <= 0)
+                    continue;
+                size_t size = response->body_size - stream->body_offset;
+                if (size > session->max_frame_size)
+                    size = session->max_frame_size;
+                if ((uint64_t)size > (uint64_t)window)
+                    size = (size_t)window;
+                frame.payload = response->body + stream->body_offset;
+                frame.payload_size = size;
+                frame.ends_stream = stream->body_offset + size == response->body_size;
+                frame.data = true;
+                WriteFrameHeader(frame.head, size, HTTP2_FRAME_DATA, frame.ends_stream ? BH2_HTTP2_FLAG_END_STREAM : 0, stream->id);
+                stream->body_offset += size;
+                session->window -= (int64_t)size;
+                stream->window -= (int64_t)size;
+            }
+            if (!PushFrame(session, &frame))
+                return;
+            stream->queued = frame.ends_stream;
+            progress = true;
+        }
+    }
+}
+
+size_t
+Http2_Gather( Http2Session *session, struct iovec *iov, size_t iov_len, size_t *requested )
+{
+    size_t batch = 0, offset = session->frame_offset;
+    *requested = 0;
+    for (size_t i = 0; i < session->frames.length && batch + 2 <= iov_len; i++)
+    {
+        Http2Frame *frame = Deque_PtrAt(&session->frames, i);
+        if (offset < frame->head_size)
+        {
+            iov[batch].iov_base = frame->head + offset;
+            iov[batch].iov_len = frame->head_size - offset;
+            *requested += iov[batch++].iov_len;
+            offset = 0;
+        }
+        else
+            offset -= frame->head_size;
+        if (frame->payload_size)
+        {
+            iov[batch].iov_base = (char *)frame->payload + offset;
+            iov[batch].iov_len = frame->payload_size - offset;
+            *requested += iov[batch++].iov_len;
+        }
+        offset = 0;
+    }
+    return batch;
+}
+
+size_t
+Http2_Written( Http2Session *session, size_t bytes, Http2Written *written )
+{
+    size_t completed = 0;
+    session->queued_bytes -= bytes;
+    bytes += session->frame_offset;
+    while (session->frames.length)
+    {
+        Http2Frame *frame = Deque_PtrAt(&session->frames, 0);
+        size_t size = frame->head_size + frame->payload_size;
+        if (bytes < size)
+            break;
+        bytes -= size;
+
+        size_t index = 0;
+        Http2Stream *stream = NULL;
+        if (frame->ends_stream && (stream = FindStream(session, frame->stream_id, &index)))
+        {
+            const Http2Response *response = &http2_responses[stream->kind];
+            written[completed] = (Http2Written){ .kind = stream->kind, .access = stream->access };
+            written[completed].access.status = response->status;
+            written[completed].access.bytes = (uint32_t)(response->block_size + response->body_size);
+            completed++;
+            Http2StreamVector_Delete(&session->streams, index);
+        }
+        Deque_Pop_Front(&session->frames, NULL);
+    }
+    session->frame_offset = bytes;
+    return completed;
+}
+
+void
+Http2_GoAway( Http2Session *session )
+{
+    if (session->going_away)
+        return;
+    uint8_t payload[8];
+    WriteUint32(payload, session->last_stream_id);
+    WriteUint32(payload + 4, HTTP2_NO_ERROR);
+    if (QueueControl(session, HTTP2_FRAME_GOAWAY, 0, 0, payload, sizeof(payload)))
+        session->going_away = true;
+}
+
+size_t
+Http2_QueuedBytes( const Http2Session *session )
+{
+    return session->queued_bytes;
+}
+
+bool
+Http2_WantsWrite( const Http2Session *session )
+{
+    if (session->frames.length || Http2_Finished(session))
+        return true;
+    for (size_t i = 0; i < session->streams.length; i++)
+    {
+        const Http2Stream *stream = Http2StreamVector_At(&session->streams, i);
+        if (!stream->queued && (!stream->headers_queued || (session->window > 0 && stream->window > 0)))
+            return true;
+    }
+    return false;
+}
+
+bool
+Http2_Finished( const Http2Session *session )
+{
+    return session->going_away && !session->streams.length && !session->frames.length;
+}
+
+size_t
+Http2_SessionBytes( const Http2Session *session )
+{
+    return sizeof(Http2Session) + session->frames.capacity * session->frames.elem_size +
+           session->streams.capacity * sizeof(Http2Stream);
+}
+
+void
+Http2_Close( Http2Session *session )
+{
+    if (!session)
+        return;
+    Deque_DestroyS(&session->frames);
+    Http2StreamVector_DestroyS(&session->streams);
+    free(session);
+}
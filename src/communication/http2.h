@@ -0,0 +1,250 @@
+#ifndef BH2_COMMUNICATION_HTTP2_H
+#define BH2_COMMUNICATION_HTTP2_H
+
+#include <pch.h>
+
+#include "request.h"
+#include "response.h"
+#include "../main/access_log.h"
+
+#include <sys/uio.h>
+
+/*
+
+    Cleartext HTTP/2, for clients starting with the connection preface (prior knowledge)
+    or upgrading an HTTP/1.1 request with "Upgrade: h2c".
+
+    Every response has its header block encoded once at startup from the prebuilt HTTP/1 header, with
+    HPACK literals that never touch the dynamic table, so the same bytes serve every stream. A response
+    is written as a frame header made per frame, the prebuilt header block, and DATA frames pointing
+    into the response's body, html_content for the page. Nothing of a response is copied.
+
+    Requests are decoded with a full HPACK decoder, since clients do use the dynamic table and Huffman
+    strings, but only :method and :path are kept. Request bodies are read away.
+
+    Every connection has at most BH2_HTTP2_MAX_STREAMS responses in progress, further streams are refused,
+    and at most BH2_HTTP2_MAX_FRAMES frames queued. DATA frames are only queued as far as the flow control
+    windows the client gives allow.
+
+    A session belongs to the data thread.
+
+*/
+
+// Connection preface sent by clients first.
+#define BH2_HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define BH2_HTTP2_PREFACE_SIZE (sizeof(BH2_HTTP2_PREFACE) - 1)
+
+// Streams a connection may have in progress, told to the client with SETTINGS_MAX_CONCURRENT_STREAMS.
+#define BH2_HTTP2_MAX_STREAMS 100
+
+// Largest header block of a request, HEADERS and CONTINUATION frames together.
+#define BH2_HTTP2_MAX_HEADER_BLOCK 16384
+
+// Size of the HPACK dynamic table requests are decoded with, the protocol's default.
+#define BH2_HTTP2_HEADER_TABLE_SIZE 4096
+
+// Frames a connection may have queued. DATA frames stop being queued at half of it,
+// a client making the server queue the rest in control frames without reading them is dropped.
+#define BH2_HTTP2_MAX_FRAMES 512
+
+// Largest header block of a prebuilt response.
+#define BH2_HTTP2_MAX_RESPONSE_BLOCK 256
+
+// Connection state, see http2.c.
+typedef struct Http2Session Http2Session;
+
+typedef enum Http2Result
+{
+    // Every complete frame is processed, the rest needs more bytes.
+    HTTP2_NEED_MORE,
+    // A request is decoded and waits for Http2_Respond().
+    HTTP2_REQUEST,
+    // The connection is broken. GOAWAY is queued, the client should be closed once it's written.
+    HTTP2_FAILED
+} Http2Result;
+
+// A request read off a connection.
+typedef struct Http2Request
+{
+    uint32_t stream_id;
+    // Method, and if the request had one.
+    RequestMethod method;
+    bool has_method;
+    // Decoded :path, valid until the next call on the session. NULL without one or if it's too long.
+    const char *path;
+    size_t path_len;
+    bool path_too_long;
+} Http2Request;
+
+// A response completely written.
+typedef struct Http2Written
+{
+    ResponseKind kind;
+    // Record given to Http2_Respond(), with status and bytes filled.
+    AccessRecord access;
+} Http2Written;
+
+///
+/// \brief Build the HTTP/2 responses
+///
+/// Encode the header block of every prebuilt response, once \a Response_BuildAll() is done.
+/// Templated responses are not supported.
+///
+/// \return false if a header does not fit.
+///
+bool
+Http2_Init( void );
+
+///
+/// \brief Start a session
+///
+/// Queue the server's SETTINGS. An upgraded session first queues the 101 response,
+/// and takes the connection preface as its first input.
+///
+/// \param upgraded If the connection upgrades from HTTP/1.1
+///
+/// \return The session, NULL if out of memory.
+///
+Http2Session *
+Http2_Open( bool upgraded );
+
+///
+/// \brief Apply the settings of an upgrade
+///
+/// \param session Upgraded session
+/// \param value Value of the HTTP2-Settings header, base64url
+/// \param value_len Length of the value
+///
+/// \return false if they are invalid, the connection should not be upgraded then.
+///
+bool
+Http2_ApplyUpgradeSettings( Http2Session *session, const char *value, size_t value_len );
+
+///
+/// \brief Read frames
+///
+/// Process the complete frames at the start of bytes, stopping after the first request.
+///
+/// \param session Session
+/// \param bytes Bytes received
+/// \param length Number of bytes
+/// \param max_path_len Longest :path accepted
+/// \param used Retrieves how many bytes are consumed
+/// \param request Retrieves the request with \a HTTP2_REQUEST
+///
+/// \return What stopped the reading.
+///
+Http2Result
+Http2_Receive( Http2Session *session, const char *bytes, size_t length, size_t max_path_len, size_t *used, Http2Request *request );
+
+///
+/// \brief Answer a request
+///
+/// Start a response on a stream. Past BH2_HTTP2_MAX_STREAMS of them, the stream is refused instead.
+///
+/// \param session Session
+/// \param stream_id Stream of the request
+/// \param kind Response, the memory report, the event stream and partial responses are answered with the page
+/// \param access Access record of the request, handed back once the response is written
+///
+/// \return false if the stream is refused.
+///
+bool
+Http2_Respond( Http2Session *session, uint32_t stream_id, ResponseKind kind, const AccessRecord *access );
+
+///
+/// \brief Queue frames
+///
+/// Queue the frames of the responses in progress, as far as the flow control windows allow.
+///
+/// \param session Session
+///
+void
+Http2_QueueFrames( Http2Session *session );
+
+///
+/// \brief Gather the queued frames
+///
+/// \param session Session
+/// \param iov Scatter list to fill, starting with the unwritten part of the first frame
+/// \param iov_len Room in the list, at least 2
+/// \param requested Retrieves the bytes gathered
+///
+/// \return Number of iovecs filled, 0 if nothing is queued.
+///
+size_t
+Http2_Gather( Http2Session *session, struct iovec *iov, size_t iov_len, size_t *requested );
+
+///
+/// \brief Account written bytes
+///
+/// Let go of the frames written, and hand back the responses they end.
+///
+/// \param session Session
+/// \param bytes Bytes written from what \a Http2_Gather() gathered
+/// \param written Retrieves the responses completed, room for BH2_HTTP2_MAX_STREAMS
+///
+/// \return Number of responses completed.
+///
+size_t
+Http2_Written( Http2Session *session, size_t bytes, Http2Written *written );
+
+///
+/// \brief Go away
+///
+/// Tell the client no more streams are taken, for draining. The streams in progress are finished.
+///
+/// \param session Session
+///
+void
+Http2_GoAway( Http2Session *session );
+
+///
+/// \brief Get the queued bytes
+///
+/// \param session Session
+///
+/// \return Bytes of the frames queued and not yet written.
+///
+size_t
+Http2_QueuedBytes( const Http2Session *session );
+
+///
+/// \brief Tell if there's something to write
+///
+/// \param session Session
+///
+/// \return true if frames are queued, or responses may queue some.
+///
+bool
+Http2_WantsWrite( const Http2Session *session );
+
+///
+/// \brief Tell if a session is over
+///
+/// \param session Session
+///
+/// \return true once the session went away and everything is written.
+///
+bool
+Http2_Finished( const Http2Session *session );
+
+///
+/// \brief Get the memory of a session
+///
+/// \param session Session
+///
+/// \return Bytes allocated for it.
+///
+size_t
+Http2_SessionBytes( const Http2Session *session );
+
+///
+/// \brief Close a session
+///
+/// \param session Session, may be NULL
+///
+void
+Http2_Close( Http2Session *session );
+
+#endif // !BH2_COMMUNICATION_HTTP2_H
@@ -0,0 +1,211 @@
+#include "listener.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Parse a port, 1 to 65535.
+static
+bool
+ParsePort( const char *text, uint16_t *port )
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (errno || end == text || *end || text[0] == '-' || parsed == 0 || parsed > UINT16_MAX)
+        return false;
+    *port = (uint16_t)parsed;
+    return true;
+}
+
+static
+bool
+ParseUnix( const char *path, struct sockaddr_un *addr, socklen_t *addr_len )
+{
+    size_t path_len = strlen(path);
+    addr->sun_family = AF_UNIX;
+    if (path[0] == '@')
+    {
+        // Abstract names start with a NUL byte instead, and are exactly as long as the address says.
+        if (path_len < 2 || path_len > sizeof(addr->sun_path))
+            return false;
+        memcpy(addr->sun_path + 1, path + 1, path_len - 1);
+        *addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len);
+    }
+    else
+    {
+        if (!path_len || path_len >= sizeof(addr->sun_path))
+            return false;
+        memcpy(addr->sun_path, path, path_len);
+        *addr_len = (socklen_t)sizeof(*addr);
+    }
+    return true;
+}
+
+bool
+Listener_ParseSpec( const char *spec, struct sockaddr_storage *addr, socklen_t *addr_len, bool *tls )
+{
+    *addr = (struct sockaddr_storage){ 0 };
+    *tls = !strncmp(spec, "tls", 3);
+
+    if (!strncmp(spec, "unix:", 5))
+        return ParseUnix(spec + 5, (struct sockaddr_un *)addr, addr_len);
+
+    // Split host and port, the host of IPv6 is in brackets as its colons would be ambiguous.
+    const char *host = NULL;
+    const char *port_text = NULL;
+    size_t host_len = 0;
+    int family = AF_UNSPEC;
+    // HTTPS specs only differ in their prefix.
+    if (!strncmp(spec, "tcp6:[", 6) || !strncmp(spec, "tls6:[", 6))
+    {
+        host = spec + 6;
+        const char *bracket = strchr(host, ']');
+        if (!bracket || bracket[1] != ':')
+            return false;
+        host_len = (size_t)(bracket - host);
+        port_text = bracket + 2;
+        family = AF_INET6;
+    }
+    else if (!strncmp(spec, "tcp:", 4) || !strncmp(spec, "tls:", 4))
+    {
+        host = spec + 4;
+        const char *colon = strrchr(host, ':');
+        if (!colon)
+            return false;
+        host_len = (size_t)(colon - host);
+        port_text = colon + 1;
+        family = AF_INET;
+    }
+    else
+        return false;
+
+    char host_text[INET6_ADDRSTRLEN] = { 0 };
+    uint16_t port = 0;
+    if (host_len >= sizeof(host_text) || !ParsePort(port_text, &port))
+        return false;
+    memcpy(host_text, host, host_len);
+    // Empty or "*" means every address.
+    bool any = !host_len || !strcmp(host_text, "*");
+
+    if (family == AF_INET)
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        in->sin_addr.s_addr = htonl(INADDR_ANY);
+        *addr_len = (socklen_t)sizeof(*in);
+        return any || inet_pton(AF_INET, host_text, &in->sin_addr) == 1;
+    }
+
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons(port);
+    in6->sin6_addr = in6addr_any;
+    *addr_len = (socklen_t)sizeof(*in6);
+    return any || inet_pton(AF_INET6, host_text, &in6->sin6_addr) == 1;
+}
+
+int
+Listener_Open( const struct sockaddr_storage *addr, socklen_t addr_len, bool v6_only )
+{
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if (addr->ss_family == AF_UNIX)
+    {
+        // A socket file left by a run that has not ended cleanly would make bind() fail, other files are left alone.
+        const char *path = ((const struct sockaddr_un *)addr)->sun_path;
+        struct stat path_stat;
+        if (path[0] && stat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode))
+            unlink(path);
+    }
+    else
+    {
+        // Connections closed by the last run may still be in TIME_WAIT, which must not stop a restart from binding.
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+        if (addr->ss_family == AF_INET6)
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &(int){ v6_only }, sizeof(int));
+    }
+
+    if (bind(fd, (const struct sockaddr *)addr, addr_len) == -1 || listen(fd, BH2_LISTEN_BACKLOG) == -1)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    return fd;
+}
+
+bool
+Listener_IsBound( int fd, const struct sockaddr_storage *addr )
+{
+    struct sockaddr_storage bound = { 0 };
+    socklen_t bound_len = sizeof(bound);
+    if (getsockname(fd, (struct sockaddr *)&bound, &bound_len) == -1 || bound.ss_family != addr->ss_family)
+        return false;
+
+    if (addr->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr, *bound_in = (const struct sockaddr_in *)&bound;
+        return in->sin_port == bound_in->sin_port && in->sin_addr.s_addr == bound_in->sin_addr.s_addr;
+    }
+    if (addr->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr, *bound_in6 = (const struct sockaddr_in6 *)&bound;
+        return in6->sin6_port == bound_in6->sin6_port && !memcmp(&in6->sin6_addr, &bound_in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+    return false;
+}
+
+void
+Listener_Describe( int fd, char *text, size_t size )
+{
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *)&addr, &addr_len) == -1)
+    {
+        snprintf(text, size, "fd %d", fd);
+        return;
+    }
+
+    char host[INET6_ADDRSTRLEN] = { 0 };
+    if (addr.ss_family == AF_INET)
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+        snprintf(text, size, "tcp:%s:%u", host, ntohs(in->sin_port));
+    }
+    else if (addr.ss_family == AF_INET6)
+    {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        snprintf(text, size, "tcp6:[%s]:%u", host, ntohs(in6->sin6_port));
+    }
+    else if (addr.ss_family == AF_UNIX)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        size_t path_len = addr_len - offsetof(struct sockaddr_un, sun_path);
+        if (path_len && !un->sun_path[0])
+            snprintf(text, size, "unix:@%.*s", (int)(path_len - 1), un->sun_path + 1);
+        else
+            snprintf(text, size, "unix:%.*s", (int)strnlen(un->sun_path, path_len), un->sun_path);
+    }
+    else
+        snprintf(text, size, "fd %d", fd);
+}
+
+void
+Listener_Close( int fd, bool remove_file )
+{
+    struct sockaddr_un addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+    if (remove_file && getsockname(fd, (struct sockaddr *)&addr, &addr_len) == 0 && addr.sun_family == AF_UNIX && addr.sun_path[0])
+        unlink(addr.sun_path);
+    close(fd);
+}
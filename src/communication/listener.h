@@ -0,0 +1,89 @@
+#ifndef BH2_COMMUNICATION_LISTENER_H
+#define BH2_COMMUNICATION_LISTENER_H
+
+#include <pch.h>
+
+#include <sys/socket.h>
+
+/*
+
+    Listening sockets, described by a short text spec:
+
+        tcp:<ipv4>:<port>       e.g. tcp:127.0.0.1:8080, tcp:*:80
+        tcp6:[<ipv6>]:<port>    e.g. tcp6:[::1]:8080, tcp6:[::]:80
+        unix:<path>             e.g. unix:/run/blackhole2.sock
+        unix:@<name>            abstract namespace, never shows up on the filesystem
+        tls:<ipv4>:<port>       HTTPS, like tcp: otherwise, see tls.h
+        tls6:[<ipv6>]:<port>    HTTPS, like tcp6: otherwise
+
+    Every listener feeds the same data thread, whatever its family.
+
+*/
+
+// Most listeners one instance serves.
+#define BH2_MAX_LISTENERS 16
+
+// Backlog of every listening socket.
+#define BH2_LISTEN_BACKLOG 32
+
+///
+/// \brief Parse a listener spec
+///
+/// \param spec Text spec, see above
+/// \param addr Retrieves the address to bind
+/// \param addr_len Retrieves the length of \a addr
+/// \param tls Retrieves whether clients of the listener speak HTTPS
+///
+/// \return true if \a spec is valid.
+///
+bool
+Listener_ParseSpec( const char *spec, struct sockaddr_storage *addr, socklen_t *addr_len, bool *tls );
+
+///
+/// \brief Open a listener
+///
+/// Create a non-blocking socket, bind it and listen. A stale socket file of a unix listener is replaced.
+///
+/// \param addr Address to bind
+/// \param addr_len Length of \a addr
+/// \param v6_only For IPv6, whether IPv4 clients are left to another listener
+///
+/// \return Listening socket, -1 on error.
+///
+int
+Listener_Open( const struct sockaddr_storage *addr, socklen_t addr_len, bool v6_only );
+
+///
+/// \brief Check where a listener is bound
+///
+/// \param fd Listening socket
+/// \param addr Address from \a Listener_ParseSpec()
+///
+/// \return true if \a fd is bound to \a addr, addresses of every interface only match each other.
+///
+bool
+Listener_IsBound( int fd, const struct sockaddr_storage *addr );
+
+///
+/// \brief Describe a listener
+///
+/// Write the spec of the address a socket is bound to, e.g. for logging.
+///
+/// \param fd Listening socket
+/// \param text Retrieves the spec
+/// \param size Size of \a text
+///
+void
+Listener_Describe( int fd, char *text, size_t size );
+
+///
+/// \brief Close a listener
+///
+/// \param fd Listening socket
+/// \param remove_file Whether to remove the socket file of a unix listener bound on the filesystem.
+///                    Not wanted once the socket has been handed over.
+///
+void
+Listener_Close( int fd, bool remove_file );
+
+#endif // !BH2_COMMUNICATION_LISTENER_H
@@ -0,0 +1,221 @@
+#include "rate_limit.h"
+
+#include "../main/clock.h"
+#include "../main/stats.h"
+
+#include <netinet/in.h>
+
+// Slots looked at for an address before giving up.
+static
+const size_t RATE_LIMIT_PROBES = 32;
+
+// An address without connections that has been quiet for this long may lose its slot.
+static
+const uint32_t RATE_LIMIT_IDLE_MS = 60000;
+
+static
+RateLimitConfig limits;
+
+static
+RateLimitSlot *table;
+
+// Connections open over all addresses.
+static
+atomic_size_t connections_open;
+
+// Hash the address part of a peer, IPv4 and IPv4-mapped IPv6 alike. Never 0.
+static
+uint64_t
+HashAddress( const struct sockaddr_storage *addr )
+{
+    uint8_t bytes[16] = { 0 };
+    if (addr->ss_family == AF_INET)
+    {
+        // Same bytes as ::ffff:a.b.c.d
+        bytes[10] = bytes[11] = 0xFF;
+        memcpy(bytes + 12, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+    }
+    else if (addr->ss_family == AF_INET6)
+        memcpy(bytes, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+    else
+        return 0;
+
+    // FNV-1a, then a finalizer so neighbouring addresses spread over the table.
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < sizeof(bytes); i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+
+    return hash ? hash : 1;
+}
+
+// Find the slot of an address, claiming a free or stale one if it has none.
+static
+RateLimitSlot *
+FindSlot( uint64_t key, uint32_t now )
+{
+    size_t mask = BH2_RATE_LIMIT_SLOTS - 1;
+    RateLimitSlot *stale = NULL;
+
+    for (size_t i = 0; i < RATE_LIMIT_PROBES; i++)
+    {
+        RateLimitSlot *slot = &table[(key + i) & mask];
+        uint64_t slot_key = atomic_load_explicit(&slot->key, memory_order_acquire);
+
+        if (slot_key == key)
+            return slot;
+        if (!slot_key)
+        {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong_explicit(&slot->key, &expected, key, memory_order_acq_rel, memory_order_acquire))
+                return slot;
+            // Somebody claimed it first, maybe for the same address.
+            if (expected == key)
+                return slot;
+            continue;
+        }
+        if (!stale && !atomic_load_explicit(&slot->connections, memory_order_relaxed)
+            && now - atomic_load_explicit(&slot->last_seen, memory_order_relaxed) > RATE_LIMIT_IDLE_MS)
+            stale = slot;
+    }
+
+    if (stale)
+    {
+        uint64_t expected = atomic_load_explicit(&stale->key, memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&stale->key, &expected, key, memory_order_acq_rel, memory_order_relaxed))
+        {
+            atomic_store_explicit(&stale->connection_bucket, 0, memory_order_relaxed);
+            atomic_store_explicit(&stale->request_bucket, 0, memory_order_relaxed);
+            return stale;
+        }
+    }
+
+    return NULL;
+}
+
+// Take a token from a bucket.
+static
+bool
+TakeToken( _Atomic uint64_t *bucket, uint32_t rate, uint32_t burst, uint32_t now )
+{
+    uint64_t full = (uint64_t)burst * 1000ULL;
+    uint64_t old = atomic_load_explicit(bucket, memory_order_relaxed);
+    uint64_t updated = 0;
+
+    do
+    {
+        uint64_t tokens = full;
+        if (old)
+        {
+            // Tokens are in thousandths, so a rate per second refills rate thousandths per millisecond.
+            uint32_t elapsed = now - (uint32_t)old;
+            tokens = (old >> 32) + (uint64_t)elapsed * rate;
+            if (tokens > full)
+                tokens = full;
+        }
+        if (tokens < 1000ULL)
+            return false;
+
+        // Keep 0 meaning full, the refill time just moves a millisecond.
+        updated = ((tokens - 1000ULL) << 32) | now;
+        if (!updated)
+            updated = 1;
+    }
+    while (!atomic_compare_exchange_weak_explicit(bucket, &old, updated, memory_order_relaxed, memory_order_relaxed));
+
+    return true;
+}
+
+bool
+RateLimit_Init( const RateLimitConfig *config )
+{
+    limits = *config;
+    if (limits.connection_rate && !limits.connection_burst)
+        limits.connection_burst = limits.connection_rate;
+    if (limits.request_rate && !limits.request_burst)
+        limits.request_burst = limits.request_rate;
+    atomic_store(&connections_open, 0);
+
+    table = NULL;
+    if (limits.max_connections_per_addr || limits.connection_rate || limits.request_rate)
+    {
+        table = calloc(BH2_RATE_LIMIT_SLOTS, sizeof(RateLimitSlot));
+        if (!table)
+            return false;
+    }
+
+    return true;
+}
+
+RateLimitVerdict
+RateLimit_Admit( const struct sockaddr_storage *addr, RateLimitSlot **slot )
+{
+    *slot = NULL;
+
+    // Only main thread admits, so the check and the increment need not be one operation.
+    if (limits.max_connections && atomic_load_explicit(&connections_open, memory_order_relaxed) >= limits.max_connections)
+    {
+        atomic_fetch_add_explicit(&server_stats.rejected_connections_total, 1, memory_order_relaxed);
+        return RATE_LIMIT_TOO_MANY_CONNECTIONS;
+    }
+
+    uint64_t key = table ? HashAddress(addr) : 0;
+    if (key)
+    {
+        uint32_t now = (uint32_t)Clock_MonotonicMs();
+        RateLimitSlot *found = FindSlot(key, now);
+        if (!found)
+            atomic_fetch_add_explicit(&server_stats.rate_limit_table_full, 1, memory_order_relaxed);
+        else
+        {
+            atomic_store_explicit(&found->last_seen, now, memory_order_relaxed);
+            if (limits.max_connections_per_addr && atomic_load_explicit(&found->connections, memory_order_relaxed) >= limits.max_connections_per_addr)
+            {
+                atomic_fetch_add_explicit(&server_stats.rejected_connections_per_addr, 1, memory_order_relaxed);
+                return RATE_LIMIT_TOO_MANY_CONNECTIONS_FROM_ADDR;
+            }
+            if (limits.connection_rate && !TakeToken(&found->connection_bucket, limits.connection_rate, limits.connection_burst, now))
+            {
+                atomic_fetch_add_explicit(&server_stats.rejected_connection_rate, 1, memory_order_relaxed);
+                return RATE_LIMIT_CONNECTING_TOO_FAST;
+            }
+            atomic_fetch_add_explicit(&found->connections, 1, memory_order_relaxed);
+            *slot = found;
+        }
+    }
+
+    atomic_fetch_add_explicit(&connections_open, 1, memory_order_relaxed);
+    return RATE_LIMIT_ADMIT;
+}
+
+void
+RateLimit_Release( RateLimitSlot *slot )
+{
+    if (slot)
+        atomic_fetch_sub_explicit(&slot->connections, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&connections_open, 1, memory_order_relaxed);
+}
+
+bool
+RateLimit_AllowRequest( RateLimitSlot *slot )
+{
+    if (!slot || !limits.request_rate)
+        return true;
+
+    uint32_t now = (uint32_t)Clock_MonotonicMs();
+    atomic_store_explicit(&slot->last_seen, now, memory_order_relaxed);
+    if (TakeToken(&slot->request_bucket, limits.request_rate, limits.request_burst, now))
+        return true;
+
+    atomic_fetch_add_explicit(&server_stats.rejected_requests, 1, memory_order_relaxed);
+    return false;
+}
+
+void
+RateLimit_Destroy( void )
+{
+    free(table);
+    table = NULL;
+}
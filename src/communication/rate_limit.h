@@ -0,0 +1,111 @@
+#ifndef BH2_COMMUNICATION_RATE_LIMIT_H
+#define BH2_COMMUNICATION_RATE_LIMIT_H
+
+#include <pch.h>
+
+#include <sys/socket.h>
+
+/*
+
+    Per peer address accounting, shared by main thread (connections) and data thread (requests).
+
+    Addresses live in a fixed open addressing table. Every field is an atomic, a slot is claimed by
+    compare-and-swap on its key, and token buckets are updated by compare-and-swap on one 64-bit word,
+    so no thread ever waits for another. When the table is full, addresses that are not found are let
+    through rather than blocked.
+
+*/
+
+// Slots in the table, a power of 2.
+#define BH2_RATE_LIMIT_SLOTS 16384
+
+typedef struct RateLimitConfig
+{
+    // Connections open at once over all addresses, 0 for no limit.
+    size_t max_connections;
+    // Connections open at once from one address, 0 for no limit.
+    size_t max_connections_per_addr;
+    // New connections per second from one address and its burst, 0 for no limit.
+    uint32_t connection_rate;
+    uint32_t connection_burst;
+    // Requests per second from one address and its burst, 0 for no limit.
+    uint32_t request_rate;
+    uint32_t request_burst;
+} RateLimitConfig;
+
+typedef struct RateLimitSlot
+{
+    // Hash of the peer address, 0 if the slot is free.
+    _Atomic uint64_t key;
+    // Token buckets. Thousandths of a token in the high 32 bits, time of the last refill in milliseconds in the low ones.
+    // 0 stands for a full bucket.
+    _Atomic uint64_t connection_bucket;
+    _Atomic uint64_t request_bucket;
+    // Connections open from the address.
+    atomic_uint connections;
+    // Last time the address connected or made a request, in milliseconds.
+    atomic_uint last_seen;
+} RateLimitSlot;
+
+typedef enum RateLimitVerdict
+{
+    RATE_LIMIT_ADMIT,
+    RATE_LIMIT_TOO_MANY_CONNECTIONS,
+    RATE_LIMIT_TOO_MANY_CONNECTIONS_FROM_ADDR,
+    RATE_LIMIT_CONNECTING_TOO_FAST
+} RateLimitVerdict;
+
+///
+/// \brief Initialize rate limiting
+///
+/// Set the limits. The table is only allocated if there's a per address limit.
+///
+/// \param config Limits
+///
+/// \return true on success, false if out of memory.
+///
+bool
+RateLimit_Init( const RateLimitConfig *config );
+
+///
+/// \brief Admit a connection
+///
+/// Account a new connection. Every admitted connection must be given back by \a RateLimit_Release().
+///
+/// \param addr Peer address
+/// \param slot Retrieves the slot of the address, NULL if it's not tracked
+///
+/// \return Whether the connection is admitted, or why not.
+///
+RateLimitVerdict
+RateLimit_Admit( const struct sockaddr_storage *addr, RateLimitSlot **slot );
+
+///
+/// \brief Release a connection
+///
+/// Account a closed connection that was admitted.
+///
+/// \param slot Slot given by \a RateLimit_Admit()
+///
+void
+RateLimit_Release( RateLimitSlot *slot );
+
+///
+/// \brief Allow a request
+///
+/// Take a token from the request bucket of the address.
+///
+/// \param slot Slot given by \a RateLimit_Admit()
+///
+/// \return true if the request may be served.
+///
+bool
+RateLimit_AllowRequest( RateLimitSlot *slot );
+
+///
+/// \brief Free the table
+///
+void
+RateLimit_Destroy( void );
+
+#endif // !BH2_COMMUNICATION_RATE_LIMIT_H
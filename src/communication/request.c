@@ -0,0 +1,165 @@
+#include "request.h"
+
+// Characters allowed in a method token.
+static
+bool
+IsTokenChar( char c )
+{
+    return isalnum((unsigned char)c) || (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+RequestParseResult
+Request_ParseLine( const char *bytes, size_t length, size_t max_target_len, RequestLine *line )
+{
+    const char *cur = bytes, *end = bytes + length;
+
+    // Skip the empty lines some clients leave between requests.
+    while (cur + 1 < end && cur[0] == '\r' && cur[1] == '\n')
+        cur += 2;
+    if (cur == end)
+        return REQUEST_PARSE_EMPTY;
+
+    // Method
+    const char *method = cur;
+    while (cur < end && IsTokenChar(*cur))
+        cur++;
+    size_t method_len = cur - method;
+    if (!method_len || cur == end || *cur != ' ')
+        return REQUEST_PARSE_BAD;
+
+    line->method = REQUEST_METHOD_OTHER;
+    switch (method_len)
+    {
+        case 3:
+            if (!memcmp(method, "GET", 3))
+                line->method = REQUEST_METHOD_GET;
+            break;
+        case 4:
+            if (!memcmp(method, "HEAD", 4))
+                line->method = REQUEST_METHOD_HEAD;
+            break;
+        case 7:
+            if (!memcmp(method, "OPTIONS", 7))
+                line->method = REQUEST_METHOD_OPTIONS;
+            break;
+    }
+    cur++;
+
+    // Target, anything visible up to the next space.
+    line->target = cur;
+    while (cur < end && (unsigned char)*cur > ' ' && *cur != 0x7F)
+        cur++;
+    line->target_len = cur - line->target;
+    if (line->target_len > max_target_len)
+        return REQUEST_PARSE_TARGET_TOO_LONG;
+    if (!line->target_len || cur == end || *cur != ' ')
+        return REQUEST_PARSE_BAD;
+    cur++;
+
+    // Version, only HTTP/1.x is spoken here.
+    if (end - cur < 10 || memcmp(cur, "HTTP/", 5) || !isdigit((unsigned char)cur[5]) || cur[6] != '.' || !isdigit((unsigned char)cur[7]))
+        return REQUEST_PARSE_BAD;
+    line->version_major = cur[5] - '0';
+    line->version_minor = cur[7] - '0';
+    if (line->version_major != 1 || cur[8] != '\r' || cur[9] != '\n')
+        return REQUEST_PARSE_BAD;
+
+    line->headers = cur + 10;
+    return REQUEST_PARSE_OK;
+}
+
+bool
+Request_FindHeader( const char *headers, size_t length, const char *name, const char **value, size_t *value_len )
+{
+    size_t name_len = strlen(name);
+    const char *cur = headers, *end = headers + length;
+
+    while (cur < end)
+    {
+        const char *line_end = memchr(cur, '\n', end - cur);
+        if (!line_end)
+            line_end = end;
+
+        if ((size_t)(line_end - cur) > name_len && cur[name_len] == ':')
+        {
+            size_t i = 0;
+            while (i < name_len && tolower((unsigned char)cur[i]) == name[i])
+                i++;
+            if (i == name_len)
+            {
+                const char *begin = cur + name_len + 1, *stop = line_end;
+                while (begin < stop && (*begin == ' ' || *begin == '\t'))
+                    begin++;
+                while (stop > begin && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t'))
+                    stop--;
+                *value = begin;
+                *value_len = stop - begin;
+                return true;
+            }
+        }
+
+        cur = line_end + 1;
+    }
+
+    return false;
+}
+
+// Read the digits at the start of bytes, saturating at SIZE_MAX. Returns how many there are.
+static
+size_t
+ParseSize( const char *bytes, size_t length, size_t *value )
+{
+    size_t i = 0;
+    *value = 0;
+    for (; i < length && isdigit((unsigned char)bytes[i]); i++)
+    {
+        size_t digit = bytes[i] - '0';
+        *value = *value > (SIZE_MAX - digit) / 10 ? SIZE_MAX : *value * 10 + digit;
+    }
+    return i;
+}
+
+RequestRangeResult
+Request_ParseRange( const char *value, size_t value_len, size_t size, RequestRange *range )
+{
+    // The unit is case-insensitive, and only one range is answered.
+    if (value_len < 6 || value[5] != '=' || memchr(value, ',', value_len))
+        return REQUEST_RANGE_NONE;
+    for (size_t i = 0; i < 5; i++)
+        if (tolower((unsigned char)value[i]) != "bytes"[i])
+            return REQUEST_RANGE_NONE;
+    const char *cur = value + 6, *end = value + value_len;
+    while (cur < end && (*cur == ' ' || *cur == '\t'))
+        cur++;
+
+    size_t first = 0, last = 0;
+    size_t first_len = ParseSize(cur, end - cur, &first);
+    cur += first_len;
+    if (cur == end || *cur != '-')
+        return REQUEST_RANGE_NONE;
+    cur++;
+    size_t last_len = ParseSize(cur, end - cur, &last);
+    cur += last_len;
+    if (cur != end || (!first_len && !last_len))
+        return REQUEST_RANGE_NONE;
+
+    // "-suffix" asks for the last bytes.
+    if (!first_len)
+    {
+        if (!last || !size)
+            return REQUEST_RANGE_UNSATISFIABLE;
+        range->length = last < size ? last : size;
+        range->start = size - range->length;
+        return REQUEST_RANGE_OK;
+    }
+
+    if (last_len && last < first)
+        return REQUEST_RANGE_NONE;
+    if (first >= size)
+        return REQUEST_RANGE_UNSATISFIABLE;
+    if (!last_len || last >= size)
+        last = size - 1;
+    range->start = first;
+    range->length = last - first + 1;
+    return REQUEST_RANGE_OK;
+}
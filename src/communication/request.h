@@ -0,0 +1,102 @@
+#ifndef BH2_COMMUNICATION_REQUEST_H
+#define BH2_COMMUNICATION_REQUEST_H
+
+#include <pch.h>
+
+// A minimal http request parser. Nothing is copied, results point into the parsed bytes.
+
+typedef enum RequestMethod
+{
+    REQUEST_METHOD_GET,
+    REQUEST_METHOD_HEAD,
+    REQUEST_METHOD_OPTIONS,
+    REQUEST_METHOD_OTHER
+} RequestMethod;
+
+typedef enum RequestParseResult
+{
+    REQUEST_PARSE_OK,
+    // Nothing but empty lines, which should be ignored.
+    REQUEST_PARSE_EMPTY,
+    // Malformed request line or unsupported version.
+    REQUEST_PARSE_BAD,
+    // Target is longer than the limit given.
+    REQUEST_PARSE_TARGET_TOO_LONG
+} RequestParseResult;
+
+typedef struct RequestLine
+{
+    RequestMethod method;
+    const char *target;
+    size_t target_len;
+    uint8_t version_major;
+    uint8_t version_minor;
+    // Where the headers start, right after the request line.
+    const char *headers;
+} RequestLine;
+
+typedef enum RequestRangeResult
+{
+    // Not a single byte range, the whole body is answered.
+    REQUEST_RANGE_NONE,
+    REQUEST_RANGE_OK,
+    // No byte of the range is in the body.
+    REQUEST_RANGE_UNSATISFIABLE
+} RequestRangeResult;
+
+// Bytes of a body asked for with a Range header.
+typedef struct RequestRange
+{
+    size_t start;
+    size_t length;
+} RequestRange;
+
+///
+/// \brief Parse a request line
+///
+/// Classify the method, target and version of a request in one pass.<BR />
+/// Leading empty lines are skipped.
+///
+/// \param bytes Request, up to and including the empty line ending its headers
+/// \param length Length of the request
+/// \param max_target_len Longest target accepted
+/// \param line Parsed request line
+///
+/// \return Result of parsing. \a line is only valid with \a REQUEST_PARSE_OK.
+///
+RequestParseResult
+Request_ParseLine( const char *bytes, size_t length, size_t max_target_len, RequestLine *line );
+
+///
+/// \brief Find a header
+///
+/// Search the headers for a field, with its name compared case-insensitively.
+///
+/// \param headers Start of the header lines
+/// \param length Length of the header lines
+/// \param name Field name, in lower case
+/// \param value Retrieves the value, without surrounding whitespace
+/// \param value_len Retrieves the length of the value
+///
+/// \return true if the field is found.
+///
+bool
+Request_FindHeader( const char *headers, size_t length, const char *name, const char **value, size_t *value_len );
+
+///
+/// \brief Parse a Range header
+///
+/// Resolve a single byte range ("bytes=first-last", "bytes=first-" or "bytes=-suffix") against a body.<BR />
+/// Several ranges, other units and malformed values are not answered partially.
+///
+/// \param value Value of the header
+/// \param value_len Length of the value
+/// \param size Size of the body
+/// \param range Retrieves the bytes asked for, within the body
+///
+/// \return Result of parsing. \a range is only valid with \a REQUEST_RANGE_OK.
+///
+RequestRangeResult
+Request_ParseRange( const char *value, size_t value_len, size_t size, RequestRange *range );
+
+#endif // !BH2_COMMUNICATION_REQUEST_H
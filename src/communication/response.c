@@ -0,0 +1,320 @@
+#include "response.h"
+
+#include "../main/shared.h"
+
+Response responses[RESPONSE_KIND_COUNT];
+Response closing_responses[RESPONSE_KIND_COUNT];
+char page_etag[BH2_PAGE_ETAG_SIZE];
+
+#define BH2_HTTP_KEEP_ALIVE "Connection: Keep-Alive\r\n" \
+                            "Keep-Alive: timeout=15, max=1000\r\n"
+#define BH2_HTTP_CLOSE "Connection: close\r\n"
+
+// Http header of the page. Range headers, connection headers and content length are filled when the page is loaded.
+static
+const char HTTP_HEAD_FORMAT[] = "HTTP/1.0 503 Service Unavailable\r\n"
+                                "Content-Type: text/html; charset=UTF-8\r\n"
+                                "%s"
+                                "%s"
+                                "Content-Length: %zu\r\n\r\n";
+
+// Http header of a templated page, which also tells the time.
+static
+const char HTTP_TEMPLATE_HEAD_FORMAT[] = "HTTP/1.0 503 Service Unavailable\r\n"
+                                         "Content-Type: text/html; charset=UTF-8\r\n"
+                                         "Date: {{date}}\r\n"
+                                         "%s"
+                                         "%s"
+                                         "Content-Length: %zu\r\n\r\n";
+
+// Range headers of a page that can be answered partially, with its ETag.
+static
+const char HTTP_RANGE_FIELDS_FORMAT[] = "Accept-Ranges: bytes\r\n"
+                                        "ETag: %s\r\n";
+
+// Http header of a range of the page: ETag, connection headers, range and its length.
+static
+const char HTTP_PARTIAL_FORMAT[] = "HTTP/1.0 206 Partial Content\r\n"
+                                   "Content-Type: text/html; charset=UTF-8\r\n"
+                                   "ETag: %s\r\n"
+                                   "%s"
+                                   "Content-Range: bytes %zu-%zu/%zu\r\n"
+                                   "Content-Length: %zu\r\n\r\n";
+
+// Connection headers and size of the page are filled when it's loaded.
+static
+const char HTTP_RANGE_NOT_SATISFIABLE_FORMAT[] = "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                                                 "Content-Range: bytes */%zu\r\n"
+                                                 "%s"
+                                                 "Content-Length: 0\r\n\r\n";
+
+// No Content-Length, a 204 can't carry one (RFC 9110, 8.6).
+static
+const char HTTP_OPTIONS[] = "HTTP/1.0 204 No Content\r\n"
+                            "Allow: GET, HEAD, OPTIONS\r\n"
+                            BH2_HTTP_KEEP_ALIVE
+                            "\r\n";
+
+static
+const char HTTP_OPTIONS_CLOSE[] = "HTTP/1.0 204 No Content\r\n"
+                                  "Allow: GET, HEAD, OPTIONS\r\n"
+                                  BH2_HTTP_CLOSE
+                                  "\r\n";
+
+static
+const char HTTP_BAD_REQUEST[] = "HTTP/1.0 400 Bad Request\r\n"
+                                BH2_HTTP_CLOSE
+                                "Content-Length: 0\r\n\r\n";
+
+static
+const char HTTP_BAD_METHOD[] = "HTTP/1.0 405 Method Not Allowed\r\n"
+                               "Allow: GET, HEAD, OPTIONS\r\n"
+                               BH2_HTTP_KEEP_ALIVE
+                               "Content-Length: 0\r\n\r\n";
+
+static
+const char HTTP_BAD_METHOD_CLOSE[] = "HTTP/1.0 405 Method Not Allowed\r\n"
+                                     "Allow: GET, HEAD, OPTIONS\r\n"
+                                     BH2_HTTP_CLOSE
+                                     "Content-Length: 0\r\n\r\n";
+
+static
+const char HTTP_URI_TOO_LONG[] = "HTTP/1.0 414 URI Too Long\r\n"
+                                 BH2_HTTP_CLOSE
+                                 "Content-Length: 0\r\n\r\n";
+
+static
+const char HTTP_TOO_MANY_REQUESTS[] = "HTTP/1.0 429 Too Many Requests\r\n"
+                                      "Retry-After: 1\r\n"
+                                      BH2_HTTP_KEEP_ALIVE
+                                      "Content-Length: 0\r\n\r\n";
+
+static
+const char HTTP_TOO_MANY_REQUESTS_CLOSE[] = "HTTP/1.0 429 Too Many Requests\r\n"
+                                            "Retry-After: 1\r\n"
+                                            BH2_HTTP_CLOSE
+                                            "Content-Length: 0\r\n\r\n";
+
+static
+const char HTTP_UNAVAILABLE[] = "HTTP/1.0 503 Service Unavailable\r\n"
+                                "Retry-After: 1\r\n"
+                                BH2_HTTP_CLOSE
+                                "Content-Length: 0\r\n\r\n";
+
+// No length, the stream lasts as long as the connection.
+static
+const char HTTP_EVENTS[] = "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: text/event-stream\r\n"
+                           "Cache-Control: no-cache\r\n"
+                           BH2_HTTP_CLOSE
+                           "\r\n";
+
+static
+const char HTTP_MEMORY_FORMAT[] = "HTTP/1.0 200 OK\r\n"
+                                  "Content-Type: text/plain; charset=UTF-8\r\n"
+                                  "%s"
+                                  "Content-Length: %zu\r\n\r\n";
+
+// The memory report, whole responses with their header.
+static
+char memory_report[BH2_MEMORY_REPORT_SIZE];
+static
+char closing_memory_report[BH2_MEMORY_REPORT_SIZE];
+
+// Header of the page when the connection is closing.
+static
+char *closing_page_head;
+
+// Range headers of the page, empty for a templated one.
+static
+char range_fields[sizeof(HTTP_RANGE_FIELDS_FORMAT) + BH2_PAGE_ETAG_SIZE];
+
+// 416 responses, with the size of the page.
+static
+char range_not_satisfiable[sizeof(HTTP_RANGE_NOT_SATISFIABLE_FORMAT) + sizeof(BH2_HTTP_KEEP_ALIVE) + 20];
+static
+char closing_range_not_satisfiable[sizeof(HTTP_RANGE_NOT_SATISFIABLE_FORMAT) + sizeof(BH2_HTTP_KEEP_ALIVE) + 20];
+
+// Templates of a templated page and of its header, for HEAD, then the same for closing connections.
+static
+ResponseTemplate page_template;
+static
+ResponseTemplate page_head_template;
+static
+ResponseTemplate closing_page_template;
+static
+ResponseTemplate closing_page_head_template;
+
+#define BH2_STATIC_RESPONSE(text, closes) \
+    (Response){ .head = (text), .head_size = sizeof(text) - 1, .body = NULL, .body_size = 0, .close = (closes) }
+
+// Compile the page responses into templates, once html_content and closing_page_head hold them.
+static
+bool
+BuildPageTemplates( size_t body_size, size_t closing_head_size )
+{
+    const char *page_body = html_content + html_head_size;
+    bool valid = Template_Compile(&page_template, html_content, html_content_size)
+                 && Template_Compile(&page_head_template, html_content, html_head_size)
+                 && Template_Compile(&closing_page_template, closing_page_head, closing_head_size)
+                 && Template_Compile(&closing_page_template, page_body, body_size)
+                 && Template_Compile(&closing_page_head_template, closing_page_head, closing_head_size);
+    if (!valid)
+        return false;
+
+    responses[RESPONSE_PAGE] = (Response){ .head = html_content, .head_size = page_template.size, .template = &page_template, .close = false };
+    responses[RESPONSE_PAGE_HEAD] = (Response){ .head = html_content, .head_size = page_head_template.size, .template = &page_head_template, .close = false };
+    closing_responses[RESPONSE_PAGE] = (Response){ .head = closing_page_head, .head_size = closing_page_template.size, .template = &closing_page_template, .close = true };
+    closing_responses[RESPONSE_PAGE_HEAD] = (Response){ .head = closing_page_head, .head_size = closing_page_head_template.size, .template = &closing_page_head_template, .close = true };
+    return true;
+}
+
+bool
+Response_BuildAll( const char *body, size_t body_size, bool templated )
+{
+    // Placeholders change the size of a templated body, its length is the filled one.
+    const char *head_format = templated ? HTTP_TEMPLATE_HEAD_FORMAT : HTTP_HEAD_FORMAT;
+    size_t content_length = body_size;
+    if (templated)
+    {
+        ResponseTemplate body_template = Template_CreateS();
+        bool valid = Template_Compile(&body_template, body, body_size);
+        content_length = body_template.size;
+        Template_DestroyS(&body_template);
+        if (!valid)
+            return false;
+    }
+
+    // A templated body changes from one response to the next, so it's never answered partially.
+    page_etag[0] = '\0';
+    range_fields[0] = '\0';
+    if (!templated)
+    {
+        // 64-bit FNV-1a of the body, the page only changes with a restart.
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (size_t i = 0; i < body_size; i++)
+            hash = (hash ^ (uint8_t)body[i]) * 0x100000001B3ULL;
+        snprintf(page_etag, sizeof(page_etag), "\"%016" PRIx64 "\"", hash);
+        snprintf(range_fields, sizeof(range_fields), HTTP_RANGE_FIELDS_FORMAT, page_etag);
+    }
+
+    html_head_size = (size_t)snprintf(NULL, 0, head_format, range_fields, BH2_HTTP_KEEP_ALIVE, content_length);
+    html_content_size = html_head_size + body_size;
+    size_t closing_head_size = (size_t)snprintf(NULL, 0, head_format, range_fields, BH2_HTTP_CLOSE, content_length);
+
+    // One more byte for the terminator snprintf() writes.
+    html_content = malloc(html_content_size + 1);
+    closing_page_head = malloc(closing_head_size + 1);
+    if (!html_content || !closing_page_head)
+    {
+        Response_DestroyAll();
+        return false;
+    }
+    snprintf(html_content, html_head_size + 1, head_format, range_fields, BH2_HTTP_KEEP_ALIVE, content_length);
+    memcpy(html_content + html_head_size, body, body_size);
+    snprintf(closing_page_head, closing_head_size + 1, head_format, range_fields, BH2_HTTP_CLOSE, content_length);
+    int not_satisfiable_size = snprintf(range_not_satisfiable, sizeof(range_not_satisfiable), HTTP_RANGE_NOT_SATISFIABLE_FORMAT,
+                                        body_size, BH2_HTTP_KEEP_ALIVE);
+    int closing_not_satisfiable_size = snprintf(closing_range_not_satisfiable, sizeof(closing_range_not_satisfiable),
+                                                HTTP_RANGE_NOT_SATISFIABLE_FORMAT, body_size, BH2_HTTP_CLOSE);
+    const char *page_body = html_content + html_head_size;
+
+    // The page is one piece, so writing it takes one iovec. HEAD shares its buffer, just stops before the body.
+    responses[RESPONSE_PAGE] = (Response){ .head = html_content, .head_size = html_content_size, .close = false };
+    responses[RESPONSE_PAGE_HEAD] = (Response){ .head = html_content, .head_size = html_head_size, .close = false };
+    responses[RESPONSE_PARTIAL] = (Response){ .head = HTTP_PARTIAL_FORMAT, .close = false };
+    responses[RESPONSE_RANGE_NOT_SATISFIABLE] = (Response){ .head = range_not_satisfiable, .head_size = (size_t)not_satisfiable_size, .close = false };
+    responses[RESPONSE_OPTIONS] = BH2_STATIC_RESPONSE(HTTP_OPTIONS, false);
+    responses[RESPONSE_BAD_REQUEST] = BH2_STATIC_RESPONSE(HTTP_BAD_REQUEST, true);
+    responses[RESPONSE_BAD_METHOD] = BH2_STATIC_RESPONSE(HTTP_BAD_METHOD, false);
+    responses[RESPONSE_URI_TOO_LONG] = BH2_STATIC_RESPONSE(HTTP_URI_TOO_LONG, true);
+    responses[RESPONSE_TOO_MANY_REQUESTS] = BH2_STATIC_RESPONSE(HTTP_TOO_MANY_REQUESTS, false);
+    responses[RESPONSE_UNAVAILABLE] = BH2_STATIC_RESPONSE(HTTP_UNAVAILABLE, true);
+    responses[RESPONSE_EVENTS] = BH2_STATIC_RESPONSE(HTTP_EVENTS, false);
+
+    closing_responses[RESPONSE_PAGE] = (Response){ .head = closing_page_head, .head_size = closing_head_size, .body = page_body, .body_size = body_size, .close = true };
+    closing_responses[RESPONSE_PAGE_HEAD] = (Response){ .head = closing_page_head, .head_size = closing_head_size, .close = true };
+    closing_responses[RESPONSE_PARTIAL] = (Response){ .head = HTTP_PARTIAL_FORMAT, .close = true };
+    closing_responses[RESPONSE_RANGE_NOT_SATISFIABLE] = (Response){ .head = closing_range_not_satisfiable,
+                                                                    .head_size = (size_t)closing_not_satisfiable_size, .close = true };
+    closing_responses[RESPONSE_OPTIONS] = BH2_STATIC_RESPONSE(HTTP_OPTIONS_CLOSE, true);
+    closing_responses[RESPONSE_BAD_REQUEST] = BH2_STATIC_RESPONSE(HTTP_BAD_REQUEST, true);
+    closing_responses[RESPONSE_BAD_METHOD] = BH2_STATIC_RESPONSE(HTTP_BAD_METHOD_CLOSE, true);
+    closing_responses[RESPONSE_URI_TOO_LONG] = BH2_STATIC_RESPONSE(HTTP_URI_TOO_LONG, true);
+    closing_responses[RESPONSE_TOO_MANY_REQUESTS] = BH2_STATIC_RESPONSE(HTTP_TOO_MANY_REQUESTS_CLOSE, true);
+    closing_responses[RESPONSE_UNAVAILABLE] = BH2_STATIC_RESPONSE(HTTP_UNAVAILABLE, true);
+    closing_responses[RESPONSE_EVENTS] = BH2_STATIC_RESPONSE(HTTP_EVENTS, true);
+    Response_SetMemoryReport("", 0);
+    if (templated && !BuildPageTemplates(body_size, closing_head_size))
+    {
+        Response_DestroyAll();
+        return false;
+    }
+
+    // Every status line is "HTTP/1.0 nnn ...".
+    for (size_t i = 0; i < RESPONSE_KIND_COUNT; i++)
+    {
+        responses[i].status = (uint16_t)strtoul(responses[i].head + 9, NULL, 10);
+        closing_responses[i].status = (uint16_t)strtoul(closing_responses[i].head + 9, NULL, 10);
+    }
+
+    return true;
+}
+
+// Write a memory response into buffer, returning its size.
+static
+size_t
+FormatMemoryReport( char *buffer, const char *connection, const char *body, size_t body_size )
+{
+    size_t head_size = (size_t)snprintf(buffer, BH2_MEMORY_REPORT_SIZE, HTTP_MEMORY_FORMAT, connection, body_size);
+    memcpy(buffer + head_size, body, body_size);
+    return head_size + body_size;
+}
+
+void
+Response_SetMemoryReport( const char *body, size_t body_size )
+{
+    // Room for the longer header, whatever the length says.
+    size_t max_body = BH2_MEMORY_REPORT_SIZE - sizeof(HTTP_MEMORY_FORMAT) - sizeof(BH2_HTTP_KEEP_ALIVE) - 32;
+    if (body_size > max_body)
+        body_size = max_body;
+
+    size_t size = FormatMemoryReport(memory_report, BH2_HTTP_KEEP_ALIVE, body, body_size);
+    responses[RESPONSE_MEMORY] = (Response){ .head = memory_report, .head_size = size, .close = false, .status = 200 };
+    size = FormatMemoryReport(closing_memory_report, BH2_HTTP_CLOSE, body, body_size);
+    closing_responses[RESPONSE_MEMORY] = (Response){ .head = closing_memory_report, .head_size = size, .close = true, .status = 200 };
+}
+
+Response
+Response_Partial( size_t start, size_t length, bool closing )
+{
+    size_t body_size = html_content_size - html_head_size;
+    size_t head_size = (size_t)snprintf(NULL, 0, HTTP_PARTIAL_FORMAT, page_etag, closing ? BH2_HTTP_CLOSE : BH2_HTTP_KEEP_ALIVE,
+                                        start, start + length - 1, body_size, length);
+    return (Response){ .head = NULL, .head_size = head_size, .body = html_content + html_head_size + start, .body_size = length,
+                       .close = closing, .status = 206 };
+}
+
+size_t
+Response_FormatPartialHead( const Response *partial, char *buffer )
+{
+    size_t start = partial->body - (html_content + html_head_size);
+    snprintf(buffer, BH2_PARTIAL_HEAD_SIZE, HTTP_PARTIAL_FORMAT, page_etag, partial->close ? BH2_HTTP_CLOSE : BH2_HTTP_KEEP_ALIVE,
+             start, start + partial->body_size - 1, html_content_size - html_head_size, partial->body_size);
+    return partial->head_size;
+}
+
+void
+Response_DestroyAll( void )
+{
+    free(html_content);
+    html_content = NULL;
+    free(closing_page_head);
+    closing_page_head = NULL;
+    Template_DestroyS(&page_template);
+    Template_DestroyS(&page_head_template);
+    Template_DestroyS(&closing_page_template);
+    Template_DestroyS(&closing_page_head_template);
+    memset(responses, 0, sizeof(responses));
+    memset(closing_responses, 0, sizeof(closing_responses));
+}
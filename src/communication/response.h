@@ -0,0 +1,147 @@
+#ifndef BH2_COMMUNICATION_RESPONSE_H
+#define BH2_COMMUNICATION_RESPONSE_H
+
+#include <pch.h>
+
+#include "template.h"
+
+// Target of the memory report.
+#define BH2_MEMORY_REPORT_PATH "/__bh2/memory"
+
+// Target of the event stream, see events.h.
+#define BH2_EVENTS_PATH "/__bh2/events"
+
+// Largest memory report, header included. Longer bodies are cut.
+#define BH2_MEMORY_REPORT_SIZE 4096
+
+// Largest header of a partial response, see Response_FormatPartialHead().
+#define BH2_PARTIAL_HEAD_SIZE 384
+
+// Size of page_etag, quotes and terminator included.
+#define BH2_PAGE_ETAG_SIZE 19
+
+// Every response the server can give, built once before any client is accepted.
+typedef enum ResponseKind
+{
+    // The html page.
+    RESPONSE_PAGE,
+    // Headers of the html page, for HEAD.
+    RESPONSE_PAGE_HEAD,
+    // 206 with a range of the page, for GET with Range. Its header differs for every range, it's made by
+    // Response_Partial() and Response_FormatPartialHead(), and the tables only hold its status line.
+    RESPONSE_PARTIAL,
+    // 416, for a Range past the end of the page.
+    RESPONSE_RANGE_NOT_SATISFIABLE,
+    // Allowed methods, for OPTIONS.
+    RESPONSE_OPTIONS,
+    // 400, the connection is closed after it.
+    RESPONSE_BAD_REQUEST,
+    // 405, for methods other than the above.
+    RESPONSE_BAD_METHOD,
+    // 414, the connection is closed after it.
+    RESPONSE_URI_TOO_LONG,
+    // 429, for clients over their request rate.
+    RESPONSE_TOO_MANY_REQUESTS,
+    // 503 without a body, for connections refused before being served. The connection is closed after it.
+    RESPONSE_UNAVAILABLE,
+    // Memory usage, for GET BH2_MEMORY_REPORT_PATH. Its body is set by Response_SetMemoryReport().
+    RESPONSE_MEMORY,
+    // Header of an event stream, for GET BH2_EVENTS_PATH. The events follow it until the connection ends.
+    RESPONSE_EVENTS,
+    RESPONSE_KIND_COUNT
+} ResponseKind;
+
+typedef struct Response
+{
+    // Header, or the whole response when it is stored in one piece.
+    const char *head;
+    size_t head_size;
+    // Body, if it is stored apart from the header.
+    const char *body;
+    size_t body_size;
+    // Template the response is written from, NULL if it's written from head and body.
+    // head_size is then the size of a filled template, and head only holds its status line.
+    const ResponseTemplate *template;
+    // If the connection must be closed once this is written.
+    bool close;
+    // Http status code, taken from the status line.
+    uint16_t status;
+} Response;
+
+// Prebuilt responses, indexed by ResponseKind.
+extern
+Response responses[RESPONSE_KIND_COUNT];
+
+// The same responses telling the client that the connection ends after them.
+// Used while the server is draining. The page body is shared with the one above.
+extern
+Response closing_responses[RESPONSE_KIND_COUNT];
+
+// Strong validator of the page for If-Range, quoted. Empty for a templated page, which is never answered partially.
+extern
+char page_etag[BH2_PAGE_ETAG_SIZE];
+
+///
+/// \brief Build the responses
+///
+/// Build the page response around the html body and fill the response tables.<BR />
+/// The page response is stored in \a html_content.<BR />
+/// A templated page gets a Date header, and its placeholders are filled as it is written, see template.h.
+///
+/// \param body Html body
+/// \param body_size Size of the html body
+/// \param templated If the body is a template
+///
+/// \return true on success, false if out of memory or the template is invalid.
+///
+bool
+Response_BuildAll( const char *body, size_t body_size, bool templated );
+
+///
+/// \brief Set the memory report
+///
+/// Rebuild the memory responses around a new body. They may not be waiting to be written by any client.
+///
+/// \param body Text of the report
+/// \param body_size Size of the text
+///
+void
+Response_SetMemoryReport( const char *body, size_t body_size );
+
+///
+/// \brief Make a partial response
+///
+/// Describe the response to a range of the page. Its body points into \a html_content,
+/// its header is only written by \a Response_FormatPartialHead(), head is NULL.
+///
+/// \param start First byte of the range in the page body
+/// \param length Bytes in the range, the range must be within the body
+/// \param closing If the connection is closed after it
+///
+/// \return The response.
+///
+Response
+Response_Partial( size_t start, size_t length, bool closing );
+
+///
+/// \brief Write the header of a partial response
+///
+/// The same response always gets the same header, so a partly written one can be made again.
+///
+/// \param partial Response made by \a Response_Partial()
+/// \param buffer Room for BH2_PARTIAL_HEAD_SIZE bytes
+///
+/// \return Size of the header, partial->head_size.
+///
+size_t
+Response_FormatPartialHead( const Response *partial, char *buffer );
+
+///
+/// \brief Free the responses
+///
+/// Free what \a Response_BuildAll() allocated.
+///
+void
+Response_DestroyAll( void );
+
+#endif // !BH2_COMMUNICATION_RESPONSE_H
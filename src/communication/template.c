@@ -0,0 +1,222 @@
+// memmem()
+#define _GNU_SOURCE
+
+#include "template.h"
+
+#include <time.h>
+#include <unistd.h>
+
+// Widths of the fields, indexed by TemplateField.
+static
+const size_t FIELD_SIZES[] = { 0, 29, 10, 16 };
+
+// Name filled into {{instance}}.
+static
+char instance_name[BH2_TEMPLATE_INSTANCE_SIZE];
+
+// Time fields of the current second.
+static
+uint64_t clock_second = UINT64_MAX;
+static
+char clock_date[29];
+static
+char clock_time[10];
+
+// Write value as width decimal digits, padded with zeros.
+static
+void
+PutDigits( char *buffer, uint64_t value, size_t width )
+{
+    for (size_t i = width; i-- > 0; value /= 10)
+        buffer[i] = (char)('0' + value % 10);
+}
+
+// Format an IMF-fixdate like "Sun, 06 Nov 1994 08:49:37 GMT", without the locale strftime() would use.
+static
+void
+FormatDate( char *buffer, uint64_t second )
+{
+    static const char DAYS[] = "SunMonTueWedThuFriSat";
+    static const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    time_t t = (time_t)second;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    memcpy(buffer, "Sun, 00 Jan 0000 00:00:00 GMT", 29);
+    memcpy(buffer, DAYS + tm.tm_wday * 3, 3);
+    PutDigits(buffer + 5, tm.tm_mday, 2);
+    memcpy(buffer + 8, MONTHS + tm.tm_mon * 3, 3);
+    PutDigits(buffer + 12, tm.tm_year + 1900, 4);
+    PutDigits(buffer + 17, tm.tm_hour, 2);
+    PutDigits(buffer + 20, tm.tm_min, 2);
+    PutDigits(buffer + 23, tm.tm_sec, 2);
+}
+
+static
+void
+FormatRequestId( char *buffer, uint64_t id )
+{
+    static const char HEX[] = "0123456789abcdef";
+    for (size_t i = 16; i-- > 0; id >>= 4)
+        buffer[i] = HEX[id & 0xF];
+}
+
+void
+Template_Init( const char *instance )
+{
+    if (instance)
+        snprintf(instance_name, sizeof(instance_name), "%s", instance);
+    else if (gethostname(instance_name, sizeof(instance_name) - 1))
+        snprintf(instance_name, sizeof(instance_name), "blackhole2");
+}
+
+ResponseTemplate
+Template_CreateS( void )
+{
+    return (ResponseTemplate){ .segments = TemplateSegmentVector_CreateS(), .size = 0, .field_size = 0 };
+}
+
+// Append a segment, merging static bytes that follow each other in memory.
+static
+void
+AddSegment( ResponseTemplate *template, TemplateField field, const char *bytes, size_t size )
+{
+    size_t segment_size = field == TEMPLATE_FIELD_NONE ? size : FIELD_SIZES[field];
+    if (!segment_size)
+        return;
+    template->size += segment_size;
+    if (field != TEMPLATE_FIELD_NONE)
+        template->field_size += segment_size;
+
+    TemplateSegmentVector *segments = &template->segments;
+    if (field == TEMPLATE_FIELD_NONE && segments->length)
+    {
+        TemplateSegment *last = TemplateSegmentVector_At(segments, segments->length - 1);
+        if (last->field == TEMPLATE_FIELD_NONE && last->bytes + last->size == bytes)
+        {
+            last->size += size;
+            return;
+        }
+    }
+    TemplateSegmentVector_Push(segments, &(TemplateSegment){ .field = field, .bytes = bytes, .size = segment_size });
+}
+
+bool
+Template_Compile( ResponseTemplate *template, const char *text, size_t size )
+{
+    static const struct
+    {
+        const char *name;
+        TemplateField field;
+    } PLACEHOLDERS[] =
+    {
+        { "date", TEMPLATE_FIELD_DATE },
+        { "time", TEMPLATE_FIELD_TIME },
+        { "request_id", TEMPLATE_FIELD_REQUEST_ID },
+        { "instance", TEMPLATE_FIELD_NONE }
+    };
+
+    const char *end = text + size;
+    const char *open = NULL;
+    while ((open = memmem(text, end - text, "{{", 2)))
+    {
+        AddSegment(template, TEMPLATE_FIELD_NONE, text, open - text);
+        const char *name = open + 2;
+        const char *close = memmem(name, end - name, "}}", 2);
+        if (!close)
+            return false;
+
+        size_t name_len = close - name;
+        size_t p = 0;
+        for (; p < sizeof(PLACEHOLDERS) / sizeof(PLACEHOLDERS[0]); p++)
+        {
+            if (strlen(PLACEHOLDERS[p].name) == name_len && !memcmp(PLACEHOLDERS[p].name, name, name_len))
+                break;
+        }
+        if (p == sizeof(PLACEHOLDERS) / sizeof(PLACEHOLDERS[0]))
+            return false;
+
+        // The instance never changes, it's static bytes of its own.
+        if (PLACEHOLDERS[p].field == TEMPLATE_FIELD_NONE)
+            AddSegment(template, TEMPLATE_FIELD_NONE, instance_name, strlen(instance_name));
+        else
+            AddSegment(template, PLACEHOLDERS[p].field, NULL, 0);
+        text = close + 2;
+    }
+    AddSegment(template, TEMPLATE_FIELD_NONE, text, end - text);
+    return true;
+}
+
+void
+Template_SetTime( uint64_t second )
+{
+    if (second == clock_second)
+        return;
+    clock_second = second;
+    FormatDate(clock_date, second);
+    PutDigits(clock_time, second, 10);
+}
+
+size_t
+Template_Fill( const ResponseTemplate *template, const TemplateValues *values, size_t offset,
+               struct iovec *iov, size_t iov_room, TemplateScratch *scratch )
+{
+    if (scratch->size - scratch->used < template->field_size)
+        return 0;
+
+    size_t used = 0, scratch_start = scratch->used;
+    for (size_t s = 0; s < template->segments.length; s++)
+    {
+        const TemplateSegment *segment = TemplateSegmentVector_At(&template->segments, s);
+        if (offset >= segment->size)
+        {
+            offset -= segment->size;
+            continue;
+        }
+        if (used == iov_room)
+        {
+            scratch->used = scratch_start;
+            return 0;
+        }
+
+        const char *bytes = segment->bytes;
+        char *value = scratch->ptr + scratch->used;
+        switch (segment->field)
+        {
+            case TEMPLATE_FIELD_NONE:
+                break;
+            case TEMPLATE_FIELD_DATE:
+                if (values->second == clock_second)
+                    bytes = clock_date;
+                else
+                    FormatDate(value, values->second);
+                break;
+            case TEMPLATE_FIELD_TIME:
+                if (values->second == clock_second)
+                    bytes = clock_time;
+                else
+                    PutDigits(value, values->second, 10);
+                break;
+            case TEMPLATE_FIELD_REQUEST_ID:
+                FormatRequestId(value, values->request_id);
+                break;
+        }
+        if (!bytes)
+        {
+            bytes = value;
+            scratch->used += segment->size;
+        }
+
+        iov[used].iov_base = (char *)bytes + offset;
+        iov[used++].iov_len = segment->size - offset;
+        offset = 0;
+    }
+    return used;
+}
+
+void
+Template_DestroyS( ResponseTemplate *template )
+{
+    TemplateSegmentVector_DestroyS(&template->segments);
+    *template = Template_CreateS();
+}
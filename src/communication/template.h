@@ -0,0 +1,148 @@
+#ifndef BH2_COMMUNICATION_TEMPLATE_H
+#define BH2_COMMUNICATION_TEMPLATE_H
+
+#include <pch.h>
+
+#include "../container/typed_vector.h"
+
+#include <sys/uio.h>
+
+/*
+
+    Responses with a few values filled in as they are written.
+
+    A template is compiled once from text with {{name}} placeholders into static segments,
+    which point into the text, and typed fields:
+
+        {{date}}        Http date of the second the response is written, 29 bytes.
+        {{time}}        Unix time of that second, 10 digits.
+        {{request_id}}  Number of the response among the ones written from templates, 16 hex digits.
+        {{instance}}    Name of this instance, see Template_Init(). Fixed when compiling.
+
+    Every field has a fixed width, so a template has the same size whatever its values are,
+    and the response sizes counted everywhere else stay right.
+
+    Filling a template only copies the field values into a scratch buffer, the static segments
+    are written from where they are. Time fields are formatted at most once per second.
+
+*/
+
+// Longest instance name, longer ones are cut.
+#define BH2_TEMPLATE_INSTANCE_SIZE 64
+
+typedef enum TemplateField
+{
+    // Static bytes.
+    TEMPLATE_FIELD_NONE,
+    TEMPLATE_FIELD_DATE,
+    TEMPLATE_FIELD_TIME,
+    TEMPLATE_FIELD_REQUEST_ID
+} TemplateField;
+
+typedef struct TemplateSegment
+{
+    TemplateField field;
+    // Static bytes, only for TEMPLATE_FIELD_NONE.
+    const char *bytes;
+    size_t size;
+} TemplateSegment;
+
+VECTOR_DEFINE(TemplateSegmentVector, TemplateSegment)
+
+typedef struct ResponseTemplate
+{
+    TemplateSegmentVector segments;
+    // Size of a filled template.
+    size_t size;
+    // Bytes of it filled per response.
+    size_t field_size;
+} ResponseTemplate;
+
+// Values of one response.
+typedef struct TemplateValues
+{
+    // Unix time in seconds.
+    uint64_t second;
+    uint64_t request_id;
+} TemplateValues;
+
+// Room for the values of a batch of responses.
+typedef struct TemplateScratch
+{
+    char *ptr;
+    size_t size;
+    size_t used;
+} TemplateScratch;
+
+///
+/// \brief Initialize templates
+///
+/// Set the instance name filled into templates compiled from now on.
+///
+/// \param instance Name of the instance, NULL for the host name
+///
+void
+Template_Init( const char *instance );
+
+///
+/// \brief Create a template
+///
+/// Create an empty template by stack.<BR />
+/// <B>The created template must be freed by \a Template_DestroyS().</B>
+///
+/// \return Created template
+///
+ResponseTemplate
+Template_CreateS( void );
+
+///
+/// \brief Compile text into a template
+///
+/// Append the segments of text to a template. The text must outlive the template.
+///
+/// \param template Template to append to
+/// \param text Text with placeholders
+/// \param size Size of the text
+///
+/// \return false if the text has an unknown or unterminated placeholder.
+///
+bool
+Template_Compile( ResponseTemplate *template, const char *text, size_t size );
+
+///
+/// \brief Set the current time
+///
+/// Format the time fields of a new second. Filling with another second formats them again for every response.
+///
+/// \param second Unix time in seconds
+///
+void
+Template_SetTime( uint64_t second );
+
+///
+/// \brief Fill a template into iovecs
+///
+/// Write the field values into the scratch buffer and point iovecs at them and the static segments.
+///
+/// \param template Template to fill
+/// \param values Values of the response
+/// \param offset Bytes of the response already written, which are skipped
+/// \param iov Iovecs to fill
+/// \param iov_room Iovecs available
+/// \param scratch Scratch buffer the values are written to
+///
+/// \return Iovecs used, 0 if there's not enough room in either of them.
+///
+size_t
+Template_Fill( const ResponseTemplate *template, const TemplateValues *values, size_t offset,
+               struct iovec *iov, size_t iov_room, TemplateScratch *scratch );
+
+///
+/// \brief Destroy a template
+///
+/// \param template Template to destroy
+///
+void
+Template_DestroyS( ResponseTemplate *template );
+
+#endif // !BH2_COMMUNICATION_TEMPLATE_H
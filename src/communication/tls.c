@@ -0,0 +1,158 @@
+#include "tls.h"
+
+#ifdef BH2_TLS
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Shared by every connection, NULL until initialized.
+static
+SSL_CTX *tls_ctx;
+
+// Text of the last error.
+static
+char error_text[256];
+
+// Keep the text of the OpenSSL error at the front of the queue, or of errno, and clear the queue.
+static
+void
+SaveError( void )
+{
+    unsigned long error = ERR_get_error();
+    if (error)
+        ERR_error_string_n(error, error_text, sizeof(error_text));
+    else
+        snprintf(error_text, sizeof(error_text), "%s", strerror(errno));
+    ERR_clear_error();
+}
+
+// Check that the kernel has the tls ULP. Setting it on a socket that is not connected fails either way,
+// but with ENOTCONN only if the ULP exists.
+static
+bool
+KernelHasTls( void )
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return false;
+    int result = setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+    int error = errno;
+    close(fd);
+    return !result || error != ENOENT;
+}
+
+bool
+Tls_Init( const char *cert_path, const char *key_path )
+{
+    if (!KernelHasTls())
+    {
+        snprintf(error_text, sizeof(error_text), "the kernel has no tls module, try modprobe tls");
+        return false;
+    }
+
+    tls_ctx = SSL_CTX_new(TLS_server_method());
+    if (!tls_ctx)
+    {
+        SaveError();
+        return false;
+    }
+
+    // Renegotiating would need the keys back from the kernel.
+    SSL_CTX_set_options(tls_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    // Older OpenSSL hands only the sending keys of TLS 1.3 to the kernel.
+    SSL_CTX_set_max_proto_version(tls_ctx, TLS1_2_VERSION);
+#endif
+    // Ciphers the kernel implements, so no connection is left half offloaded.
+    SSL_CTX_set_cipher_list(tls_ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_ciphersuites(tls_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+
+    // Tickets are on by default, the cache serves clients resuming by session id.
+    SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(tls_ctx, BH2_TLS_SESSION_CACHE);
+    SSL_CTX_set_timeout(tls_ctx, BH2_TLS_SESSION_TIMEOUT);
+    SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char *)"blackhole2", sizeof("blackhole2") - 1);
+
+    if (SSL_CTX_use_certificate_chain_file(tls_ctx, cert_path) != 1 ||
+        SSL_CTX_use_PrivateKey_file(tls_ctx, key_path, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(tls_ctx) != 1)
+    {
+        SaveError();
+        SSL_CTX_free(tls_ctx);
+        tls_ctx = NULL;
+        return false;
+    }
+    return true;
+}
+
+const char *
+Tls_Error( void )
+{
+    return error_text;
+}
+
+TlsHandshake *
+Tls_Accept( int fd )
+{
+    SSL *ssl = SSL_new(tls_ctx);
+    if (!ssl)
+        return NULL;
+    // The socket BIO leaves the socket open when freed.
+    if (SSL_set_fd(ssl, fd) != 1)
+    {
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+TlsResult
+Tls_Handshake( TlsHandshake *handshake, bool *resumed )
+{
+    ERR_clear_error();
+    int result = SSL_do_handshake(handshake);
+    if (result == 1)
+    {
+        // Records only the kernel can read or write from now on, so both directions must be offloaded.
+        if (!BIO_get_ktls_send(SSL_get_wbio(handshake)) || !BIO_get_ktls_recv(SSL_get_rbio(handshake)))
+        {
+            snprintf(error_text, sizeof(error_text), "%s with %s could not be handed to the kernel",
+                     SSL_get_version(handshake), SSL_get_cipher_name(handshake));
+            return TLS_FAILED;
+        }
+        *resumed = SSL_session_reused(handshake);
+        return TLS_DONE;
+    }
+
+    switch (SSL_get_error(handshake, result))
+    {
+        case SSL_ERROR_WANT_READ:
+            return TLS_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return TLS_WANT_WRITE;
+        default:
+            SaveError();
+            return TLS_FAILED;
+    }
+}
+
+void
+Tls_Free( TlsHandshake *handshake )
+{
+    SSL_free(handshake);
+}
+
+void
+Tls_Cleanup( void )
+{
+    SSL_CTX_free(tls_ctx);
+    tls_ctx = NULL;
+}
+
+#endif // BH2_TLS
@@ -0,0 +1,103 @@
+#ifndef BH2_COMMUNICATION_TLS_H
+#define BH2_COMMUNICATION_TLS_H
+
+#include <pch.h>
+
+/*
+
+    HTTPS listeners, with the records encrypted by the kernel (kTLS).
+
+    The handshake is done with OpenSSL by the data thread, a step each time the socket is ready. Once it's done, OpenSSL hands the
+    keys of both directions to the socket (TCP_ULP "tls") and its state is freed. From then on the connection
+    is read and written with plain recv() and sendmsg() like any other, so the prebuilt responses are still
+    sent from where they are, and the kernel encrypts them on the way out.
+
+    The sockets must be non-blocking. The kernel only hands out whole records, so recv() fails with EAGAIN
+    while one is still arriving, and with EIO when an alert or close_notify comes instead of data.
+
+    Reconnecting clients resume their session from a ticket or the session cache, skipping the key exchange.
+
+    Only built with BH2_TLS defined, linking -lssl -lcrypto. The kernel needs the tls module.
+
+*/
+
+// Sessions kept in the server's session cache, for clients resuming without a ticket.
+#define BH2_TLS_SESSION_CACHE 20480
+
+// How long a session may be resumed, in seconds.
+#define BH2_TLS_SESSION_TIMEOUT 7200
+
+// OpenSSL connection state, only held during the handshake.
+typedef struct ssl_st TlsHandshake;
+
+typedef enum TlsResult
+{
+    // Handshake is done and the socket encrypts by itself.
+    TLS_DONE,
+    TLS_WANT_READ,
+    TLS_WANT_WRITE,
+    // Handshake failed, or the keys could not be handed to the kernel. The client has to be dropped.
+    TLS_FAILED
+} TlsResult;
+
+///
+/// \brief Initialize TLS
+///
+/// Load the certificate chain and the private key, and check that the kernel can take the keys over.
+///
+/// \param cert_path PEM file of the certificate chain
+/// \param key_path PEM file of the private key, may be the same file
+///
+/// \return false if HTTPS can't be served, see \a Tls_Error().
+///
+bool
+Tls_Init( const char *cert_path, const char *key_path );
+
+///
+/// \brief Describe the last error
+///
+/// \return Text of the last OpenSSL error, or of errno if there's none.
+///
+const char *
+Tls_Error( void );
+
+///
+/// \brief Start the handshake of an accepted client
+///
+/// \param fd Non-blocking socket of the client
+///
+/// \return Handshake state, NULL if out of memory.
+///
+TlsHandshake *
+Tls_Accept( int fd );
+
+///
+/// \brief Go on with a handshake
+///
+/// Do as much of the handshake as the socket allows without blocking.
+///
+/// \param handshake Handshake state
+/// \param resumed Retrieves whether the session was resumed, set once done
+///
+/// \return What the handshake waits for.
+///
+TlsResult
+Tls_Handshake( TlsHandshake *handshake, bool *resumed );
+
+///
+/// \brief Free a handshake
+///
+/// The socket is left open, and keeps encrypting if the handshake was done.
+///
+/// \param handshake Handshake state, may be NULL
+///
+void
+Tls_Free( TlsHandshake *handshake );
+
+///
+/// \brief Clean TLS up
+///
+void
+Tls_Cleanup( void );
+
+#endif // !BH2_COMMUNICATION_TLS_H
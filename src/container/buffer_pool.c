@@ -0,0 +1,72 @@
+#include "buffer_pool.h"
+
+BufferPool
+BufferPool_CreateS( size_t buffer_size, size_t max_buffers )
+{
+    return (BufferPool)
+    {
+        .buffer_size = buffer_size,
+        .max_buffers = max_buffers,
+        .allocated = 0ULL,
+        .in_use = 0ULL,
+        .peak_in_use = 0ULL,
+        .exhausted = 0ULL,
+        .free_buffers = Vector_CreateS(sizeof(char *), NULL)
+    };
+}
+
+char *
+BufferPool_Acquire( BufferPool *pool )
+{
+    char *buffer = NULL;
+
+    if (pool->free_buffers.length)
+        Vector_Pop(&pool->free_buffers, &buffer);
+    else if (pool->allocated < pool->max_buffers)
+    {
+        buffer = malloc(pool->buffer_size);
+        if (!buffer)
+        {
+            pool->exhausted++;
+            return NULL;
+        }
+        pool->allocated++;
+    }
+    else
+    {
+        pool->exhausted++;
+        return NULL;
+    }
+
+    pool->in_use++;
+    if (pool->in_use > pool->peak_in_use)
+        pool->peak_in_use = pool->in_use;
+
+    return buffer;
+}
+
+void
+BufferPool_Release( BufferPool *pool, char *buffer )
+{
+    Vector_Push(&pool->free_buffers, &buffer);
+    pool->in_use--;
+}
+
+void
+BufferPool_Trim( BufferPool *pool, size_t keep )
+{
+    char *buffer = NULL;
+    while (pool->free_buffers.length > keep)
+    {
+        Vector_Pop(&pool->free_buffers, &buffer);
+        free(buffer);
+        pool->allocated--;
+    }
+}
+
+void
+BufferPool_DestroyS( BufferPool *pool )
+{
+    BufferPool_Trim(pool, 0ULL);
+    Vector_DestroyS(&pool->free_buffers);
+}
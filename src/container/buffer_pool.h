@@ -0,0 +1,87 @@
+#ifndef BH2_CONTAINER_BUFFER_POOL_H
+#define BH2_CONTAINER_BUFFER_POOL_H
+
+#include <pch.h>
+
+#include "vector.h"
+
+// A pool of equally sized byte buffers. Buffers are allocated on demand up to a limit,
+// and idle ones are kept in a free list for reuse.
+// Not thread safe, the pool is meant to be owned by one thread.
+
+typedef struct BufferPool
+{
+    size_t buffer_size;
+    size_t max_buffers;
+    // Buffers currently allocated, idle or not.
+    size_t allocated;
+    // Buffers currently handed out.
+    size_t in_use;
+    // Highest in_use ever reached.
+    size_t peak_in_use;
+    // Times an acquire failed because max_buffers was reached.
+    size_t exhausted;
+    // Idle buffers, as char *.
+    Vector free_buffers;
+} BufferPool;
+
+///
+/// \brief Create a buffer pool
+///
+/// Create a buffer pool by stack. No buffer is allocated until acquired.<BR />
+/// <B>The created pool must be freed by \a BufferPool_DestroyS().</B>
+///
+/// \param buffer_size Size of every buffer in the pool
+/// \param max_buffers Maximum number of buffers that may be allocated at once
+///
+/// \return Created pool
+///
+BufferPool
+BufferPool_CreateS( size_t buffer_size, size_t max_buffers );
+
+///
+/// \brief Acquire a buffer
+///
+/// Take an idle buffer from the pool, allocating a new one if there is none.
+///
+/// \param pool Pool to acquire from
+///
+/// \return Buffer of \a buffer_size bytes, NULL if the pool is exhausted.
+///
+char *
+BufferPool_Acquire( BufferPool *pool );
+
+///
+/// \brief Release a buffer
+///
+/// Give a buffer acquired from the pool back to it.
+///
+/// \param pool Pool to release to
+/// \param buffer Buffer to release
+///
+void
+BufferPool_Release( BufferPool *pool, char *buffer );
+
+///
+/// \brief Trim the pool
+///
+/// Free idle buffers until at most \a keep of them are left.
+///
+/// \param pool Pool to trim
+/// \param keep Number of idle buffers to keep
+///
+void
+BufferPool_Trim( BufferPool *pool, size_t keep );
+
+///
+/// \brief Destroy a buffer pool
+///
+/// Destroy a pool created by \a BufferPool_CreateS(), freeing all its idle buffers.<BR />
+/// Buffers still in use must be released before this.
+///
+/// \param pool Pool to destroy
+///
+void
+BufferPool_DestroyS( BufferPool *pool );
+
+#endif // !BH2_CONTAINER_BUFFER_POOL_H
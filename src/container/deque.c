@@ -0,0 +1,160 @@
+#include "deque.h"
+
+// Smallest allocation, so short queues don't grow one slot at a time.
+#define BH2_DEQUE_MIN_CAPACITY 16ULL
+
+// Slot of an index from the front.
+static inline
+size_t
+Slot( const Deque *deque, size_t index )
+{
+    return (deque->head + index) & (deque->capacity - 1ULL);
+}
+
+static inline
+void *
+SlotPtr( const Deque *deque, size_t slot )
+{
+    return (char *)deque->ptr + deque->elem_size * slot;
+}
+
+// Double the capacity, unwrapping the elements to the start of the new buffer.
+static
+bool
+Grow( Deque *deque )
+{
+    size_t capacity = deque->capacity ? deque->capacity * 2ULL : BH2_DEQUE_MIN_CAPACITY;
+    char *ptr = malloc(deque->elem_size * capacity);
+    if (!ptr)
+        return false;
+
+    if (deque->length)
+    {
+        size_t first = deque->capacity - deque->head;
+        if (first > deque->length)
+            first = deque->length;
+        memcpy(ptr, SlotPtr(deque, deque->head), deque->elem_size * first);
+        memcpy(ptr + deque->elem_size * first, deque->ptr, deque->elem_size * (deque->length - first));
+    }
+    free(deque->ptr);
+    deque->ptr = ptr;
+    deque->capacity = capacity;
+    deque->head = 0ULL;
+    return true;
+}
+
+Deque
+Deque_CreateS( size_t elem_size )
+{
+    return (Deque)
+    {
+        .elem_size = elem_size,
+        .capacity = 0ULL,
+        .head = 0ULL,
+        .length = 0ULL,
+        .ptr = NULL
+    };
+}
+
+void *
+Deque_PtrAt( const Deque *deque, size_t index )
+{
+    return SlotPtr(deque, Slot(deque, index));
+}
+
+bool
+Deque_Push( Deque *deque, const void *elem )
+{
+    if (deque->length == deque->capacity && !Grow(deque))
+        return false;
+    memcpy(Deque_PtrAt(deque, deque->length), elem, deque->elem_size);
+    deque->length++;
+    return true;
+}
+
+bool
+Deque_Push_Front( Deque *deque, const void *elem )
+{
+    if (deque->length == deque->capacity && !Grow(deque))
+        return false;
+    deque->head = (deque->head - 1ULL) & (deque->capacity - 1ULL);
+    memcpy(SlotPtr(deque, deque->head), elem, deque->elem_size);
+    deque->length++;
+    return true;
+}
+
+bool
+Deque_Pop( Deque *deque, void *ptr_retrieve )
+{
+    if (!deque->length)
+        return false;
+    deque->length--;
+    if (ptr_retrieve)
+        memcpy(ptr_retrieve, Deque_PtrAt(deque, deque->length), deque->elem_size);
+    return true;
+}
+
+bool
+Deque_Pop_Front( Deque *deque, void *ptr_retrieve )
+{
+    if (!deque->length)
+        return false;
+    if (ptr_retrieve)
+        memcpy(ptr_retrieve, SlotPtr(deque, deque->head), deque->elem_size);
+    deque->head = Slot(deque, 1ULL);
+    deque->length--;
+    return true;
+}
+
+void
+Deque_Delete( Deque *deque, size_t index )
+{
+    if (index >= deque->length)
+        return;
+
+    // Shift whichever side is shorter by one, in runs that are contiguous in both the source and destination.
+    if (index < deque->length / 2ULL)
+    {
+        for (size_t end = index; end > 0ULL; )
+        {
+            size_t src = Slot(deque, end - 1ULL), dst = Slot(deque, end);
+            size_t run = end;
+            if (run > src + 1ULL)
+                run = src + 1ULL;
+            if (run > dst + 1ULL)
+                run = dst + 1ULL;
+            memmove(SlotPtr(deque, dst + 1ULL - run), SlotPtr(deque, src + 1ULL - run), deque->elem_size * run);
+            end -= run;
+        }
+        deque->head = Slot(deque, 1ULL);
+    }
+    else
+    {
+        for (size_t i = index; i + 1ULL < deque->length; )
+        {
+            size_t src = Slot(deque, i + 1ULL), dst = Slot(deque, i);
+            size_t run = deque->length - 1ULL - i;
+            if (run > deque->capacity - src)
+                run = deque->capacity - src;
+            if (run > deque->capacity - dst)
+                run = deque->capacity - dst;
+            memmove(SlotPtr(deque, dst), SlotPtr(deque, src), deque->elem_size * run);
+            i += run;
+        }
+    }
+    deque->length--;
+}
+
+void
+Deque_Clear( Deque *deque )
+{
+    deque->head = 0ULL;
+    deque->length = 0ULL;
+}
+
+void
+Deque_DestroyS( Deque *deque )
+{
+    free(deque->ptr);
+    *deque = Deque_CreateS(deque->elem_size);
+}
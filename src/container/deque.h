@@ -0,0 +1,123 @@
+#ifndef BH2_CONTAINER_DEQUE_H
+#define BH2_CONTAINER_DEQUE_H
+
+#include <pch.h>
+
+// A double ended queue in a ring buffer. Pushing and popping at either end is O(1),
+// so it suits FIFO queues that Vector_Pop_Front() would memmove through.
+// Elements are plain data, the deque never frees anything they point to.
+
+typedef struct Deque
+{
+    size_t elem_size;
+    // Always a power of 2, or 0 before the first push.
+    size_t capacity;
+    // Slot of the first element.
+    size_t head;
+    size_t length;
+    void *ptr;
+} Deque;
+
+///
+/// \brief Create a deque
+///
+/// Create a deque by stack. Nothing is allocated until the first push.<BR />
+/// <B>The created deque must be freed by \a Deque_DestroyS().</B>
+///
+/// \param elem_size Size of deque's elements
+///
+/// \return Created deque
+///
+Deque
+Deque_CreateS( size_t elem_size );
+
+///
+/// \brief Get the indexed element
+///
+/// \param deque Deque
+/// \param index Index from the front, must be in bound
+///
+/// \return Pointer to the element
+///
+void *
+Deque_PtrAt( const Deque *deque, size_t index );
+
+///
+/// \brief Push an element
+///
+/// Push an element into the back of deque.
+///
+/// \param deque Deque to push into
+/// \param elem Element to be pushed
+///
+/// \return false if out of memory, the deque is unchanged then.
+///
+bool
+Deque_Push( Deque *deque, const void *elem );
+
+///
+/// \brief Push an element to front
+///
+/// \param deque Deque to push into
+/// \param elem Element to be pushed
+///
+/// \return false if out of memory, the deque is unchanged then.
+///
+bool
+Deque_Push_Front( Deque *deque, const void *elem );
+
+///
+/// \brief Pop the last element
+///
+/// \param deque Deque to pop out
+/// \param ptr_retrieve Pointer to retrieve the element, may be NULL
+///
+/// \return false if the deque is empty.
+///
+bool
+Deque_Pop( Deque *deque, void *ptr_retrieve );
+
+///
+/// \brief Pop the first element
+///
+/// \param deque Deque to pop out
+/// \param ptr_retrieve Pointer to retrieve the element, may be NULL
+///
+/// \return false if the deque is empty.
+///
+bool
+Deque_Pop_Front( Deque *deque, void *ptr_retrieve );
+
+///
+/// \brief Delete an element
+///
+/// Delete an element in index, shifting whichever side of it is shorter.<BR />
+/// If index is out of bound, it does nothing.
+///
+/// \param deque Deque to operate
+/// \param index Index to delete
+///
+void
+Deque_Delete( Deque *deque, size_t index );
+
+///
+/// \brief Clear out a deque
+///
+/// Clear the content of a deque. Its capacity is unchanged.
+///
+/// \param deque Deque to clear
+///
+void
+Deque_Clear( Deque *deque );
+
+///
+/// \brief Destroy a deque
+///
+/// Destroy a deque created by \a Deque_CreateS().
+///
+/// \param deque Deque to destroy
+///
+void
+Deque_DestroyS( Deque *deque );
+
+#endif // !BH2_CONTAINER_DEQUE_H
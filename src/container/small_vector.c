@@ -0,0 +1,80 @@
+#include "small_vector.h"
+
+static inline
+unsigned char *
+Elems( SmallVector *vec )
+{
+    return vec->heap ? vec->heap : vec->inline_elems;
+}
+
+SmallVector
+SmallVector_CreateS( size_t elem_size )
+{
+    return (SmallVector)
+    {
+        .elem_size = elem_size,
+        .capacity = BH2_SMALL_VECTOR_INLINE_BYTES / elem_size,
+        .length = 0ULL,
+        .heap = NULL
+    };
+}
+
+void *
+SmallVector_PtrAt( SmallVector *vec, size_t index )
+{
+    return Elems(vec) + vec->elem_size * index;
+}
+
+bool
+SmallVector_Push( SmallVector *vec, const void *elem )
+{
+    if (vec->length == vec->capacity)
+    {
+        size_t capacity = vec->capacity ? vec->capacity * 2ULL : 4ULL;
+        void *heap = vec->heap ? realloc(vec->heap, vec->elem_size * capacity) : malloc(vec->elem_size * capacity);
+        if (!heap)
+            return false;
+        // Leaving the struct, bring the inline elements along.
+        if (!vec->heap)
+            memcpy(heap, vec->inline_elems, vec->elem_size * vec->length);
+        vec->heap = heap;
+        vec->capacity = capacity;
+    }
+
+    memcpy(SmallVector_PtrAt(vec, vec->length), elem, vec->elem_size);
+    vec->length++;
+    return true;
+}
+
+bool
+SmallVector_Pop( SmallVector *vec, void *ptr_retrieve )
+{
+    if (!vec->length)
+        return false;
+    vec->length--;
+    if (ptr_retrieve)
+        memcpy(ptr_retrieve, SmallVector_PtrAt(vec, vec->length), vec->elem_size);
+    return true;
+}
+
+void
+SmallVector_Delete( SmallVector *vec, size_t index )
+{
+    if (index >= vec->length)
+        return;
+    memmove(SmallVector_PtrAt(vec, index), SmallVector_PtrAt(vec, index + 1ULL), vec->elem_size * (vec->length - index - 1ULL));
+    vec->length--;
+}
+
+void
+SmallVector_Clear( SmallVector *vec )
+{
+    vec->length = 0ULL;
+}
+
+void
+SmallVector_DestroyS( SmallVector *vec )
+{
+    free(vec->heap);
+    *vec = SmallVector_CreateS(vec->elem_size);
+}
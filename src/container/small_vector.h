@@ -0,0 +1,104 @@
+#ifndef BH2_CONTAINER_SMALL_VECTOR_H
+#define BH2_CONTAINER_SMALL_VECTOR_H
+
+#include <pch.h>
+
+// A vector keeping its first few elements inside the struct, and only allocating once they outgrow it.
+// Nothing points into the struct itself, so it may be moved around like any plain data,
+// e.g. as an element of a Vector.
+// Elements are plain data, the vector never frees anything they point to.
+
+// Bytes of elements stored in the struct.
+#define BH2_SMALL_VECTOR_INLINE_BYTES 64
+
+typedef struct SmallVector
+{
+    size_t elem_size;
+    size_t capacity;
+    size_t length;
+    // Elements once they are on the heap, NULL while they are inline.
+    void *heap;
+    alignas(max_align_t) unsigned char inline_elems[BH2_SMALL_VECTOR_INLINE_BYTES];
+} SmallVector;
+
+///
+/// \brief Create a small vector
+///
+/// Create a small vector by stack.<BR />
+/// <B>The created vector must be freed by \a SmallVector_DestroyS().</B>
+///
+/// \param elem_size Size of vector's elements
+///
+/// \return Created vector
+///
+SmallVector
+SmallVector_CreateS( size_t elem_size );
+
+///
+/// \brief Get the indexed element
+///
+/// \param vec Vector
+/// \param index Index to access, must be in bound
+///
+/// \return Pointer to the element
+///
+void *
+SmallVector_PtrAt( SmallVector *vec, size_t index );
+
+///
+/// \brief Push an element
+///
+/// Push an element into the end of vector.
+///
+/// \param vec Vector to push into
+/// \param elem Element to be pushed
+///
+/// \return false if out of memory, the vector is unchanged then.
+///
+bool
+SmallVector_Push( SmallVector *vec, const void *elem );
+
+///
+/// \brief Pop the last element
+///
+/// \param vec Vector to pop out
+/// \param ptr_retrieve Pointer to retrieve the element, may be NULL
+///
+/// \return false if the vector is empty.
+///
+bool
+SmallVector_Pop( SmallVector *vec, void *ptr_retrieve );
+
+///
+/// \brief Delete an element
+///
+/// Delete an element in index.<BR />
+/// If index is out of bound, it does nothing.
+///
+/// \param vec Vector to operate
+/// \param index Index to delete
+///
+void
+SmallVector_Delete( SmallVector *vec, size_t index );
+
+///
+/// \brief Clear out a vector
+///
+/// Clear the content of a vector. Its capacity is unchanged.
+///
+/// \param vec Vector to clear
+///
+void
+SmallVector_Clear( SmallVector *vec );
+
+///
+/// \brief Destroy a small vector
+///
+/// Destroy a vector created by \a SmallVector_CreateS(), freeing its heap storage if any.
+///
+/// \param vec Vector to destroy
+///
+void
+SmallVector_DestroyS( SmallVector *vec );
+
+#endif // !BH2_CONTAINER_SMALL_VECTOR_H
@@ -0,0 +1,140 @@
+#ifndef BH2_CONTAINER_TYPED_VECTOR_H
+#define BH2_CONTAINER_TYPED_VECTOR_H
+
+#include <pch.h>
+
+/*
+
+    Vectors specialized for one element type at compile time.
+
+    VECTOR_DEFINE(Name, Type) defines the struct Name and its functions Name_*, all static inline,
+    so element offsets and copies are of a size known to the compiler and the calls are inlined.
+    Define each vector once, in the header next to its element type:
+
+        VECTOR_DEFINE(ClientVector, Client)
+
+        ClientVector clients = ClientVector_CreateS();
+        ClientVector_Push(&clients, &client);
+        Client *first = ClientVector_At(&clients, 0);
+        ClientVector_DestroyS(&clients);
+
+    Elements are plain data like with Vector when it has no free function, the vector never frees
+    anything they point to. Growth is the same as Vector's.
+
+*/
+
+// First allocation of a vector, in elements.
+#define BH2_TYPED_VECTOR_MIN_CAPACITY 4ULL
+
+#define VECTOR_DEFINE( Name, Type )                                                             \
+                                                                                                \
+typedef struct Name                                                                             \
+{                                                                                               \
+    size_t capacity;                                                                            \
+    size_t length;                                                                              \
+    Type *ptr;                                                                                  \
+} Name;                                                                                         \
+                                                                                                \
+/* Create a vector by stack, it must be freed by Name##_DestroyS(). */                         \
+static inline                                                                                   \
+Name                                                                                            \
+Name##_CreateS( void )                                                                          \
+{                                                                                               \
+    return (Name){ .capacity = 0ULL, .length = 0ULL, .ptr = NULL };                             \
+}                                                                                               \
+                                                                                                \
+/* Element in index, which must be in bound. */                                                 \
+static inline                                                                                   \
+Type *                                                                                          \
+Name##_At( const Name *vec, size_t index )                                                      \
+{                                                                                               \
+    return vec->ptr + index;                                                                    \
+}                                                                                               \
+                                                                                                \
+/* Grow the capacity until it holds size elements. */                                          \
+static inline                                                                                   \
+void                                                                                            \
+Name##_ExpandUntil( Name *vec, size_t size )                                                    \
+{                                                                                               \
+    if (vec->capacity >= size)                                                                  \
+        return;                                                                                 \
+    size_t capacity = vec->capacity ? vec->capacity : BH2_TYPED_VECTOR_MIN_CAPACITY;            \
+    while (capacity < size)                                                                     \
+        capacity *= 2ULL;                                                                       \
+    vec->ptr = realloc(vec->ptr, sizeof(Type) * capacity);                                      \
+    vec->capacity = capacity;                                                                   \
+}                                                                                               \
+                                                                                                \
+/* Push a copy of elem into the end. */                                                         \
+static inline                                                                                   \
+void                                                                                            \
+Name##_Push( Name *vec, const Type *elem )                                                      \
+{                                                                                               \
+    if (vec->length == vec->capacity)                                                           \
+        Name##_ExpandUntil(vec, vec->length + 1ULL);                                            \
+    vec->ptr[vec->length++] = *elem;                                                            \
+}                                                                                               \
+                                                                                                \
+/* Pop the last element into ptr_retrieve, which may be NULL. Does nothing if empty. */        \
+static inline                                                                                   \
+void                                                                                            \
+Name##_Pop( Name *vec, Type *ptr_retrieve )                                                     \
+{                                                                                               \
+    if (!vec->length)                                                                           \
+        return;                                                                                 \
+    vec->length--;                                                                              \
+    if (ptr_retrieve)                                                                           \
+        *ptr_retrieve = vec->ptr[vec->length];                                                  \
+}                                                                                               \
+                                                                                                \
+/* Delete the element in index, shifting the ones after it. Does nothing if out of bound. */   \
+static inline                                                                                   \
+void                                                                                            \
+Name##_Delete( Name *vec, size_t index )                                                        \
+{                                                                                               \
+    if (index >= vec->length)                                                                   \
+        return;                                                                                 \
+    vec->length--;                                                                              \
+    memmove(vec->ptr + index, vec->ptr + index + 1ULL, sizeof(Type) * (vec->length - index));  \
+}                                                                                               \
+                                                                                                \
+/* Shrink the capacity to the length, freeing everything if empty. */                           \
+static inline                                                                                   \
+void                                                                                            \
+Name##_ShrinkToFit( Name *vec )                                                                 \
+{                                                                                               \
+    if (vec->capacity == vec->length)                                                           \
+        return;                                                                                 \
+    if (!vec->length)                                                                           \
+    {                                                                                           \
+        free(vec->ptr);                                                                         \
+        vec->ptr = NULL;                                                                        \
+        vec->capacity = 0ULL;                                                                   \
+        return;                                                                                 \
+    }                                                                                           \
+    Type *ptr = realloc(vec->ptr, sizeof(Type) * vec->length);                                  \
+    if (ptr)                                                                                    \
+    {                                                                                           \
+        vec->ptr = ptr;                                                                         \
+        vec->capacity = vec->length;                                                            \
+    }                                                                                           \
+}                                                                                               \
+                                                                                                \
+/* Clear the content, the capacity is unchanged. */                                             \
+static inline                                                                                   \
+void                                                                                            \
+Name##_Clear( Name *vec )                                                                       \
+{                                                                                               \
+    vec->length = 0ULL;                                                                         \
+}                                                                                               \
+                                                                                                \
+/* Free a vector created by Name##_CreateS(). */                                                \
+static inline                                                                                   \
+void                                                                                            \
+Name##_DestroyS( Name *vec )                                                                    \
+{                                                                                               \
+    free(vec->ptr);                                                                             \
+    *vec = Name##_CreateS();                                                                    \
+}
+
+#endif // !BH2_CONTAINER_TYPED_VECTOR_H
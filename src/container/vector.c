@@ -1,5 +1,8 @@
 #include "vector.h"
 
+// First allocation of a vector, in elements.
+#define BH2_VECTOR_MIN_CAPACITY 4ULL
+
 Vector *
 Vector_Create( size_t elem_size, VectorFreeFunc free_func )
 {
@@ -68,8 +71,9 @@ Vector_Expand( Vector *vec )
 {
     if (!vec->capacity)
     {
-        vec->capacity = 1ULL;
-        vec->ptr = malloc(vec->elem_size);
+        // Growing 1, 2, 4 costs three reallocs for a handful of elements.
+        vec->capacity = BH2_VECTOR_MIN_CAPACITY;
+        vec->ptr = malloc(vec->elem_size * vec->capacity);
     }
     else
     {
@@ -98,6 +102,7 @@ Vector_ShrinkToFit( Vector *vec )
     else if (vec->capacity && !vec->length)
     {
         free(vec->ptr);
+        vec->ptr = NULL;
         vec->capacity = 0ULL;
     }
 }
@@ -204,7 +209,7 @@ Vector_Pop( Vector *vec, void *ptr_retrieve )
     if (ptr_retrieve)
         memcpy(ptr_retrieve, Vector_PtrAt(vec, vec->length - 1ULL), vec->elem_size);
     else if (vec->free_func)
-        vec->free_func(Vector_PtrAt(vec, vec->length));
+        vec->free_func(Vector_PtrAt(vec, vec->length - 1ULL));
     vec->length--;
 }
 
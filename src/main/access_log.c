@@ -0,0 +1,158 @@
+#include "access_log.h"
+
+#include "clock.h"
+#include "shared.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool access_log_enabled;
+
+static
+const char *log_path;
+
+static
+uint64_t log_rotate_size;
+
+static
+int log_fd = -1;
+
+// Bytes in the current file, header included.
+static
+uint64_t log_file_size;
+
+// Records waiting to be written.
+static
+AccessRecord log_buffer[BH2_ACCESS_LOG_BUFFER_SIZE / sizeof(AccessRecord)];
+static
+size_t log_buffer_len;
+
+// When the buffer was last written, in monotonic milliseconds.
+static
+uint64_t log_last_flush;
+
+// Open the file at log_path, writing the header if it's new.
+static
+bool
+OpenFile( void )
+{
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd == -1)
+        return false;
+
+    struct stat file_stat;
+    if (fstat(log_fd, &file_stat) == -1)
+        return false;
+    log_file_size = (uint64_t)file_stat.st_size;
+    if (log_file_size)
+        return true;
+
+    AccessLogHeader header = { .version = BH2_ACCESS_LOG_VERSION, .record_size = sizeof(AccessRecord) };
+    memcpy(header.magic, BH2_ACCESS_LOG_MAGIC, sizeof(header.magic));
+    if (!WriteAll(log_fd, &header, sizeof(header)))
+        return false;
+    log_file_size = sizeof(header);
+    return true;
+}
+
+// Move the current file aside and start a new one.
+static
+void
+Rotate( void )
+{
+    size_t rotated_len = strlen(log_path) + 3;
+    char *rotated = malloc(rotated_len);
+    if (!rotated)
+        return;
+    snprintf(rotated, rotated_len, "%s.1", log_path);
+
+    close(log_fd);
+    rename(log_path, rotated);
+    free(rotated);
+    if (!OpenFile() && log_fd != -1)
+    {
+        close(log_fd);
+        log_fd = -1;
+    }
+}
+
+bool
+AccessLog_Open( const char *path, uint64_t rotate_size )
+{
+    log_path = path;
+    log_rotate_size = rotate_size;
+    log_buffer_len = 0;
+    log_last_flush = Clock_MonotonicMs();
+    if (!OpenFile())
+    {
+        int error = errno;
+        if (log_fd != -1)
+            close(log_fd);
+        log_fd = -1;
+        errno = error;
+        return false;
+    }
+
+    access_log_enabled = true;
+    return true;
+}
+
+uint32_t
+AccessLog_HashPath( const char *target, size_t length )
+{
+    uint32_t hash = 0x811C9DC5U;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t)target[i]) * 0x01000193U;
+    return hash ? hash : 1;
+}
+
+void
+AccessLog_Add( const AccessRecord *record )
+{
+    log_buffer[log_buffer_len++] = *record;
+    if (log_buffer_len == sizeof(log_buffer) / sizeof(log_buffer[0]))
+        AccessLog_Flush(true);
+}
+
+void
+AccessLog_Flush( bool force )
+{
+    uint64_t now = Clock_MonotonicMs();
+    if (!log_buffer_len || (!force && now - log_last_flush < BH2_ACCESS_LOG_FLUSH_MS))
+        return;
+    log_last_flush = now;
+
+    // Records that can't be written are lost, the log must never hold the server up.
+    size_t bytes = log_buffer_len * sizeof(AccessRecord);
+    log_buffer_len = 0;
+    if (log_fd == -1)
+        return;
+    if (log_file_size + bytes > log_rotate_size && log_file_size > sizeof(AccessLogHeader))
+    {
+        Rotate();
+        if (log_fd == -1)
+            return;
+    }
+    if (WriteAll(log_fd, log_buffer, bytes))
+        log_file_size += bytes;
+}
+
+uint64_t
+AccessLog_FlushDeadline( void )
+{
+    return log_buffer_len ? log_last_flush + BH2_ACCESS_LOG_FLUSH_MS : UINT64_MAX;
+}
+
+void
+AccessLog_Close( void )
+{
+    if (!access_log_enabled)
+        return;
+
+    AccessLog_Flush(true);
+    if (log_fd != -1)
+        close(log_fd);
+    log_fd = -1;
+    access_log_enabled = false;
+}
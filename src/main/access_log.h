@@ -0,0 +1,132 @@
+#ifndef BH2_SERVER_ACCESS_LOG_H
+#define BH2_SERVER_ACCESS_LOG_H
+
+#include <pch.h>
+
+/*
+
+    Binary access log, one fixed-size record per answered request.
+
+    A file starts with an AccessLogHeader, followed by AccessRecords back to back,
+    both in the byte order of the host that wrote them. Records are gathered in a
+    buffer owned by the data thread, and written in batches. Once a file grows past
+    its size limit, it's renamed to "<path>.1", replacing the previous one, and a new
+    file is started.
+
+    bh2-logdump turns these files into CSV or JSON.
+
+*/
+
+#define BH2_ACCESS_LOG_MAGIC "BH2L"
+#define BH2_ACCESS_LOG_VERSION 1
+
+// Bytes of records gathered before they are written.
+#define BH2_ACCESS_LOG_BUFFER_SIZE 65536
+
+// Longest time records wait in the buffer.
+#define BH2_ACCESS_LOG_FLUSH_MS 1000
+
+// Size a file may grow to unless told otherwise.
+#define BH2_ACCESS_LOG_DEFAULT_ROTATE_SIZE (64ULL * 1024ULL * 1024ULL)
+
+// Method of a request that could not be parsed.
+#define BH2_ACCESS_METHOD_NONE 0xFF
+
+typedef struct AccessLogHeader
+{
+    char magic[4];
+    uint32_t version;
+    // Size of every record, so older readers may skip fields added at the end.
+    uint32_t record_size;
+    uint32_t reserved;
+} AccessLogHeader;
+
+typedef struct AccessRecord
+{
+    // When the response was completely written, in microseconds since the epoch.
+    uint64_t time_us;
+    // Peer address, IPv4 as ::ffff:a.b.c.d, all zero for unix clients.
+    uint8_t addr[16];
+    uint16_t port;
+    // RequestMethod, BH2_ACCESS_METHOD_NONE if the request could not be parsed.
+    uint8_t method;
+    uint8_t reserved;
+    // Http status code of the response.
+    uint16_t status;
+    uint16_t reserved2;
+    // FNV-1a of the request target, 0 if there is none.
+    uint32_t path_hash;
+    // Bytes of the response.
+    uint32_t bytes;
+    // From reading the end of the request to writing the end of the response.
+    uint32_t latency_us;
+    uint32_t reserved3;
+} AccessRecord;
+
+static_assert(sizeof(AccessRecord) == 48, "Access records are 48 bytes on every platform");
+
+// If the access log is open. Set once by AccessLog_Open() before any thread is created.
+extern
+bool access_log_enabled;
+
+///
+/// \brief Open the access log
+///
+/// \param path File to append to, created if it doesn't exist
+/// \param rotate_size Size a file may grow to before it's rotated
+///
+/// \return true on success.
+///
+bool
+AccessLog_Open( const char *path, uint64_t rotate_size );
+
+///
+/// \brief Hash a request target
+///
+/// \param target Request target
+/// \param length Length of \a target
+///
+/// \return Hash of \a target, never 0.
+///
+uint32_t
+AccessLog_HashPath( const char *target, size_t length );
+
+///
+/// \brief Add a record
+///
+/// Add a record to the buffer, writing the buffer out if it's full. Only called by the data thread.
+///
+/// \param record Record to add
+///
+void
+AccessLog_Add( const AccessRecord *record );
+
+///
+/// \brief Write buffered records
+///
+/// Write the buffer out if its records have waited long enough. Only called by the data thread.
+///
+/// \param force Write whatever is buffered right away
+///
+void
+AccessLog_Flush( bool force );
+
+///
+/// \brief Time of the next write
+///
+/// Only called by the data thread, to wake up in time for \a AccessLog_Flush().
+///
+/// \return Monotonic milliseconds at which buffered records are due, UINT64_MAX if there are none.
+///
+uint64_t
+AccessLog_FlushDeadline( void );
+
+///
+/// \brief Close the access log
+///
+/// Write what's left in the buffer and close the file. No thread may add records anymore.
+///
+void
+AccessLog_Close( void );
+
+#endif // !BH2_SERVER_ACCESS_LOG_H
@@ -0,0 +1,125 @@
+#include "capture.h"
+
+#include "clock.h"
+#include "shared.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+bool capture_enabled;
+
+static
+int capture_fd = -1;
+
+static
+uint64_t capture_max_size;
+
+// Bytes written to the file, header included.
+static
+uint64_t capture_size;
+
+// Events waiting to be written.
+static
+char capture_buffer[BH2_CAPTURE_BUFFER_SIZE];
+static
+size_t capture_buffer_len;
+
+// When the buffer was last written, in monotonic milliseconds.
+static
+uint64_t capture_last_flush;
+
+// If the size limit has been reached, nothing more is recorded.
+static
+bool capture_full;
+
+bool
+Capture_Open( const char *path, uint64_t max_size )
+{
+    capture_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (capture_fd == -1)
+        return false;
+
+    CaptureHeader header = { .version = BH2_CAPTURE_VERSION };
+    memcpy(header.magic, BH2_CAPTURE_MAGIC, sizeof(header.magic));
+    if (!WriteAll(capture_fd, &header, sizeof(header)))
+    {
+        int error = errno;
+        close(capture_fd);
+        capture_fd = -1;
+        errno = error;
+        return false;
+    }
+
+    capture_size = sizeof(header);
+    capture_max_size = max_size;
+    capture_buffer_len = 0;
+    capture_last_flush = Clock_MonotonicMs();
+    capture_full = false;
+    capture_enabled = true;
+    return true;
+}
+
+void
+Capture_Record( uint32_t connection, CaptureEventType type, uint64_t time_us, const char *bytes, size_t length )
+{
+    size_t event_size = sizeof(CaptureEvent) + length;
+    if (capture_full || capture_fd == -1)
+        return;
+    if (capture_size + capture_buffer_len + event_size > capture_max_size)
+    {
+        // A connection cut short is still worth replaying, a torn event is not.
+        capture_full = true;
+        Capture_Flush(true);
+        return;
+    }
+
+    if (capture_buffer_len + event_size > sizeof(capture_buffer))
+        Capture_Flush(true);
+
+    CaptureEvent event = { .time_us = time_us, .connection = connection, .type = (uint16_t)type, .length = (uint32_t)length };
+    if (event_size > sizeof(capture_buffer))
+    {
+        // Too big to gather, the buffer is empty by now so order is kept.
+        if (WriteAll(capture_fd, &event, sizeof(event)) && WriteAll(capture_fd, bytes, length))
+            capture_size += event_size;
+        return;
+    }
+
+    memcpy(capture_buffer + capture_buffer_len, &event, sizeof(event));
+    if (length)
+        memcpy(capture_buffer + capture_buffer_len + sizeof(event), bytes, length);
+    capture_buffer_len += event_size;
+}
+
+void
+Capture_Flush( bool force )
+{
+    uint64_t now = Clock_MonotonicMs();
+    if (!capture_buffer_len || (!force && now - capture_last_flush < BH2_CAPTURE_FLUSH_MS))
+        return;
+    capture_last_flush = now;
+
+    // Events that can't be written are lost, capturing must never hold the server up.
+    if (capture_fd != -1 && WriteAll(capture_fd, capture_buffer, capture_buffer_len))
+        capture_size += capture_buffer_len;
+    capture_buffer_len = 0;
+}
+
+uint64_t
+Capture_FlushDeadline( void )
+{
+    return capture_buffer_len ? capture_last_flush + BH2_CAPTURE_FLUSH_MS : UINT64_MAX;
+}
+
+void
+Capture_Close( void )
+{
+    if (!capture_enabled)
+        return;
+
+    Capture_Flush(true);
+    if (capture_fd != -1)
+        close(capture_fd);
+    capture_fd = -1;
+    capture_enabled = false;
+}
@@ -0,0 +1,120 @@
+#ifndef BH2_SERVER_CAPTURE_H
+#define BH2_SERVER_CAPTURE_H
+
+#include <pch.h>
+
+/*
+
+    Capture of the raw bytes clients send, for replaying them with bh2-replay.
+
+    A file starts with a CaptureHeader, followed by CaptureEvents in the byte order of the
+    host that wrote them. A CAPTURE_DATA event is followed by its bytes. Times are monotonic
+    microseconds, only their differences mean anything. Events of different connections may
+    be slightly out of order, the ones of a connection never are.
+
+    Capturing stops for good once the file reaches its size limit, connections still open
+    by then have no CAPTURE_CLOSE.
+
+*/
+
+#define BH2_CAPTURE_MAGIC "BH2C"
+#define BH2_CAPTURE_VERSION 1
+
+// Bytes gathered before they are written.
+#define BH2_CAPTURE_BUFFER_SIZE (256 * 1024)
+
+// Longest time events wait in the buffer.
+#define BH2_CAPTURE_FLUSH_MS 1000
+
+// Size of a capture unless told otherwise.
+#define BH2_CAPTURE_DEFAULT_MAX_SIZE (256ULL * 1024ULL * 1024ULL)
+
+typedef enum CaptureEventType
+{
+    // Connection accepted.
+    CAPTURE_OPEN = 1,
+    // Bytes received, as many as length says follow the event.
+    CAPTURE_DATA,
+    // Connection closed, by either side.
+    CAPTURE_CLOSE
+} CaptureEventType;
+
+typedef struct CaptureHeader
+{
+    char magic[4];
+    uint32_t version;
+} CaptureHeader;
+
+typedef struct CaptureEvent
+{
+    uint64_t time_us;
+    // Number of the connection, unique within a capture.
+    uint32_t connection;
+    // CaptureEventType
+    uint16_t type;
+    uint16_t reserved;
+    // Bytes following the event.
+    uint32_t length;
+    uint32_t reserved2;
+} CaptureEvent;
+
+static_assert(sizeof(CaptureEvent) == 24, "Capture events are 24 bytes on every platform");
+
+// If capturing is on. Set once by Capture_Open() before any thread is created.
+extern
+bool capture_enabled;
+
+///
+/// \brief Start capturing
+///
+/// \param path File to write, replaced if it exists
+/// \param max_size Size the file may grow to
+///
+/// \return true on success.
+///
+bool
+Capture_Open( const char *path, uint64_t max_size );
+
+///
+/// \brief Record an event
+///
+/// Only called by the data thread.
+///
+/// \param connection Number of the connection
+/// \param type Type of the event
+/// \param time_us Monotonic time of the event
+/// \param bytes Bytes received for CAPTURE_DATA, NULL otherwise
+/// \param length Number of \a bytes
+///
+void
+Capture_Record( uint32_t connection, CaptureEventType type, uint64_t time_us, const char *bytes, size_t length );
+
+///
+/// \brief Write buffered events
+///
+/// Write the buffer out if its events have waited long enough. Only called by the data thread.
+///
+/// \param force Write whatever is buffered right away
+///
+void
+Capture_Flush( bool force );
+
+///
+/// \brief Time of the next write
+///
+/// Only called by the data thread, to wake up in time for \a Capture_Flush().
+///
+/// \return Monotonic milliseconds at which buffered events are due, UINT64_MAX if there are none.
+///
+uint64_t
+Capture_FlushDeadline( void );
+
+///
+/// \brief Stop capturing
+///
+/// Write what's left in the buffer and close the file. No thread may record anymore.
+///
+void
+Capture_Close( void );
+
+#endif // !BH2_SERVER_CAPTURE_H
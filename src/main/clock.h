@@ -0,0 +1,35 @@
+#ifndef BH2_SERVER_CLOCK_H
+#define BH2_SERVER_CLOCK_H
+
+#include <pch.h>
+
+///
+/// \brief Get monotonic time
+///
+/// Get the time of a coarse monotonic clock, good to a few milliseconds but cheap to read.
+///
+/// \return Milliseconds since an unspecified point
+///
+uint64_t
+Clock_MonotonicMs( void );
+
+///
+/// \brief Get precise monotonic time
+///
+/// Get the time of the monotonic clock. Read through the vDSO, so still no system call,
+/// but a little dearer than \a Clock_MonotonicMs(). Used for timing the event loop.
+///
+/// \return Microseconds since an unspecified point
+///
+uint64_t
+Clock_MonotonicUs( void );
+
+///
+/// \brief Get wall clock time
+///
+/// \return Microseconds since the epoch
+///
+uint64_t
+Clock_RealtimeUs( void );
+
+#endif // !BH2_SERVER_CLOCK_H
@@ -0,0 +1,148 @@
+#include "events.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int events_fd = -1;
+
+// Path of the control socket, and the file bound there, so a newer run's file is not removed.
+static
+struct sockaddr_un events_addr;
+static
+dev_t events_dev;
+static
+ino_t events_ino;
+
+// Number of the next event.
+static
+uint64_t next_event_id = 1;
+
+// Event new subscribers get first.
+static
+EventBuffer *last_event;
+
+bool
+Events_Open( const char *path )
+{
+    size_t path_len = strlen(path);
+    if (!path_len || path_len >= sizeof(events_addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    events_addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    memcpy(events_addr.sun_path, path, path_len);
+
+    events_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (events_fd == -1)
+        return false;
+
+    // Like listeners, only a socket file left by another run is replaced.
+    struct stat path_stat;
+    if (stat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode))
+        unlink(path);
+    if (bind(events_fd, (const struct sockaddr *)&events_addr, sizeof(events_addr)) == -1 || stat(path, &path_stat) == -1)
+    {
+        int error = errno;
+        close(events_fd);
+        events_fd = -1;
+        errno = error;
+        return false;
+    }
+    events_dev = path_stat.st_dev;
+    events_ino = path_stat.st_ino;
+    return true;
+}
+
+EventBuffer *
+Events_Receive( void )
+{
+    char data[BH2_EVENTS_MAX_DATA];
+    ssize_t received = recv(events_fd, data, sizeof(data), MSG_TRUNC);
+    if (received < 0)
+        return NULL;
+    size_t length = (size_t)received < sizeof(data) ? (size_t)received : sizeof(data);
+
+    // Lines end with CRLF, LF or a lone CR, as they do in the stream, where a CR left in would end a line too.
+    // Each end becomes a line feed.
+    size_t kept = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] != '\r')
+            data[kept++] = data[i];
+        else if (i + 1 == length || data[i + 1] != '\n')
+            data[kept++] = '\n';
+    }
+    length = kept;
+
+    // A trailing line feed ends the last line, it does not start an empty one.
+    if (length && data[length - 1] == '\n')
+        length--;
+    size_t lines = 1;
+    for (size_t i = 0; i < length; i++)
+        lines += data[i] == '\n';
+
+    char id_line[32];
+    size_t id_size = (size_t)snprintf(id_line, sizeof(id_line), "id: %" PRIu64 "\n", next_event_id);
+    // "data: " and a line feed per line, and the empty line ending the event.
+    size_t size = id_size + length + lines * 7 + 1;
+    EventBuffer *event = malloc(sizeof(EventBuffer) + size);
+    if (!event)
+        return NULL;
+    event->refs = 1;
+    event->id = next_event_id++;
+    event->size = size;
+
+    char *out = event->bytes;
+    memcpy(out, id_line, id_size);
+    out += id_size;
+    const char *end = data + length;
+    for (const char *line = data, *lf = NULL; line; line = lf ? lf + 1 : NULL)
+    {
+        lf = memchr(line, '\n', end - line);
+        size_t line_len = (lf ? lf : end) - line;
+        memcpy(out, "data: ", 6);
+        memcpy(out + 6, line, line_len);
+        out[6 + line_len] = '\n';
+        out += 7 + line_len;
+    }
+    *out++ = '\n';
+    event->size = out - event->bytes;
+
+    if (last_event)
+        Events_Release(last_event);
+    last_event = event;
+    event->refs++;
+    return event;
+}
+
+EventBuffer *
+Events_Last( void )
+{
+    return last_event;
+}
+
+void
+Events_Release( EventBuffer *event )
+{
+    if (!--event->refs)
+        free(event);
+}
+
+void
+Events_Close( void )
+{
+    if (events_fd == -1)
+        return;
+    close(events_fd);
+    events_fd = -1;
+
+    struct stat path_stat;
+    if (stat(events_addr.sun_path, &path_stat) == 0 && path_stat.st_dev == events_dev && path_stat.st_ino == events_ino)
+        unlink(events_addr.sun_path);
+    if (last_event)
+        Events_Release(last_event);
+    last_event = NULL;
+}
@@ -0,0 +1,91 @@
+#ifndef BH2_SERVER_EVENTS_H
+#define BH2_SERVER_EVENTS_H
+
+#include <pch.h>
+
+/*
+
+    Server-sent events broadcast to clients holding GET BH2_EVENTS_PATH open.
+
+    Every datagram sent to the control socket is one event. Its lines, ended by CRLF, LF or CR, become the
+    data lines of the event, which is numbered in the order events are received:
+
+        id: 7
+        data: first line
+        data: second line
+
+    An event is encoded once, and every subscriber refers to the same buffer until it has written it.
+    New subscribers get the last event first, unless their Last-Event-ID says they have seen it.
+
+    Only the data thread receives events and touches the buffers.
+
+*/
+
+// Largest datagram taken as an event, the rest of longer ones is cut.
+#define BH2_EVENTS_MAX_DATA 4096
+
+// Unwritten event bytes a subscriber may fall behind by unless told otherwise. It's dropped past that.
+#define BH2_EVENTS_DEFAULT_BACKLOG (64 * 1024)
+
+// An encoded event shared by its subscribers.
+typedef struct EventBuffer
+{
+    // Subscribers and others holding it, it's freed when the last one releases it.
+    size_t refs;
+    uint64_t id;
+    size_t size;
+    char bytes[];
+} EventBuffer;
+
+// Control socket events are received from, -1 if events are off.
+extern
+int events_fd;
+
+///
+/// \brief Open the control socket
+///
+/// Bind a unix datagram socket at path. A socket file left there by another run is replaced.
+///
+/// \param path Path of the socket file
+///
+/// \return false with errno set if it could not be opened.
+///
+bool
+Events_Open( const char *path );
+
+///
+/// \brief Receive an event
+///
+/// Take the next datagram off the control socket and encode it.<BR />
+/// The caller holds a reference to the event, and becomes the last event's holder too.
+///
+/// \return The event, NULL if there's none waiting.
+///
+EventBuffer *
+Events_Receive( void );
+
+///
+/// \brief Get the last event
+///
+/// \return The last event received, NULL if there's none. No reference is taken.
+///
+EventBuffer *
+Events_Last( void );
+
+///
+/// \brief Release an event
+///
+/// \param event Event to release a reference to, freed with the last one
+///
+void
+Events_Release( EventBuffer *event );
+
+///
+/// \brief Close the control socket
+///
+/// Close the socket, and remove its file unless another run has replaced it.
+///
+void
+Events_Close( void );
+
+#endif // !BH2_SERVER_EVENTS_H
@@ -0,0 +1,325 @@
+#include "options.h"
+
+#include "access_log.h"
+#include "capture.h"
+#include "events.h"
+#include "shared.h"
+#include "trace.h"
+
+#include <getopt.h>
+
+Options options;
+
+static
+void
+PrintUsage( const char *program )
+{
+    fprintf(stderr,
+            "Usage: %s [options] <html file>\n"
+            "\n"
+            "Options:\n"
+            "  -l, --listen <spec>          Accept clients on this socket, may be given up to 16 times:\n"
+            "                                 tcp:<ipv4>:<port>, tcp6:[<ipv6>]:<port>, unix:<path> or unix:@<abstract name>,\n"
+            "                                 and tls:<ipv4>:<port> or tls6:[<ipv6>]:<port> for HTTPS.\n"
+            "                               tcp6:[::]:80 by default, which takes IPv4 clients too unless a tcp: listener is given.\n"
+            "  -u, --upgrade-socket <path>  Take the listening sockets over from the instance listening on\n"
+            "                               this unix socket, if any, then listen on it for the next upgrade.\n"
+            "  --tls-cert <file>            PEM certificate chain of the HTTPS listeners.\n"
+            "  --tls-key <file>             PEM private key of the certificate. The certificate file by default.\n"
+            "  --h2c                        Also speak cleartext HTTP/2, to clients starting with its preface or\n"
+            "                               upgrading with \"Upgrade: h2c\". Not with -t.\n"
+            "  -t, --template               Serve the html file as a template, with {{date}}, {{time}}, {{request_id}}\n"
+            "                               and {{instance}} filled in as it's written, and a Date header.\n"
+            "  --instance <name>            Name filled into {{instance}}. The host name by default.\n"
+            "  --max-connections <n>        Connections open at once. Further ones get a short 503.\n"
+            "  --max-connections-per-ip <n> Connections open at once from one address.\n"
+            "  --connection-rate <r[:b]>    New connections per second from one address, with a burst of b.\n"
+            "  --request-rate <r[:b]>       Requests per second from one address, with a burst of b.\n"
+            "                               Further requests get 429. Limits are off unless given.\n"
+            "  --overload-connections <n>   Clients connected at which the server is overloaded. Off by default.\n"
+            "  --overload-pending <bytes>   Unwritten response bytes at which the server is overloaded. 64 MiB by default.\n"
+            "  --overload-lag <ms>          Busy time of a data thread cycle at which the server is overloaded. 200 by default.\n"
+            "                               0 turns a watermark off.\n"
+            "  --overload-action <action>   \"pause\" to stop accepting or \"shed\" to answer new clients with 503\n"
+            "                               while overloaded. \"shed\" by default.\n"
+            "  --access-log <file>          Append a binary record of every answered request to this file.\n"
+            "                               bh2-logdump reads it.\n"
+            "  --access-log-size <bytes>    Size at which the access log is moved to <file>.1 and started over. 64 MiB by default.\n"
+            "  --capture <file>             Record every byte clients send, with its timing, for bh2-replay.\n"
+            "  --capture-size <bytes>       Size at which capturing stops. 256 MiB by default.\n"
+            "  --events <path>              Stream every datagram sent to this unix socket as an event to the clients\n"
+            "                               holding GET /__bh2/events open.\n"
+            "  --events-backlog <bytes>     Unwritten event bytes a client may fall behind by before it's dropped. 64 KiB by default.\n"
+            "  --trace <file>               Record spans of both threads, and write them to this file as Chrome trace JSON\n"
+            "                               on SIGUSR2 and at exit.\n"
+            "  --trace-events <n>           Spans kept per thread while tracing, older ones are overwritten. 65536 by default.\n"
+            "  --stats-shm <name>           Publish statistics in this POSIX shared memory object, \"/<name>\", for bh2-top.\n"
+            "  --low-memory                 Use less memory per connection: small socket buffers, no spare receive buffers,\n"
+            "                               and client tables shrunk after load spikes. GET /__bh2/memory reports the usage.\n"
+            "  --wait-spin <us>             Keep polling without blocking for up to this long after traffic, which costs CPU\n"
+            "                               but saves the wakeup latency. Adapts to how soon traffic comes back. 0 by default.\n"
+            "  -h, --help                   Show this message.\n",
+            program);
+}
+
+// Option values without a short option.
+enum
+{
+    OPTION_MAX_CONNECTIONS = 256,
+    OPTION_INSTANCE,
+    OPTION_MAX_CONNECTIONS_PER_IP,
+    OPTION_CONNECTION_RATE,
+    OPTION_REQUEST_RATE,
+    OPTION_OVERLOAD_CONNECTIONS,
+    OPTION_OVERLOAD_PENDING,
+    OPTION_OVERLOAD_LAG,
+    OPTION_OVERLOAD_ACTION,
+    OPTION_ACCESS_LOG,
+    OPTION_ACCESS_LOG_SIZE,
+    OPTION_CAPTURE,
+    OPTION_CAPTURE_SIZE,
+    OPTION_EVENTS,
+    OPTION_EVENTS_BACKLOG,
+    OPTION_TRACE,
+    OPTION_TRACE_EVENTS,
+    OPTION_LOW_MEMORY,
+    OPTION_WAIT_SPIN,
+    OPTION_TLS_CERT,
+    OPTION_TLS_KEY,
+    OPTION_H2C,
+    OPTION_STATS_SHM
+};
+
+// Parse a non-negative number that fits in max.
+static
+bool
+ParseCount( const char *text, uint64_t max, uint64_t *value )
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, 10);
+    if (errno || end == text || *end || text[0] == '-' || parsed > max)
+        return false;
+    *value = parsed;
+    return true;
+}
+
+// Parse "rate" or "rate:burst".
+static
+bool
+ParseRate( const char *text, uint32_t *rate, uint32_t *burst )
+{
+    char rate_text[32] = { 0 };
+    const char *colon = strchr(text, ':');
+    size_t rate_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (rate_len >= sizeof(rate_text))
+        return false;
+    memcpy(rate_text, text, rate_len);
+
+    uint64_t parsed_rate = 0, parsed_burst = 0;
+    if (!ParseCount(rate_text, UINT32_MAX / 1000, &parsed_rate) || (colon && !ParseCount(colon + 1, UINT32_MAX / 1000, &parsed_burst)))
+        return false;
+    *rate = (uint32_t)parsed_rate;
+    *burst = (uint32_t)parsed_burst;
+    return true;
+}
+
+bool
+Options_Parse( int argc, char *argv[] )
+{
+    static const struct option long_options[] =
+    {
+        { "listen", required_argument, NULL, 'l' },
+        { "upgrade-socket", required_argument, NULL, 'u' },
+        { "tls-cert", required_argument, NULL, OPTION_TLS_CERT },
+        { "tls-key", required_argument, NULL, OPTION_TLS_KEY },
+        { "h2c", no_argument, NULL, OPTION_H2C },
+        { "template", no_argument, NULL, 't' },
+        { "instance", required_argument, NULL, OPTION_INSTANCE },
+        { "max-connections", required_argument, NULL, OPTION_MAX_CONNECTIONS },
+        { "max-connections-per-ip", required_argument, NULL, OPTION_MAX_CONNECTIONS_PER_IP },
+        { "connection-rate", required_argument, NULL, OPTION_CONNECTION_RATE },
+        { "request-rate", required_argument, NULL, OPTION_REQUEST_RATE },
+        { "overload-connections", required_argument, NULL, OPTION_OVERLOAD_CONNECTIONS },
+        { "overload-pending", required_argument, NULL, OPTION_OVERLOAD_PENDING },
+        { "overload-lag", required_argument, NULL, OPTION_OVERLOAD_LAG },
+        { "overload-action", required_argument, NULL, OPTION_OVERLOAD_ACTION },
+        { "access-log", required_argument, NULL, OPTION_ACCESS_LOG },
+        { "access-log-size", required_argument, NULL, OPTION_ACCESS_LOG_SIZE },
+        { "capture", required_argument, NULL, OPTION_CAPTURE },
+        { "capture-size", required_argument, NULL, OPTION_CAPTURE_SIZE },
+        { "events", required_argument, NULL, OPTION_EVENTS },
+        { "events-backlog", required_argument, NULL, OPTION_EVENTS_BACKLOG },
+        { "trace", required_argument, NULL, OPTION_TRACE },
+        { "trace-events", required_argument, NULL, OPTION_TRACE_EVENTS },
+        { "stats-shm", required_argument, NULL, OPTION_STATS_SHM },
+        { "low-memory", no_argument, NULL, OPTION_LOW_MEMORY },
+        { "wait-spin", required_argument, NULL, OPTION_WAIT_SPIN },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    options = (Options)
+    {
+        .access_log_size = BH2_ACCESS_LOG_DEFAULT_ROTATE_SIZE,
+        .capture_size = BH2_CAPTURE_DEFAULT_MAX_SIZE,
+        .events_backlog = BH2_EVENTS_DEFAULT_BACKLOG,
+        .trace_events = BH2_TRACE_DEFAULT_EVENTS,
+        .overload =
+        {
+            .pending_bytes = 64ULL * 1024ULL * 1024ULL,
+            .loop_lag_ms = 200,
+            .action = OVERLOAD_SHED
+        }
+    };
+
+    int opt = 0;
+    uint64_t count = 0;
+    bool valid = true;
+    struct sockaddr_storage listen_addr;
+    socklen_t listen_addr_len = 0;
+    bool listen_tls = false;
+    while ((opt = getopt_long(argc, argv, "l:u:th", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                valid = options.listen_count < BH2_MAX_LISTENERS && Listener_ParseSpec(optarg, &listen_addr, &listen_addr_len, &listen_tls);
+                if (valid)
+                    options.listen[options.listen_count++] = optarg;
+                options.tls |= listen_tls;
+                break;
+            case 'u':
+                options.upgrade_socket = optarg;
+                break;
+            case OPTION_TLS_CERT:
+                options.tls_cert_path = optarg;
+                break;
+            case OPTION_TLS_KEY:
+                options.tls_key_path = optarg;
+                break;
+            case OPTION_H2C:
+                options.h2c = true;
+                break;
+            case 't':
+                options.templated = true;
+                break;
+            case OPTION_INSTANCE:
+                options.instance_name = optarg;
+                break;
+            case OPTION_MAX_CONNECTIONS:
+                valid = ParseCount(optarg, SIZE_MAX, &count);
+                options.rate_limit.max_connections = count;
+                break;
+            case OPTION_MAX_CONNECTIONS_PER_IP:
+                valid = ParseCount(optarg, UINT32_MAX, &count);
+                options.rate_limit.max_connections_per_addr = count;
+                break;
+            case OPTION_CONNECTION_RATE:
+                valid = ParseRate(optarg, &options.rate_limit.connection_rate, &options.rate_limit.connection_burst);
+                break;
+            case OPTION_REQUEST_RATE:
+                valid = ParseRate(optarg, &options.rate_limit.request_rate, &options.rate_limit.request_burst);
+                break;
+            case OPTION_OVERLOAD_CONNECTIONS:
+                valid = ParseCount(optarg, SIZE_MAX, &count);
+                options.overload.connections = count;
+                break;
+            case OPTION_OVERLOAD_PENDING:
+                valid = ParseCount(optarg, SIZE_MAX, &count);
+                options.overload.pending_bytes = count;
+                break;
+            case OPTION_OVERLOAD_LAG:
+                valid = ParseCount(optarg, UINT64_MAX, &count);
+                options.overload.loop_lag_ms = count;
+                break;
+            case OPTION_OVERLOAD_ACTION:
+                valid = !strcmp(optarg, "pause") || !strcmp(optarg, "shed");
+                options.overload.action = !strcmp(optarg, "pause") ? OVERLOAD_PAUSE_ACCEPT : OVERLOAD_SHED;
+                break;
+            case OPTION_ACCESS_LOG:
+                options.access_log_path = optarg;
+                break;
+            case OPTION_ACCESS_LOG_SIZE:
+                valid = ParseCount(optarg, UINT64_MAX, &count) && count;
+                options.access_log_size = count;
+                break;
+            case OPTION_CAPTURE:
+                options.capture_path = optarg;
+                break;
+            case OPTION_CAPTURE_SIZE:
+                valid = ParseCount(optarg, UINT64_MAX, &count) && count;
+                options.capture_size = count;
+                break;
+            case OPTION_EVENTS:
+                options.events_path = optarg;
+                break;
+            case OPTION_EVENTS_BACKLOG:
+                valid = ParseCount(optarg, SIZE_MAX, &count) && count;
+                options.events_backlog = count;
+                break;
+            case OPTION_TRACE:
+                options.trace_path = optarg;
+                break;
+            case OPTION_TRACE_EVENTS:
+                valid = ParseCount(optarg, SIZE_MAX / 64, &count) && count;
+                options.trace_events = count;
+                break;
+            case OPTION_STATS_SHM:
+                // One leading slash and no other, as shm_open() wants.
+                valid = optarg[0] == '/' && optarg[1] && !strchr(optarg + 1, '/');
+                options.stats_shm_name = optarg;
+                break;
+            case OPTION_LOW_MEMORY:
+                options.low_memory = true;
+                break;
+            case OPTION_WAIT_SPIN:
+                valid = ParseCount(optarg, BH2_WAIT_SPIN_MAX_US, &count);
+                options.wait_spin_us = count;
+                break;
+            case 'h':
+            default:
+                PrintUsage(argv[0]);
+                return false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Invalid option value: %s\n", optarg);
+            return false;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Specify html file path.\n");
+        PrintUsage(argv[0]);
+        return false;
+    }
+    options.html_path = argv[optind];
+
+    // HTTP/2 responses are encoded once, templates change with every one.
+    if (options.h2c && options.templated)
+    {
+        fprintf(stderr, "--h2c does not serve templates.\n");
+        return false;
+    }
+
+#ifdef BH2_TLS
+    if (options.tls && !options.tls_cert_path)
+    {
+        fprintf(stderr, "HTTPS listeners need --tls-cert.\n");
+        return false;
+    }
+    if (!options.tls_key_path)
+        options.tls_key_path = options.tls_cert_path;
+#else
+    if (options.tls)
+    {
+        fprintf(stderr, "HTTPS listeners need a build with BH2_TLS.\n");
+        return false;
+    }
+#endif
+
+    return true;
+}
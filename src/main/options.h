@@ -0,0 +1,71 @@
+#ifndef BH2_SERVER_OPTIONS_H
+#define BH2_SERVER_OPTIONS_H
+
+#include <pch.h>
+
+#include "overload.h"
+#include "../communication/listener.h"
+#include "../communication/rate_limit.h"
+
+// Command line options.
+typedef struct Options
+{
+    // Path of the html file to serve.
+    const char *html_path;
+    // If the html file is a template, see template.h, and the name its {{instance}} is filled with.
+    bool templated;
+    const char *instance_name;
+    // Unix socket for handing the listening sockets over to a newer instance, NULL if unused.
+    const char *upgrade_socket;
+    // Listener specs given by --listen, see listener.h. tcp6:[::]:80 if none is given.
+    const char *listen[BH2_MAX_LISTENERS];
+    size_t listen_count;
+    // If any of them is HTTPS, and the certificate chain and private key it's served with.
+    bool tls;
+    const char *tls_cert_path;
+    const char *tls_key_path;
+    // If clients may speak cleartext HTTP/2, with the preface or by upgrading.
+    bool h2c;
+    // File that spans are dumped to, NULL if tracing is off.
+    const char *trace_path;
+    // Spans kept per thread while tracing.
+    size_t trace_events;
+    // Binary access log, NULL if off, and the size its files are rotated at.
+    const char *access_log_path;
+    uint64_t access_log_size;
+    // Capture of client bytes, NULL if off, and the size it stops at.
+    const char *capture_path;
+    uint64_t capture_size;
+    // Connection and request limits.
+    RateLimitConfig rate_limit;
+    // Admission control watermarks.
+    OverloadConfig overload;
+    // Control socket of server-sent events, NULL if off, and the backlog subscribers are dropped past.
+    const char *events_path;
+    size_t events_backlog;
+    // Shared memory object statistics are published in, NULL if off.
+    const char *stats_shm_name;
+    // Trade some speed for less memory per connection.
+    bool low_memory;
+    // Longest time the data thread busy polls before blocking while traffic is hot, 0 to always block.
+    uint64_t wait_spin_us;
+} Options;
+
+// Options of the running server. Main thread will not modify this after parsing them.
+extern
+Options options;
+
+///
+/// \brief Parse command line options
+///
+/// Parse the command line into \a options. Usage is printed on error.
+///
+/// \param argc Argument count of main()
+/// \param argv Arguments of main()
+///
+/// \return true if the program may go on.
+///
+bool
+Options_Parse( int argc, char *argv[] );
+
+#endif // !BH2_SERVER_OPTIONS_H
@@ -0,0 +1,68 @@
+#include "overload.h"
+
+#include "clock.h"
+#include "shared.h"
+#include "stats.h"
+
+#include <rxi/log.h>
+
+static
+OverloadConfig watermarks;
+
+static
+atomic_int state;
+
+// Reasons currently in effect. Only touched by data thread.
+static
+unsigned reasons;
+
+// Set or clear a reason bit with hysteresis.
+static
+void
+CheckWatermark( uint64_t value, uint64_t watermark, unsigned reason )
+{
+    if (!watermark)
+        return;
+    if (value >= watermark)
+        reasons |= reason;
+    else if (value < watermark - watermark / 4)
+        reasons &= ~reason;
+}
+
+void
+Overload_Init( const OverloadConfig *config )
+{
+    watermarks = *config;
+    reasons = 0;
+    atomic_store(&state, OVERLOAD_NONE);
+}
+
+OverloadState
+Overload_Update( size_t connections, size_t pending_bytes, uint64_t loop_lag_ms )
+{
+    CheckWatermark(connections, watermarks.connections, OVERLOAD_REASON_CONNECTIONS);
+    CheckWatermark(pending_bytes, watermarks.pending_bytes, OVERLOAD_REASON_PENDING_BYTES);
+    CheckWatermark(loop_lag_ms, watermarks.loop_lag_ms, OVERLOAD_REASON_LOOP_LAG);
+
+    OverloadState new_state = reasons ? watermarks.action : OVERLOAD_NONE;
+    OverloadState old_state = atomic_exchange_explicit(&state, new_state, memory_order_relaxed);
+    if (old_state != new_state)
+    {
+        bh2_log_info("[Data] Overload state %d -> %d, reasons %#x.", old_state, new_state, reasons);
+        atomic_fetch_add_explicit(&server_stats.overload_transitions, 1, memory_order_relaxed);
+        atomic_store_explicit(&server_stats.overload_since_ms, Clock_MonotonicMs(), memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&server_stats.overload_state, new_state, memory_order_relaxed);
+    atomic_store_explicit(&server_stats.overload_reasons, reasons, memory_order_relaxed);
+    atomic_store_explicit(&server_stats.pending_out_bytes, pending_bytes, memory_order_relaxed);
+    atomic_store_explicit(&server_stats.loop_lag_ms, loop_lag_ms, memory_order_relaxed);
+
+    return new_state;
+}
+
+OverloadState
+Overload_State( void )
+{
+    return atomic_load_explicit(&state, memory_order_relaxed);
+}
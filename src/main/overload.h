@@ -0,0 +1,74 @@
+#ifndef BH2_SERVER_OVERLOAD_H
+#define BH2_SERVER_OVERLOAD_H
+
+#include <pch.h>
+
+/*
+
+    Admission control. Data thread measures its load every cycle against the watermarks,
+    and main thread looks at the resulting state before taking a new client.
+    Existing clients are always served, only new ones are held back.
+
+    A watermark is crossed when the value reaches it, and cleared once the value falls
+    under three quarters of it, so the state does not flap around the line.
+
+*/
+
+typedef enum OverloadState
+{
+    OVERLOAD_NONE,
+    // Main thread stops accepting, new clients wait in the listen backlog.
+    OVERLOAD_PAUSE_ACCEPT,
+    // Main thread accepts and answers new clients with a short 503.
+    OVERLOAD_SHED
+} OverloadState;
+
+// Why the server is overloaded, as bits.
+enum
+{
+    OVERLOAD_REASON_CONNECTIONS = 1,
+    OVERLOAD_REASON_PENDING_BYTES = 2,
+    OVERLOAD_REASON_LOOP_LAG = 4
+};
+
+typedef struct OverloadConfig
+{
+    // Watermarks, 0 to ignore one.
+    size_t connections;
+    size_t pending_bytes;
+    uint64_t loop_lag_ms;
+    // What to do when a watermark is crossed.
+    OverloadState action;
+} OverloadConfig;
+
+///
+/// \brief Initialize admission control
+///
+/// \param config Watermarks and action
+///
+void
+Overload_Init( const OverloadConfig *config );
+
+///
+/// \brief Update the load
+///
+/// Compare the load of data thread with the watermarks and publish the state.
+///
+/// \param connections Clients connected
+/// \param pending_bytes Response bytes waiting to be written
+/// \param loop_lag_ms Time the last cycle spent outside of poll()
+///
+/// \return New state.
+///
+OverloadState
+Overload_Update( size_t connections, size_t pending_bytes, uint64_t loop_lag_ms );
+
+///
+/// \brief Get the state
+///
+/// \return State published by the last \a Overload_Update().
+///
+OverloadState
+Overload_State( void );
+
+#endif // !BH2_SERVER_OVERLOAD_H
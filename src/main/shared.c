@@ -1,20 +1,52 @@
 #include "shared.h"
 
+#include <unistd.h>
+
 thrd_t data_thread;
-Vector clients, client_pfds;
+ClientVector clients;
+PollfdVector client_pfds;
+int data_wake_fd;
 mtx_t clients_mtx;
 cnd_t clients_cnd;
 atomic_bool data_mtx_locked;
 atomic_bool new_client_incoming;
 atomic_bool data_thread_block;
+atomic_bool draining;
 atomic_bool should_exit;
+const uint64_t BH2_DRAIN_TIMEOUT_MS = 5000;
 
 const uint16_t BH2_SERVER_PORT = 80;
 
-const char HTTP_HEAD[] = "HTTP/1.0 503 Service Unavailable\r\n"
-                         "Content-Type: text/html; charset=UTF-8\r\n"
-                         "Connection: Keep-Alive\r\n"
-                         "Keep-Alive: timeout=15, max=1000\r\n"
-                         "Content-Length: 3833\r\n\r\n";
 char *html_content;
 size_t html_content_size;
+size_t html_head_size;
+const size_t BH2_MAX_TARGET_LENGTH = 2048;
+
+const size_t BH2_RECV_BUFFER_SIZE = 65536;
+const size_t BH2_RECV_POOL_MAX_BUFFERS = 4096;
+const size_t BH2_RECV_POOL_SPARE_BUFFERS = 16;
+
+const int BH2_LOW_MEMORY_SOCKET_BUFFER = 4096;
+const size_t BH2_LOW_MEMORY_MIN_CLIENTS = 64;
+
+const uint64_t BH2_WAIT_SPIN_MAX_US = 1000000;
+const int BH2_WAIT_OVERLOADED_MS = 100;
+
+bool
+WriteAll( int fd, const void *bytes, size_t length )
+{
+    const char *remaining = bytes;
+    while (length)
+    {
+        ssize_t written = write(fd, remaining, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        remaining += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
@@ -3,8 +3,12 @@
 
 #include <pch.h>
 
+#include "../communication/client.h"
+#include "../container/typed_vector.h"
 #include "../container/vector.h"
 
+#include <poll.h>
+
 // ----------------- Logging -------------------------
 
 #ifdef BH2_DEBUG
@@ -25,13 +29,26 @@
 
 // ----------------------- Concurrency -------------------------------
 
+VECTOR_DEFINE(PollfdVector, struct pollfd)
+
 // Child thread handles.
 extern
 thrd_t data_thread;
 
 // The clients waiting and their poll file descriptors.
+// The first BH2_DATA_PFDS_RESERVED poll file descriptors belong to the data thread itself,
+// data_wake_fd and then events_fd of events.h, so the client at index i polls with client_pfds[i + BH2_DATA_PFDS_RESERVED].
+extern
+ClientVector clients;
+extern
+PollfdVector client_pfds;
+
+#define BH2_DATA_PFDS_RESERVED 2
+
+// Eventfd polled by the data thread, in the first reserved slot of client_pfds.
+// Main thread writes to it to wake the data thread up for new clients or shutdown.
 extern
-Vector clients, client_pfds;
+int data_wake_fd;
 
 // Mutex for the vectors above. Usually data thread has it.
 // Main thread uses it to add new clients.
@@ -62,12 +79,25 @@ atomic_bool data_thread_block;
     Data thread will receive that message, clean up, set some variables to tell main thread that it has ended.
     Now I'll just use Ctrl+C to end it.
 
+    Signals are read by main thread through a signalfd. The first SIGINT or SIGTERM starts draining:
+    main thread stops accepting, data thread closes idle clients, answers the in-flight requests with
+    "Connection: close" and ends when no client is left or BH2_DRAIN_TIMEOUT_MS has passed.
+    A second one ends the program right away.
+
 */
 
-// Used by signal handlers to tell threads that program should end.
+// Set by main thread to tell the data thread to drain its clients and end.
+extern
+atomic_bool draining;
+
+// Tell threads that program should end now.
 extern
 atomic_bool should_exit;
 
+// Longest time draining may take.
+extern
+const uint64_t BH2_DRAIN_TIMEOUT_MS;
+
 // -------------------------------------------------------------------
 
 // ------------------- HTML contents -------------------------
@@ -76,12 +106,8 @@ atomic_bool should_exit;
 extern
 const uint16_t BH2_SERVER_PORT;
 
-// Http header code.
-// Hard-coded the length of html file...
-extern
-const char HTTP_HEAD[];
-
-// Content of the html. Main thread will not modify this after finish loading it.
+// Respond content of the html, header followed by the page.
+// Main thread will not modify this after finish loading it.
 extern
 char *html_content;
 
@@ -89,6 +115,74 @@ char *html_content;
 extern
 size_t html_content_size;
 
+// Size of the header at the start of html_content.
+extern
+size_t html_head_size;
+
+// Longest request target accepted, longer ones get 414.
+extern
+const size_t BH2_MAX_TARGET_LENGTH;
+
+// -----------------------------------------------------------
+
+// ------------------- Receiving -----------------------------
+
+// Size of every receive buffer, which is also the largest request we accept.
+extern
+const size_t BH2_RECV_BUFFER_SIZE;
+
+// Most receive buffers the data thread may hold at once.
+// Memory is only taken by clients with an incomplete request, so this bounds
+// the in-flight partial requests rather than the connections.
+extern
+const size_t BH2_RECV_POOL_MAX_BUFFERS;
+
+// Idle receive buffers kept around after a load spike.
+extern
+const size_t BH2_RECV_POOL_SPARE_BUFFERS;
+
+// -----------------------------------------------------------
+
+// ------------------- Low memory mode -----------------------
+
+// Socket buffer size asked for every client in low memory mode. The kernel doubles it and enforces a minimum.
+extern
+const int BH2_LOW_MEMORY_SOCKET_BUFFER;
+
+// Capacity the client vectors are not shrunk below in low memory mode.
+extern
+const size_t BH2_LOW_MEMORY_MIN_CLIENTS;
+
+// -----------------------------------------------------------
+
+// ------------------- Waiting -------------------------------
+
+// Largest busy polling budget --wait-spin may give the data thread.
+extern
+const uint64_t BH2_WAIT_SPIN_MAX_US;
+
+// Longest the data thread blocks while overloaded, so the state is looked at again even if nothing happens.
+extern
+const int BH2_WAIT_OVERLOADED_MS;
+
+// -----------------------------------------------------------
+
+// ------------------- Files ---------------------------------
+
+///
+/// \brief Write all the bytes
+///
+/// Go on after a short write or an interrupted one, for the files the server records into.
+///
+/// \param fd File to write to
+/// \param bytes Bytes to write
+/// \param length Size of bytes
+///
+/// \return false if writing failed, with errno set.
+///
+bool
+WriteAll( int fd, const void *bytes, size_t length );
+
 // -----------------------------------------------------------
 
 #endif // !BH2_SERVER_SHARED_H
@@ -0,0 +1,128 @@
+#include "stats.h"
+
+ServerStats server_stats;
+
+// A counter of ServerStats, by name.
+typedef struct StatsField
+{
+    const char *name;
+    size_t offset;
+} StatsField;
+
+#define BH2_STATS_FIELD(field) { #field, offsetof(ServerStats, field) }
+
+// Every counter but the histogram, which follows them.
+static
+const StatsField STATS_FIELDS[] =
+{
+    BH2_STATS_FIELD(recv_pool_buffers),
+    BH2_STATS_FIELD(recv_pool_in_use),
+    BH2_STATS_FIELD(recv_pool_peak),
+    BH2_STATS_FIELD(recv_pool_exhausted),
+    BH2_STATS_FIELD(requests_oversized),
+    BH2_STATS_FIELD(responses_sent),
+    BH2_STATS_FIELD(send_calls),
+    BH2_STATS_FIELD(send_blocked),
+    BH2_STATS_FIELD(rejected_connections_total),
+    BH2_STATS_FIELD(rejected_connections_per_addr),
+    BH2_STATS_FIELD(rejected_connection_rate),
+    BH2_STATS_FIELD(rejected_requests),
+    BH2_STATS_FIELD(rate_limit_table_full),
+    BH2_STATS_FIELD(overload_state),
+    BH2_STATS_FIELD(overload_reasons),
+    BH2_STATS_FIELD(overload_transitions),
+    BH2_STATS_FIELD(overload_since_ms),
+    BH2_STATS_FIELD(pending_out_bytes),
+    BH2_STATS_FIELD(loop_lag_ms),
+    BH2_STATS_FIELD(shed_connections),
+    BH2_STATS_FIELD(events_received),
+    BH2_STATS_FIELD(events_subscribers),
+    BH2_STATS_FIELD(events_delivered),
+    BH2_STATS_FIELD(events_dropped_subscribers),
+    BH2_STATS_FIELD(tls_handshakes),
+    BH2_STATS_FIELD(tls_resumed),
+    BH2_STATS_FIELD(tls_failed),
+    BH2_STATS_FIELD(http2_connections),
+    BH2_STATS_FIELD(http2_streams),
+    BH2_STATS_FIELD(http2_refused_streams),
+    BH2_STATS_FIELD(http2_failed),
+    BH2_STATS_FIELD(loop_cycles),
+    BH2_STATS_FIELD(loop_busy_us),
+    BH2_STATS_FIELD(loop_busy_max_us),
+    BH2_STATS_FIELD(poll_blocked_us),
+    BH2_STATS_FIELD(poll_wakeups),
+    BH2_STATS_FIELD(poll_ready_fds),
+    BH2_STATS_FIELD(poll_timeouts),
+    BH2_STATS_FIELD(wait_indefinite),
+    BH2_STATS_FIELD(wait_spin_polls),
+    BH2_STATS_FIELD(wait_spin_us),
+    BH2_STATS_FIELD(wait_spin_hits),
+    BH2_STATS_FIELD(wait_spin_misses),
+    BH2_STATS_FIELD(wait_spin_budget_us),
+    BH2_STATS_FIELD(recv_calls),
+    BH2_STATS_FIELD(requests_received),
+    BH2_STATS_FIELD(write_cycles),
+    BH2_STATS_FIELD(write_clients),
+    BH2_STATS_FIELD(write_limit_reached),
+    BH2_STATS_FIELD(poll_calls),
+    BH2_STATS_FIELD(close_calls),
+    BH2_STATS_FIELD(eventfd_reads),
+};
+
+#define BH2_STATS_FIELD_COUNT (sizeof(STATS_FIELDS) / sizeof(STATS_FIELDS[0]))
+
+void
+Stats_RecordLoopCycle( uint64_t busy_us )
+{
+    Stats_AddOwned(&server_stats.loop_cycles, 1);
+    Stats_AddOwned(&server_stats.loop_busy_us, busy_us);
+    if (busy_us > atomic_load_explicit(&server_stats.loop_busy_max_us, memory_order_relaxed))
+        atomic_store_explicit(&server_stats.loop_busy_max_us, busy_us, memory_order_relaxed);
+
+    // Number of significant bits picks the bucket.
+    size_t bucket = 0;
+    while (busy_us && bucket < BH2_STATS_LOOP_BUCKETS - 1)
+    {
+        busy_us >>= 1;
+        bucket++;
+    }
+    Stats_AddOwned(&server_stats.loop_busy_histogram[bucket], 1);
+}
+
+size_t
+Stats_Count( void )
+{
+    return BH2_STATS_FIELD_COUNT + BH2_STATS_LOOP_BUCKETS;
+}
+
+void
+Stats_Name( size_t index, char *name, size_t size )
+{
+    if (index < BH2_STATS_FIELD_COUNT)
+        snprintf(name, size, "%s", STATS_FIELDS[index].name);
+    else if (index - BH2_STATS_FIELD_COUNT < BH2_STATS_LOOP_BUCKETS - 1)
+        snprintf(name, size, "loop_busy_us_lt_%zu", (size_t)1 << (index - BH2_STATS_FIELD_COUNT));
+    else
+        snprintf(name, size, "loop_busy_us_ge_%zu", (size_t)1 << (BH2_STATS_LOOP_BUCKETS - 2));
+}
+
+size_t
+Stats_Value( size_t index )
+{
+    const atomic_size_t *counter = index < BH2_STATS_FIELD_COUNT ?
+        (const atomic_size_t *)((const char *)&server_stats + STATS_FIELDS[index].offset) :
+        &server_stats.loop_busy_histogram[index - BH2_STATS_FIELD_COUNT];
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void
+Stats_Print( FILE *stream )
+{
+    char name[BH2_STATS_NAME_SIZE];
+    for (size_t i = 0; i < Stats_Count(); i++)
+    {
+        Stats_Name(i, name, sizeof(name));
+        fprintf(stream, "%s %zu\n", name, Stats_Value(i));
+    }
+    fflush(stream);
+}
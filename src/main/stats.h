@@ -0,0 +1,178 @@
+#ifndef BH2_SERVER_STATS_H
+#define BH2_SERVER_STATS_H
+
+#include <pch.h>
+
+// Buckets of the loop cycle histogram. Bucket i counts cycles busy for less than 2^i microseconds,
+// the last one takes everything longer.
+#define BH2_STATS_LOOP_BUCKETS 20
+
+// Room for the name of a counter, terminator included.
+#define BH2_STATS_NAME_SIZE 32
+
+// Counters published by the threads for monitoring.
+// Threads update them with relaxed atomics, readers only get a loose snapshot.
+typedef struct ServerStats
+{
+    // Receive buffers currently allocated by the pool.
+    atomic_size_t recv_pool_buffers;
+    // Receive buffers attached to clients holding an incomplete request.
+    atomic_size_t recv_pool_in_use;
+    // Highest recv_pool_in_use reached.
+    atomic_size_t recv_pool_peak;
+    // Reads that found the pool exhausted.
+    atomic_size_t recv_pool_exhausted;
+    // Clients dropped because their request did not fit in a buffer.
+    atomic_size_t requests_oversized;
+    // Responses completely written.
+    atomic_size_t responses_sent;
+    // sendmsg() calls made for responses.
+    atomic_size_t send_calls;
+    // Flushes that stopped because the socket buffer was full.
+    atomic_size_t send_blocked;
+    // Connections refused by the limit over all addresses.
+    atomic_size_t rejected_connections_total;
+    // Connections refused by the limit of one address.
+    atomic_size_t rejected_connections_per_addr;
+    // Connections refused for connecting too fast.
+    atomic_size_t rejected_connection_rate;
+    // Requests answered with 429.
+    atomic_size_t rejected_requests;
+    // Addresses not tracked because the rate limit table was full.
+    atomic_size_t rate_limit_table_full;
+    // Admission control state and the reason bits behind it, see overload.h.
+    atomic_size_t overload_state;
+    atomic_size_t overload_reasons;
+    // Times the state changed, and when it last did in monotonic milliseconds.
+    atomic_size_t overload_transitions;
+    atomic_size_t overload_since_ms;
+    // Response bytes waiting to be written.
+    atomic_size_t pending_out_bytes;
+    // Time the last data thread cycle spent outside of poll().
+    atomic_size_t loop_lag_ms;
+    // New connections answered with 503 while shedding.
+    atomic_size_t shed_connections;
+    // Server-sent events received, clients subscribed to them, events written to subscribers,
+    // and subscribers dropped for falling behind.
+    atomic_size_t events_received;
+    atomic_size_t events_subscribers;
+    atomic_size_t events_delivered;
+    atomic_size_t events_dropped_subscribers;
+    // HTTPS handshakes done, how many of them resumed a session, and the ones failed or not offloaded.
+    atomic_size_t tls_handshakes;
+    atomic_size_t tls_resumed;
+    atomic_size_t tls_failed;
+    // HTTP/2 connections, streams answered and refused over the stream limit, and connections broken by protocol errors.
+    atomic_size_t http2_connections;
+    atomic_size_t http2_streams;
+    atomic_size_t http2_refused_streams;
+    atomic_size_t http2_failed;
+
+    // Event loop of the data thread, only written by it.
+    // Cycles run, each one is a poll() and the work on what it returned.
+    atomic_size_t loop_cycles;
+    // Time spent outside of poll() over all cycles, the longest cycle, and how cycles spread.
+    atomic_size_t loop_busy_us;
+    atomic_size_t loop_busy_max_us;
+    atomic_size_t loop_busy_histogram[BH2_STATS_LOOP_BUCKETS];
+    // Time spent blocked in poll().
+    atomic_size_t poll_blocked_us;
+    // poll() calls that returned ready fds, and the sum of those fds.
+    atomic_size_t poll_wakeups;
+    atomic_size_t poll_ready_fds;
+    // poll() calls that timed out.
+    atomic_size_t poll_timeouts;
+    // Waits that blocked without a timeout, only traffic or the main thread could end them.
+    atomic_size_t wait_indefinite;
+    // Busy polling before blocking: poll() calls without blocking and the time spent in them,
+    // then waits that found traffic that way and ones that went on to block.
+    atomic_size_t wait_spin_polls;
+    atomic_size_t wait_spin_us;
+    atomic_size_t wait_spin_hits;
+    atomic_size_t wait_spin_misses;
+    // Time the next wait may busy poll, adapted to how soon traffic came lately.
+    atomic_size_t wait_spin_budget_us;
+    // recv() calls made for requests, and the requests they brought.
+    atomic_size_t recv_calls;
+    atomic_size_t requests_received;
+    // Cycles that wrote to clients, clients written to, and cycles that left clients for the next one
+    // because of the limit of writes per cycle.
+    atomic_size_t write_cycles;
+    atomic_size_t write_clients;
+    atomic_size_t write_limit_reached;
+    // Other system calls of the loop.
+    atomic_size_t poll_calls;
+    atomic_size_t close_calls;
+    atomic_size_t eventfd_reads;
+} ServerStats;
+
+// Statistics of the running server.
+extern
+ServerStats server_stats;
+
+///
+/// \brief Add to a counter of one thread
+///
+/// Add to a counter that no other thread writes. Cheaper than \a atomic_fetch_add(), since no locked instruction is needed.
+///
+/// \param counter Counter to add to
+/// \param value Value to add
+///
+static inline
+void
+Stats_AddOwned( atomic_size_t *counter, size_t value )
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+///
+/// \brief Record a loop cycle
+///
+/// Account a data thread cycle to the loop counters. Only called by the data thread.
+///
+/// \param busy_us Time the cycle spent outside of poll()
+///
+void
+Stats_RecordLoopCycle( uint64_t busy_us );
+
+///
+/// \brief Get the number of counters
+///
+/// Counters are numbered from 0 in a fixed order, every field of \a ServerStats once and each histogram bucket.
+///
+/// \return Number of counters.
+///
+size_t
+Stats_Count( void );
+
+///
+/// \brief Get the name of a counter
+///
+/// \param index Counter, below \a Stats_Count()
+/// \param name Buffer to write the name to
+/// \param size Size of the buffer, BH2_STATS_NAME_SIZE holds any name
+///
+void
+Stats_Name( size_t index, char *name, size_t size );
+
+///
+/// \brief Get the value of a counter
+///
+/// \param index Counter, below \a Stats_Count()
+///
+/// \return Its value, loaded relaxed.
+///
+size_t
+Stats_Value( size_t index );
+
+///
+/// \brief Print statistics
+///
+/// Print a snapshot of \a server_stats in "name value" lines.
+///
+/// \param stream Stream to print to
+///
+void
+Stats_Print( FILE *stream );
+
+#endif // !BH2_SERVER_STATS_H
@@ -0,0 +1,130 @@
+#include "stats_segment.h"
+
+#include "clock.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool stats_segment_enabled;
+
+static
+StatsSegment *segment;
+
+// Name and inode of the segment, to tell if the name still refers to it at exit.
+static
+char segment_name[256];
+static
+ino_t segment_inode;
+
+// Counters of stats.h at the start of the values, the loop state after them.
+static
+size_t counter_count;
+
+// When the last snapshot was taken, in monotonic microseconds.
+static
+uint64_t last_publish_us;
+
+// Names of the loop state values, in the order of StatsLoopState.
+static
+const char *const LOOP_NAMES[] = { "data_connections", "data_scheduled_writes", "data_draining", "data_last_cycle_us" };
+
+#define BH2_STATS_LOOP_VALUES (sizeof(LOOP_NAMES) / sizeof(LOOP_NAMES[0]))
+
+bool
+StatsSegment_Open( const char *name )
+{
+    counter_count = Stats_Count();
+    if (counter_count + BH2_STATS_LOOP_VALUES > BH2_STATS_SEGMENT_VALUES || strlen(name) >= sizeof(segment_name))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    // A segment left by an older instance is its readers' to keep, the name gets a new one.
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+    struct stat segment_stat;
+    if (ftruncate(fd, sizeof(StatsSegment)) == -1 || fstat(fd, &segment_stat) == -1)
+    {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = error;
+        return false;
+    }
+    segment = mmap(NULL, sizeof(StatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        int error = errno;
+        segment = NULL;
+        shm_unlink(name);
+        errno = error;
+        return false;
+    }
+    snprintf(segment_name, sizeof(segment_name), "%s", name);
+    segment_inode = segment_stat.st_ino;
+
+    // The memory comes zeroed, only the header and the names are filled.
+    segment->version = BH2_STATS_SEGMENT_VERSION;
+    segment->size = sizeof(StatsSegment);
+    segment->count = (uint32_t)(counter_count + BH2_STATS_LOOP_VALUES);
+    segment->pid = (uint64_t)getpid();
+    segment->started_us = Clock_RealtimeUs();
+    for (size_t i = 0; i < counter_count; i++)
+        Stats_Name(i, segment->names[i], BH2_STATS_NAME_SIZE);
+    for (size_t i = 0; i < BH2_STATS_LOOP_VALUES; i++)
+        snprintf(segment->names[counter_count + i], BH2_STATS_NAME_SIZE, "%s", LOOP_NAMES[i]);
+    // Readers check the magic first, it's only there once the rest is.
+    atomic_thread_fence(memory_order_release);
+    memcpy(segment->magic, BH2_STATS_SEGMENT_MAGIC, sizeof(segment->magic));
+
+    stats_segment_enabled = true;
+    return true;
+}
+
+void
+StatsSegment_Publish( const StatsLoopState *loop, uint64_t now_us, bool force )
+{
+    if (!force && now_us - last_publish_us < BH2_STATS_SEGMENT_INTERVAL_US)
+        return;
+    last_publish_us = now_us;
+
+    // Seqlock write: odd while the values change, so readers retry.
+    uint64_t sequence = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+    atomic_store_explicit(&segment->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    segment->published_us = Clock_RealtimeUs();
+    for (size_t i = 0; i < counter_count; i++)
+        segment->values[i] = Stats_Value(i);
+    uint64_t *state = segment->values + counter_count;
+    state[0] = loop->connections;
+    state[1] = loop->scheduled_writes;
+    state[2] = loop->draining;
+    state[3] = loop->last_cycle_us;
+    atomic_store_explicit(&segment->sequence, sequence + 2, memory_order_release);
+}
+
+void
+StatsSegment_Close( void )
+{
+    if (!segment)
+        return;
+    munmap(segment, sizeof(StatsSegment));
+    segment = NULL;
+    stats_segment_enabled = false;
+
+    // An instance that took over has its own segment under the name by now.
+    int fd = shm_open(segment_name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return;
+    struct stat segment_stat;
+    bool own = !fstat(fd, &segment_stat) && segment_stat.st_ino == segment_inode;
+    close(fd);
+    if (own)
+        shm_unlink(segment_name);
+}
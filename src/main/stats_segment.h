@@ -0,0 +1,103 @@
+#ifndef BH2_SERVER_STATS_SEGMENT_H
+#define BH2_SERVER_STATS_SEGMENT_H
+
+#include <pch.h>
+
+#include "stats.h"
+
+/*
+
+    Statistics published in POSIX shared memory, for bh2-top and other readers that
+    should not cost the server a request or a system call.
+
+    The segment is a StatsSegment, in the byte order of the host. Its header and the
+    counter names are written once when it's created, magic last. The values are a
+    snapshot of every counter of stats.h, followed by the loop state of the data thread,
+    copied by the data thread at most every BH2_STATS_SEGMENT_INTERVAL_US under a seqlock:
+    sequence is odd while they are being written, and a reader's copy only counts if
+    sequence was the same even number before and after it.
+
+    The name belongs to the newest instance. One taking over from another replaces its
+    segment, readers of the old one see its published time stop.
+
+*/
+
+#define BH2_STATS_SEGMENT_MAGIC "BH2S"
+#define BH2_STATS_SEGMENT_VERSION 1
+
+// Values a segment has room for, counters added later keep the layout.
+#define BH2_STATS_SEGMENT_VALUES 256
+
+// Shortest time between two snapshots.
+#define BH2_STATS_SEGMENT_INTERVAL_US 10000
+
+typedef struct StatsSegment
+{
+    char magic[4];
+    uint32_t version;
+    // Size of the whole segment.
+    uint32_t size;
+    // Values in use, each named in names.
+    uint32_t count;
+    uint64_t pid;
+    // When the server started, in microseconds since the epoch.
+    uint64_t started_us;
+    char names[BH2_STATS_SEGMENT_VALUES][BH2_STATS_NAME_SIZE];
+
+    // Seqlock of what follows, odd while it changes.
+    _Atomic uint64_t sequence;
+    // When the snapshot was taken, in microseconds since the epoch.
+    uint64_t published_us;
+    uint64_t values[BH2_STATS_SEGMENT_VALUES];
+} StatsSegment;
+
+// What the data thread's loop is doing, published after the counters.
+typedef struct StatsLoopState
+{
+    // Clients held, and the ones scheduled for writing.
+    size_t connections;
+    size_t scheduled_writes;
+    // If the server is draining.
+    bool draining;
+    // Time the last cycle spent outside of poll().
+    uint64_t last_cycle_us;
+} StatsLoopState;
+
+// If the segment is published. Set once by StatsSegment_Open() before any thread is created.
+extern
+bool stats_segment_enabled;
+
+///
+/// \brief Create the segment
+///
+/// Replace any segment of that name with a new one, named and zeroed.
+///
+/// \param name Name of the shared memory object, "/name"
+///
+/// \return true on success.
+///
+bool
+StatsSegment_Open( const char *name );
+
+///
+/// \brief Publish a snapshot
+///
+/// Copy the counters and the loop state into the segment, unless the last snapshot is too recent.
+/// Only called by the data thread.
+///
+/// \param loop State of the loop
+/// \param now_us Monotonic time
+/// \param force Publish even if the last snapshot is recent
+///
+void
+StatsSegment_Publish( const StatsLoopState *loop, uint64_t now_us, bool force );
+
+///
+/// \brief Remove the segment
+///
+/// Unmap it, and remove its name unless a newer instance took it. No thread may publish anymore.
+///
+void
+StatsSegment_Close( void );
+
+#endif // !BH2_SERVER_STATS_SEGMENT_H
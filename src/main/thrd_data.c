@@ -1,40 +1,214 @@
 #include <pch.h>
 
+#include "access_log.h"
+#include "capture.h"
+#include "clock.h"
+#include "events.h"
+#include "options.h"
+#include "overload.h"
 #include "shared.h"
+#include "stats.h"
+#include "stats_segment.h"
+#include "trace.h"
 #include "../communication/client.h"
+#include "../communication/http2.h"
+#include "../communication/rate_limit.h"
+#include "../communication/request.h"
+#include "../communication/response.h"
+#include "../communication/tls.h"
+#include "../container/buffer_pool.h"
+#include "../container/deque.h"
 
 #include <rxi/log.h>
 
+#include <limits.h>
 #include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-// Vector of potential writing for clients. In Blackhole 1, it was a hash map.
-// It contains an index to the clients vector.
+#ifndef IOV_MAX
+    #define IOV_MAX 1024
+#endif
+
+// Clients written to per cycle at most, so a crowd of writers does not keep readers waiting.
+#define BH2_DATA_WRITES_PER_CYCLE 14
+
+// Queue of potential writing for clients. In Blackhole 1, it was a hash map.
+// It contains an index to the clients vector, each client appears at most once.
+// Served first in first out, so clients left over by the per cycle limit go first next cycle.
+static
+Deque await_writings;
+
+// Scatter list for writing pipelined responses, the same response buffer repeated.
+static
+struct iovec response_iov[IOV_MAX];
+
+// Room for the values of templated responses in one sendmsg(), far more than IOV_MAX of them fill.
+#define BH2_DATA_TEMPLATE_SCRATCH_SIZE 65536
+
+// Values filled into templated responses being written, and the values of each one by its order in response_iov.
+static
+char template_scratch[BH2_DATA_TEMPLATE_SCRATCH_SIZE];
 static
-Vector await_writings;
+TemplateValues response_values[IOV_MAX];
 
-// Buffer for receiving client contents
+// HTTP/2 responses completed by one write.
 static
-char recv_buffer[65536];
+Http2Written http2_written[BH2_HTTP2_MAX_STREAMS];
+
+// Number of the next response written from a template.
+static
+uint64_t next_request_id;
+
+// Buffers for receiving client contents.
+// A buffer is taken for every read, and only stays with the client if it ends with an incomplete request.
+static
+BufferPool recv_pool;
+
+// Used for reading when the pool is exhausted. Incomplete requests in it can not be kept.
+static
+char *recv_fallback;
 
 // Tell if the clients mutex is locked by this thread.
 // Used for cleaning up.
 static
 bool mtx_locked;
 
-// Signal handler for data thread.
+// Response bytes of all clients waiting to be written.
+static
+size_t pending_out_bytes;
+
+// Memory reports waiting to be written. The report is only rebuilt when there's none,
+// the bytes of waiting responses may not change under them.
+static
+size_t memory_reports_pending;
+
+// Clients subscribed to events.
+static
+size_t subscribers;
+
+// If this thread has started draining, and when it must give up.
+static
+bool drain_started;
+static
+uint64_t drain_deadline;
+
+// Time the next wait may busy poll before blocking, adapted to how soon traffic came in the last waits.
+static
+uint64_t wait_spin_budget_us;
+
+// Milliseconds the next wait may block for: 0 with writes left over, until the earliest flush or
+// drain deadline otherwise, or -1 without any.
+static
+int
+WaitTimeout( void );
+
+// poll() every client, busy polling within the spin budget first, then blocking for up to timeout.
+// Returns like poll() does.
+static
+int
+WaitForEvents( int timeout );
+
+// Poll file descriptor of a client.
+static
+struct pollfd *
+ClientPfd( size_t index );
+
+// Response bytes of a client waiting to be written.
+static
+size_t
+ClientPendingBytes( const Client *client );
+
+// Put a client with waiting responses in the writing schedule, and only poll it for reading if it may read.
+static
+void
+ScheduleClient( size_t index );
+
+// Close idle clients, and make the last waiting response of every other one close the connection.
+static
+void
+BeginDrain( void );
+
+// Close a client and remove it from the vectors, along with its receive buffer and scheduled writes.
+static
+void
+RemoveClient( size_t index );
+
+// Read from a client into its receive buffer and schedule a response for every complete request.
+// Returns the received bytes like recv() does.
+static
+ssize_t
+ReceiveRequests( size_t index );
+
+// Write the waiting responses of a client in as few sendmsg() calls as possible.
+// Returns the written bytes, -1 if the client should be dropped.
+// A client with out_close set is done once it has no waiting responses or events.
+static
+ssize_t
+FlushResponses( size_t index );
+
+// Write the waiting events of a subscriber in one sendmsg() per IOV_MAX of them.
+// Returns the written bytes, -1 if the client should be dropped.
+static
+ssize_t
+FlushEvents( size_t index );
+
+// Write the queued frames of an HTTP/2 client, queueing more as the flow control windows allow.
+// Returns the written bytes, -1 if the client should be dropped.
+static
+ssize_t
+FlushHttp2( size_t index );
+
+// Receive the waiting events and queue them for every subscriber, then write to the ones that can take them now.
+static
+void
+BroadcastEvents( void );
+
+#ifdef BH2_TLS
+// Go on with the handshake of an HTTPS client, and poll for what it waits for.
+// Returns false if the client has to be dropped.
+static
+bool
+ContinueHandshake( size_t index );
+#endif
+
+// Record an event of a client in the capture, preceded by its CAPTURE_OPEN if it's the first.
+static
+void
+CaptureClient( Client *client, CaptureEventType type, const char *bytes, size_t length );
+
+// Publish receive pool counters to the statistics.
+static
+void
+PublishPoolStats( void );
+
+// Publish the statistics and the loop state to the shared memory segment, see stats_segment.h.
+static
+void
+PublishSegment( uint64_t now_us, uint64_t cycle_us, bool force );
+
+// Rebuild the memory report from the current usage.
+static
+void
+BuildMemoryReport( void );
+
+// Give back the room of client vectors left mostly empty by a load spike.
 static
 void
-DataThreadSignalHandler( int );
+ShrinkClientVectors( void );
 
 int
 DataThread( void *arg_unused )
 {
     bh2_log_trace("[Data] Data thread is starting.");
-    sigaction(SIGINT, &(struct sigaction){ .sa_handler = DataThreadSignalHandler }, NULL);
+    Trace_RegisterThread("data");
 
     // await_writings contains index of clients that need respond.
-    await_writings = Vector_CreateS(sizeof(size_t), NULL);
+    await_writings = Deque_CreateS(sizeof(size_t));
+    recv_pool = BufferPool_CreateS(BH2_RECV_BUFFER_SIZE, BH2_RECV_POOL_MAX_BUFFERS);
+    recv_fallback = malloc(BH2_RECV_BUFFER_SIZE);
     // Return value of poll().
     int poll_result = 0;
     // Return value of recv() and send().
@@ -47,11 +221,24 @@ DataThread( void *arg_unused )
 
     while (!atomic_load(&should_exit))
     {
-        if (clients.length)
+        // Events keep coming without clients, and are taken off the control socket so its senders don't block.
+        if (clients.length || (events_fd != -1 && !atomic_load(&draining)))
         {
-            // Try to poll.
-            // If we have writings scheduled, block for 100ms. Otherwise, block for 300ms.
-            poll_result = poll(client_pfds.ptr, client_pfds.length, await_writings.length ? 100 : 300);
+            // Wait for traffic. The main thread wakes us up through data_wake_fd when it needs us,
+            // and nothing else is due before the timeout.
+            BH2_TRACE_BEGIN(poll_span);
+            poll_result = WaitForEvents(WaitTimeout());
+            BH2_TRACE_END("poll", poll_span, poll_result);
+            BH2_TRACE_BEGIN(cycle_span);
+            // Everything from here to the next poll() counts as lag.
+            uint64_t cycle_start = Clock_MonotonicUs();
+            if (poll_result > 0)
+            {
+                Stats_AddOwned(&server_stats.poll_wakeups, 1);
+                Stats_AddOwned(&server_stats.poll_ready_fds, (size_t)poll_result);
+            }
+            else if (!poll_result)
+                Stats_AddOwned(&server_stats.poll_timeouts, 1);
 
             if (!poll_result)
                 // None polled, do nothing.
@@ -64,30 +251,64 @@ DataThread( void *arg_unused )
                 bh2_log_error("[Data] poll() Error: %s.", strerror(errno));
             else
             {
+                // Woken up by main thread, reset the eventfd.
+                struct pollfd *wake_pfd = PollfdVector_At(&client_pfds, 0);
+                if (wake_pfd->revents & POLLIN)
+                {
+                    eventfd_t wake_count = 0;
+                    eventfd_read(data_wake_fd, &wake_count);
+                    Stats_AddOwned(&server_stats.eventfd_reads, 1);
+                }
+
+                if (PollfdVector_At(&client_pfds, 1)->revents & POLLIN)
+                    BroadcastEvents();
+
                 // Polled input.
                 // Process inputs, and add corresponding writes to writing schedule.
-                for (size_t i = 0; i < clients.length; i++)
+                // Walk backwards, so removing a client does not shift the ones not yet visited.
+                for (size_t i = clients.length; i-- > 0; )
                 {
-                    struct pollfd *cl = Vector_PtrAt(&client_pfds, i);
+                    struct pollfd *cl = ClientPfd(i);
                     if (cl->revents != 0)
                     {
                         if (cl->revents & POLLHUP)
                         {
                             // For some reason, most of the time when the other side disconnects, POLLIN with 0 byte recv() is received instead.
-                            close(cl->fd);
-                            Vector_Delete(&clients, i);
-                            Vector_Delete(&client_pfds, i);
+                            RemoveClient(i);
                             bh2_log_info("[Data] Client hunged up, removing from list. %zu clients left.", clients.length);
                             continue;
                         }
                         if (cl->revents & POLLERR)
                         {
-                            close(cl->fd);
-                            Vector_Delete(&clients, i);
-                            Vector_Delete(&client_pfds, i);
+                            RemoveClient(i);
                             bh2_log_error("[Data] Client poll() error, removing from list. %zu clients left.", clients.length);
                             continue;
                         }
+#ifdef BH2_TLS
+                        // HTTPS clients send no requests until their handshake is done.
+                        ClientExtras *extras = ClientVector_At(&clients, i)->extras;
+                        if (extras && extras->tls)
+                        {
+                            if (!ContinueHandshake(i))
+                            {
+                                RemoveClient(i);
+                                bh2_log_info("[Data] Handshake failed, removing client. %zu clients left.", clients.length);
+                            }
+                            continue;
+                        }
+#endif
+                        if (cl->revents & POLLOUT)
+                        {
+                            // Socket buffer has room again, resume the responses left behind.
+                            Client *client = ClientVector_At(&clients, i);
+                            cl->events &= ~POLLOUT;
+                            if (!client->out_scheduled)
+                            {
+                                client->out_scheduled = true;
+                                client->trace_scheduled = trace_enabled ? Trace_Now() : 0;
+                                Deque_Push(&await_writings, &i);
+                            }
+                        }
                         if (cl->revents & POLLIN)
                         {
 
@@ -98,44 +319,43 @@ DataThread( void *arg_unused )
                             */
 
                             bh2_log_info("[Data] POLLIN from Client #%zu.", i);
-                            recv_result = recv(cl->fd, recv_buffer, 65535, 0);
+                            recv_result = ReceiveRequests(i);
 
-                            if (recv_result < 0)
+                            if (recv_result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
                             {
-                                close(cl->fd);
-                                Vector_Delete(&clients, i);
-                                Vector_Delete(&client_pfds, i);
+                                // Only part of a TLS record is there yet, or the buffer is full until the waiting responses are written.
+                                bh2_log_info("[Data] Nothing to read yet from Client #%zu.", i);
+                            }
+                            else if (recv_result < 0)
+                            {
+                                RemoveClient(i);
                                 bh2_log_error("[Data] Received -1 byte from #%zu, possible error: %s. %zu clients left.", i, strerror(errno), clients.length);
                             }
                             else if (!recv_result)
                             {
-                                close(cl->fd);
-                                Vector_Delete(&clients, i);
-                                Vector_Delete(&client_pfds, i);
+                                RemoveClient(i);
                                 bh2_log_info("[Data] Received 0 byte from #%zu. Client hunged up. %zu clients left.", i, clients.length);
                             }
                             else
                             {
                                 // Record that "I received data (anything) from this client."
                                 bh2_log_info("[Data] Received %zd bytes from Client #%zu.", recv_result, i);
-
-                                // I noticed that certain browsers tend to send multiple requests to websites (eg. one for webpage one for icon),
-                                // and since we recv() 65535 bytes at once, it is possible that one recv() contains multiple requests from the same client.
-                                // So it's necessary to process every one of them.
-                                // I just send a respond to every \r\n\r\n, ignoring "Content-Length".
-                                for (const char *haystack = recv_buffer; haystack; haystack = strstr(haystack + 1, "\r\n\r\n"))
-                                    Vector_Push(&await_writings, &i);
                             }
                         }
                     }
                 }
             }
 
-            // Perform writes on schedules. If there are over 14 writes, write only 14 of them.
+            if (atomic_load(&draining) && !drain_started)
+                BeginDrain();
+
+            // Perform writes on schedules. If there are over 14 clients to write, write only 14 of them.
+            // Every client gets all of its pipelined responses in one go.
             if (await_writings.length)
             {
                 bh2_log_info("[Data] Start handling writing.");
-                for (size_t i = 0; i < 14 && await_writings.length; i++)
+                size_t writes = 0;
+                for (; writes < BH2_DATA_WRITES_PER_CYCLE && await_writings.length; writes++)
                 {
                     /*
                 
@@ -143,16 +363,62 @@ DataThread( void *arg_unused )
 
                     */
                     size_t client_id = 0;
-                    Vector_Pop(&await_writings, &client_id);
+                    Deque_Pop_Front(&await_writings, &client_id);
 
-                    Client *client = Vector_PtrAt(&clients, client_id);
-                    send_result = send(client->socket_fd, html_content, html_content_size, MSG_DONTWAIT);
-                    bh2_log_info("[Data] Written to client %zu, send result: %zu, error: %s.", client_id, send_result, strerror(errno));
+                    Client *client = ClientVector_At(&clients, client_id);
+                    int client_fd = client->socket_fd;
+                    BH2_TRACE_BEGIN(send_span);
+                    if (trace_enabled)
+                        Trace_Span("queue_wait", client->trace_scheduled, send_span, client_fd);
+                    send_result = FlushResponses(client_id);
+                    BH2_TRACE_END("send", send_span, client_fd);
+                    client = ClientVector_At(&clients, client_id);
+                    if (send_result < 0)
+                    {
+                        bh2_log_error("[Data] Failed to write to client %zu: %s.", client_id, strerror(errno));
+                        RemoveClient(client_id);
+                    }
+                    else if (client->out_close && !ClientPendingBytes(client))
+                    {
+                        bh2_log_info("[Data] Written final %zd bytes to client %zu, closing it.", send_result, client_id);
+                        RemoveClient(client_id);
+                    }
+                    else
+                    {
+                        bh2_log_info("[Data] Written %zd bytes to client %zu.", send_result, client_id);
+                    }
                 }
+                Stats_AddOwned(&server_stats.write_cycles, 1);
+                Stats_AddOwned(&server_stats.write_clients, writes);
+                if (await_writings.length)
+                    Stats_AddOwned(&server_stats.write_limit_reached, 1);
             }
             else
                 bh2_log_info("[Data] No await writings in current cycle with %zu clients.", clients.length);
 
+            AccessLog_Flush(false);
+            Capture_Flush(false);
+
+            // Give back what the last load spike left idle.
+            BufferPool_Trim(&recv_pool, options.low_memory ? 0 : BH2_RECV_POOL_SPARE_BUFFERS);
+            if (options.low_memory)
+                ShrinkClientVectors();
+            PublishPoolStats();
+            BH2_TRACE_END("cycle", cycle_span, clients.length);
+            uint64_t busy_us = Clock_MonotonicUs() - cycle_start;
+            Stats_RecordLoopCycle(busy_us);
+            Overload_Update(clients.length, pending_out_bytes, busy_us / 1000);
+            if (stats_segment_enabled)
+                PublishSegment(cycle_start + busy_us, busy_us, false);
+
+            // Draining is done once every client is gone, or out of time.
+            if (drain_started && (!clients.length || Clock_MonotonicMs() >= drain_deadline))
+            {
+                bh2_log_info("[Data] Done draining, %zu clients left.", clients.length);
+                atomic_store(&should_exit, true);
+                break;
+            }
+
             // Check if there's new clients incoming. If so, set conditional variable and wait for
             // main thread to add new clients to the clients vector
             if (atomic_load(&new_client_incoming))
@@ -174,10 +440,21 @@ DataThread( void *arg_unused )
                 bh2_log_info("[Data] Added new client from Main thread. New clients count: %zu.", clients.length);
             }
         }
+        else if (atomic_load(&draining))
+        {
+            // Nobody to drain.
+            atomic_store(&should_exit, true);
+        }
         else
         {
             // If there is no client for us to read, release the mutex and block until main thread adds a client
             bh2_log_info("[Data] No client. Data thread sleeping.");
+            AccessLog_Flush(true);
+            Capture_Flush(true);
+            Overload_Update(0, 0, 0);
+            // Readers see the server idle, not the last cycle before it.
+            if (stats_segment_enabled)
+                PublishSegment(Clock_MonotonicUs(), 0, true);
             mtx_locked = false;
             atomic_store(&data_thread_block, true);
             cnd_wait(&clients_cnd, &clients_mtx);
@@ -188,9 +465,24 @@ DataThread( void *arg_unused )
     }
 
     // Data thread quitting.
+    // Clients are closed by main thread, but their receive buffers belong to the pool.
+    for (size_t i = 0; i < clients.length; i++)
+    {
+        Client *client = ClientVector_At(&clients, i);
+        if (client->recv_buf)
+        {
+            BufferPool_Release(&recv_pool, client->recv_buf);
+            client->recv_buf = NULL;
+            client->recv_len = 0;
+        }
+        Client_FreeExtras(client);
+    }
+    PublishPoolStats();
+    BufferPool_DestroyS(&recv_pool);
+    free(recv_fallback);
     if (mtx_locked)
         mtx_unlock(&clients_mtx);
-    Vector_DestroyS(&await_writings);
+    Deque_DestroyS(&await_writings);
 
     bh2_log_trace("[Data] Data thread has ended.");
     atomic_store(&data_thread_block, false);
@@ -198,11 +490,1335 @@ DataThread( void *arg_unused )
     return EXIT_SUCCESS;
 }
 
+static
+int
+WaitTimeout( void )
+{
+    // Responses left over by the per cycle limit go out right away.
+    if (await_writings.length)
+        return 0;
+
+    uint64_t deadline = AccessLog_FlushDeadline();
+    uint64_t capture_deadline = Capture_FlushDeadline();
+    if (capture_deadline < deadline)
+        deadline = capture_deadline;
+    if (drain_started && drain_deadline < deadline)
+        deadline = drain_deadline;
+
+    int timeout = -1;
+    if (deadline != UINT64_MAX)
+    {
+        uint64_t now = Clock_MonotonicMs();
+        timeout = now >= deadline ? 0 : (int)(deadline - now < INT_MAX ? deadline - now : INT_MAX);
+    }
+    // Overload state is only updated after a cycle, and main thread may be waiting for it to clear.
+    if (Overload_State() != OVERLOAD_NONE && (timeout < 0 || timeout > BH2_WAIT_OVERLOADED_MS))
+        timeout = BH2_WAIT_OVERLOADED_MS;
+    return timeout;
+}
+
+static
+int
+WaitForEvents( int timeout )
+{
+    uint64_t wait_start = Clock_MonotonicUs();
+    // Waits that may not block tell nothing about the traffic.
+    bool adapt = options.wait_spin_us && timeout;
+    int result = 0;
+
+    // Traffic came back soon enough lately that polling again beats sleeping and being woken up.
+    if (timeout && wait_spin_budget_us)
+    {
+        BH2_TRACE_BEGIN(spin_span);
+        uint64_t spin_end = wait_start + wait_spin_budget_us;
+        uint64_t now = wait_start;
+        size_t polls = 0;
+        do
+        {
+            result = poll(client_pfds.ptr, client_pfds.length, 0);
+            polls++;
+            now = Clock_MonotonicUs();
+        }
+        while (!result && now < spin_end);
+        BH2_TRACE_END("spin", spin_span, result);
+
+        Stats_AddOwned(&server_stats.poll_calls, polls);
+        Stats_AddOwned(&server_stats.wait_spin_polls, polls);
+        Stats_AddOwned(&server_stats.wait_spin_us, now - wait_start);
+        if (result)
+        {
+            if (result > 0)
+                Stats_AddOwned(&server_stats.wait_spin_hits, 1);
+            timeout = 0;
+        }
+        else
+        {
+            Stats_AddOwned(&server_stats.wait_spin_misses, 1);
+            if (timeout > 0)
+            {
+                uint64_t spun_ms = (now - wait_start) / 1000;
+                timeout = spun_ms < (uint64_t)timeout ? timeout - (int)spun_ms : 0;
+            }
+        }
+    }
+
+    if (!result)
+    {
+        if (timeout < 0)
+            Stats_AddOwned(&server_stats.wait_indefinite, 1);
+        uint64_t block_start = Clock_MonotonicUs();
+        result = poll(client_pfds.ptr, client_pfds.length, timeout);
+        Stats_AddOwned(&server_stats.poll_calls, 1);
+        Stats_AddOwned(&server_stats.poll_blocked_us, Clock_MonotonicUs() - block_start);
+    }
+
+    // Aim the budget at twice the time traffic took to come, averaged with the last budget.
+    // Traffic that came later than the spin limit, or not at all, is not worth spinning for.
+    // A wait ended sooner by its deadline does not tell either.
+    uint64_t gap_us = Clock_MonotonicUs() - wait_start;
+    if (adapt && result >= 0 && (result || gap_us >= options.wait_spin_us))
+    {
+        uint64_t target_us = 0;
+        if (result && gap_us <= options.wait_spin_us)
+            target_us = gap_us * 2ULL < options.wait_spin_us ? gap_us * 2ULL : options.wait_spin_us;
+        wait_spin_budget_us = (wait_spin_budget_us + target_us) / 2ULL;
+        atomic_store_explicit(&server_stats.wait_spin_budget_us, wait_spin_budget_us, memory_order_relaxed);
+    }
+    return result;
+}
+
+static
+struct pollfd *
+ClientPfd( size_t index )
+{
+    return PollfdVector_At(&client_pfds, index + BH2_DATA_PFDS_RESERVED);
+}
+
+// Response a run of a client is made of.
+static
+const Response *
+RunResponse( const Client *client, const ResponseRun *run )
+{
+    if (run->kind == RESPONSE_PARTIAL)
+        return &client->extras->partial;
+    return run->closing ? &closing_responses[run->kind] : &responses[run->kind];
+}
+
+static
+size_t
+ClientPendingBytes( const Client *client )
+{
+    size_t bytes = 0;
+    for (size_t r = 0; r < client->out_runs_len; r++)
+    {
+        const Response *response = RunResponse(client, &client->out_runs[r]);
+        bytes += (response->head_size + response->body_size) * client->out_runs[r].count;
+    }
+    if (client->extras)
+        bytes += client->extras->events_backlog;
+    if (client->http2)
+        bytes += Http2_QueuedBytes(client->extras->h2);
+    return bytes - client->out_offset;
+}
+
+static
+void
+BeginDrain( void )
+{
+    drain_started = true;
+    drain_deadline = Clock_MonotonicMs() + BH2_DRAIN_TIMEOUT_MS;
+
+    for (size_t i = clients.length; i-- > 0; )
+    {
+        Client *client = ClientVector_At(&clients, i);
+
+        // Streams end once the events they have are written.
+        if (client->subscribed && (client->out_runs_len || client->extras->events.length))
+        {
+            client->out_close = true;
+            ScheduleClient(i);
+            continue;
+        }
+
+        // HTTP/2 clients are told to go away, and end once their streams are written.
+        if (client->http2)
+        {
+            size_t queued = Http2_QueuedBytes(client->extras->h2);
+            Http2_GoAway(client->extras->h2);
+            pending_out_bytes += Http2_QueuedBytes(client->extras->h2) - queued;
+            ScheduleClient(i);
+            continue;
+        }
+
+        // Keep-alive clients with nothing going on are closed right away.
+        if (!client->out_runs_len && !client->recv_len)
+        {
+            RemoveClient(i);
+            continue;
+        }
+
+        // Clients in the middle of a request get a closing response once it's complete.
+        if (!client->out_runs_len || client->out_close)
+            continue;
+
+        // Turn the last waiting response into a closing one, unless it has started being written.
+        pending_out_bytes -= ClientPendingBytes(client);
+        ResponseRun *last = &client->out_runs[client->out_runs_len - 1];
+        bool last_started = client->out_runs_len == 1 && last->count == 1 && client->out_offset;
+        if (!last_started && last->count == 1)
+        {
+            last->closing = true;
+            if (last->kind == RESPONSE_PARTIAL)
+            {
+                Response *partial = &client->extras->partial;
+                *partial = Response_Partial(partial->body - (html_content + html_head_size), partial->body_size, true);
+            }
+        }
+        else if (!last_started && client->out_runs_len < BH2_CLIENT_OUT_RUNS)
+        {
+            last->count--;
+            client->out_runs[client->out_runs_len++] = (ResponseRun){ .kind = last->kind, .closing = true, .count = 1 };
+        }
+        client->out_close = true;
+        pending_out_bytes += ClientPendingBytes(client);
+        ScheduleClient(i);
+    }
+
+    bh2_log_info("[Data] Draining %zu clients.", clients.length);
+}
+
+static
+void
+RemoveClient( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+    close(client->socket_fd);
+    Stats_AddOwned(&server_stats.close_calls, 1);
+    if (capture_enabled)
+        CaptureClient(client, CAPTURE_CLOSE, NULL, 0);
+    RateLimit_Release(client->rate_slot);
+    pending_out_bytes -= ClientPendingBytes(client);
+    for (size_t r = 0; r < client->out_runs_len; r++)
+        if (client->out_runs[r].kind == RESPONSE_MEMORY)
+            memory_reports_pending -= client->out_runs[r].count;
+    if (client->recv_buf)
+        BufferPool_Release(&recv_pool, client->recv_buf);
+    if (client->subscribed)
+        atomic_store_explicit(&server_stats.events_subscribers, --subscribers, memory_order_relaxed);
+    // Requests of a client gone before its responses are written are not logged.
+    Client_FreeExtras(client);
+    ClientVector_Delete(&clients, index);
+    PollfdVector_Delete(&client_pfds, index + BH2_DATA_PFDS_RESERVED);
+
+    // Scheduled writes refer to clients by index, drop the ones of this client and shift the ones after it.
+    for (size_t i = 0; i < await_writings.length; )
+    {
+        size_t *client_id = Deque_PtrAt(&await_writings, i);
+        if (*client_id == index)
+            Deque_Delete(&await_writings, i);
+        else
+        {
+            if (*client_id > index)
+                (*client_id)--;
+            i++;
+        }
+    }
+}
+
+// Find the end of the first request header ("\r\n\r\n") in the bytes.
+// Returns the offset right after it, 0 if there is none.
+static
+size_t
+FindRequestEnd( const char *bytes, size_t length )
+{
+    for (const char *lf = memchr(bytes, '\n', length); lf; lf = memchr(lf + 1, '\n', bytes + length - lf - 1))
+    {
+        size_t offset = lf - bytes;
+        if (offset >= 3 && lf[-1] == '\r' && lf[-2] == '\n' && lf[-3] == '\r')
+            return offset + 1;
+    }
+    return 0;
+}
+
+// Queue a response for a client, merging it into the last run if it is of the same kind.
+// Returns false if the client has no run left for it.
+// While draining, the response is the closing one.
+static
+bool
+QueueResponse( Client *client, ResponseKind kind )
+{
+    ResponseRun *last = client->out_runs_len ? &client->out_runs[client->out_runs_len - 1] : NULL;
+    if (last && last->kind == kind && kind != RESPONSE_PARTIAL && last->closing == drain_started && last->count < UINT32_MAX)
+        last->count++;
+    else if (client->out_runs_len < BH2_CLIENT_OUT_RUNS)
+    {
+        last = &client->out_runs[client->out_runs_len++];
+        *last = (ResponseRun){ .kind = kind, .closing = drain_started, .count = 1 };
+    }
+    else
+        return false;
+
+    if (kind == RESPONSE_MEMORY && !memory_reports_pending++)
+        BuildMemoryReport();
+    const Response *response = RunResponse(client, last);
+    pending_out_bytes += response->head_size + response->body_size;
+    if (response->close)
+        client->out_close = true;
+    return true;
+}
+
+// Queue the response to a range of the page. Returns false if the client has a partial response waiting already.
+static
+bool
+QueuePartial( Client *client, const RequestRange *range )
+{
+    // Without extras, the whole page is as good an answer.
+    ClientExtras *extras = Client_Extras(client);
+    if (!extras)
+        return QueueResponse(client, RESPONSE_PAGE);
+    for (size_t r = 0; r < client->out_runs_len; r++)
+        if (client->out_runs[r].kind == RESPONSE_PARTIAL)
+            return false;
+    extras->partial = Response_Partial(range->start, range->length, drain_started);
+    return QueueResponse(client, RESPONSE_PARTIAL);
+}
+
+// Start the access record of a queued response. line is NULL if the request could not be parsed.
+static
+void
+QueueAccess( Client *client, const RequestLine *line, uint64_t received_us )
+{
+    ClientExtras *extras = Client_Extras(client);
+    if (!extras)
+        return;
+
+    AccessRecord record = { .time_us = received_us, .method = BH2_ACCESS_METHOD_NONE };
+    if (line)
+    {
+        record.method = (uint8_t)line->method;
+        record.path_hash = AccessLog_HashPath(line->target, line->target_len);
+    }
+    Vector_Push(&extras->access_pending, &record);
+}
+
+// Add the access record of a response written completely to the log, with its status and size set.
+static
+void
+AddAccess( const Client *client, AccessRecord *record, uint64_t written_us, uint64_t now_realtime_us )
+{
+    uint64_t latency = written_us - record->time_us;
+    record->latency_us = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+    record->time_us = now_realtime_us;
+    memcpy(record->addr, client->addr, sizeof(record->addr));
+    record->port = client->port;
+    AccessLog_Add(record);
+}
+
+// Finish the access record of a response written completely, and add it to the log.
+static
+void
+CompleteAccess( Client *client, const Response *response, uint64_t written_us, uint64_t now_realtime_us )
+{
+    ClientExtras *extras = client->extras;
+    if (!extras || extras->access_done >= extras->access_pending.length)
+        return;
+
+    AccessRecord *record = Vector_PtrAt(&extras->access_pending, extras->access_done++);
+    record->status = response->status;
+    record->bytes = (uint32_t)(response->head_size + response->body_size);
+    AddAccess(client, record, written_us, now_realtime_us);
+
+    // Everything pending is logged, start over instead of shifting the vector.
+    if (extras->access_done == extras->access_pending.length)
+    {
+        Vector_Clear(&extras->access_pending);
+        extras->access_done = 0;
+        if (options.low_memory)
+            Vector_ShrinkToFit(&extras->access_pending);
+    }
+}
+
+// Pick the response for a GET of the page with a Range header.
+static
+ResponseKind
+ClassifyRange( const RequestLine *line, size_t headers_len, RequestRange *range )
+{
+    const char *value = NULL;
+    size_t value_len = 0;
+    if (!Request_FindHeader(line->headers, headers_len, "range", &value, &value_len))
+        return RESPONSE_PAGE;
+    RequestRangeResult result = Request_ParseRange(value, value_len, html_content_size - html_head_size, range);
+
+    // A range of another version of the page is of no use, the whole page replaces it.
+    const char *validator = NULL;
+    size_t validator_len = 0;
+    if (result != REQUEST_RANGE_NONE && Request_FindHeader(line->headers, headers_len, "if-range", &validator, &validator_len) &&
+        (validator_len != strlen(page_etag) || memcmp(validator, page_etag, validator_len)))
+        return RESPONSE_PAGE;
+
+    switch (result)
+    {
+        case REQUEST_RANGE_OK:
+            return RESPONSE_PARTIAL;
+        case REQUEST_RANGE_UNSATISFIABLE:
+            return RESPONSE_RANGE_NOT_SATISFIABLE;
+        case REQUEST_RANGE_NONE:
+            break;
+    }
+    return RESPONSE_PAGE;
+}
+
+// Pick the response for a complete request.
+// line retrieves the request line, its target is NULL if the request could not be parsed.
+// range retrieves the range of the page asked for with RESPONSE_PARTIAL.
+static
+ResponseKind
+ClassifyRequest( Client *client, const char *bytes, size_t length, bool *ignore, RequestLine *line, RequestRange *range )
+{
+    *ignore = false;
+    *line = (RequestLine){ 0 };
+
+    switch (Request_ParseLine(bytes, length, BH2_MAX_TARGET_LENGTH, line))
+    {
+        case REQUEST_PARSE_EMPTY:
+            *ignore = true;
+            return RESPONSE_PAGE;
+        case REQUEST_PARSE_BAD:
+            *line = (RequestLine){ 0 };
+            return RESPONSE_BAD_REQUEST;
+        case REQUEST_PARSE_TARGET_TOO_LONG:
+            *line = (RequestLine){ 0 };
+            return RESPONSE_URI_TOO_LONG;
+        case REQUEST_PARSE_OK:
+            break;
+    }
+
+    switch (line->method)
+    {
+        case REQUEST_METHOD_GET:
+            // Fast path, bodies of GET are not looked for.
+            if (line->target_len == sizeof(BH2_MEMORY_REPORT_PATH) - 1 && !memcmp(line->target, BH2_MEMORY_REPORT_PATH, line->target_len))
+                return RESPONSE_MEMORY;
+            if (events_fd != -1 && line->target_len == sizeof(BH2_EVENTS_PATH) - 1 && !memcmp(line->target, BH2_EVENTS_PATH, line->target_len))
+                return RESPONSE_EVENTS;
+            // A templated page changes with every response, it's only answered whole.
+            if (!options.templated)
+                return ClassifyRange(line, bytes + length - line->headers, range);
+            return RESPONSE_PAGE;
+        case REQUEST_METHOD_HEAD:
+            return RESPONSE_PAGE_HEAD;
+        case REQUEST_METHOD_OPTIONS:
+        case REQUEST_METHOD_OTHER:
+            break;
+    }
+
+    // Other methods may carry a body, which has to be skipped to find the next request.
+    const char *value = NULL;
+    size_t value_len = 0;
+    size_t headers_len = bytes + length - line->headers;
+    if (Request_FindHeader(line->headers, headers_len, "transfer-encoding", &value, &value_len))
+        // Not worth decoding chunks just to reject them.
+        return RESPONSE_BAD_REQUEST;
+    if (Request_FindHeader(line->headers, headers_len, "content-length", &value, &value_len))
+    {
+        size_t content_length = 0;
+        for (size_t i = 0; i < value_len; i++)
+        {
+            if (!isdigit((unsigned char)value[i]) || content_length > SIZE_MAX / 10)
+                return RESPONSE_BAD_REQUEST;
+            content_length = content_length * 10 + (value[i] - '0');
+        }
+        client->recv_skip = content_length;
+    }
+
+    return line->method == REQUEST_METHOD_OPTIONS ? RESPONSE_OPTIONS : RESPONSE_BAD_METHOD;
+}
+
+// Queue an event for a subscriber. Returns false if it would fall behind by more than the backlog allows.
+static
+bool
+QueueEvent( Client *client, EventBuffer *event )
+{
+    ClientExtras *extras = client->extras;
+    if (extras->events_backlog + event->size > options.events_backlog || !Deque_Push(&extras->events, &event))
+        return false;
+    event->refs++;
+    extras->events_backlog += event->size;
+    pending_out_bytes += event->size;
+    return true;
+}
+
+// Make a client asking for the event stream a subscriber, and give it the last event unless its Last-Event-ID is that one.
 static
 void
-DataThreadSignalHandler( int signum_unused )
+Subscribe( Client *client, const RequestLine *line, size_t headers_len )
 {
-    // Received Ctrl+C signal, ending program.
-    bh2_log_info("[Data] Caught SIGINT.");
-    atomic_store(&should_exit, true);
+    if (!Client_Extras(client))
+    {
+        // The stream ends right after its header, the client will try again.
+        client->out_close = true;
+        return;
+    }
+    client->subscribed = true;
+    atomic_store_explicit(&server_stats.events_subscribers, ++subscribers, memory_order_relaxed);
+
+    EventBuffer *last = Events_Last();
+    if (!last)
+        return;
+    const char *value = NULL;
+    size_t value_len = 0;
+    if (Request_FindHeader(line->headers, headers_len, "last-event-id", &value, &value_len))
+    {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < value_len && isdigit((unsigned char)value[i]) && seen <= UINT64_MAX / 10; i++)
+            seen = seen * 10 + (value[i] - '0');
+        if (seen == last->id)
+            return;
+    }
+    QueueEvent(client, last);
+}
+
+static
+void
+ScheduleClient( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+    bool events_waiting = client->subscribed && client->extras->events.length;
+    bool frames_waiting = client->http2 && Http2_WantsWrite(client->extras->h2);
+    if ((client->out_runs_len || events_waiting || frames_waiting) && !client->out_scheduled)
+    {
+        client->out_scheduled = true;
+        client->trace_scheduled = trace_enabled ? Trace_Now() : 0;
+        Deque_Push(&await_writings, &index);
+    }
+
+    struct pollfd *pfd = ClientPfd(index);
+    if (client->recv_paused || client->out_close)
+        pfd->events &= ~POLLIN;
+    else
+        pfd->events |= POLLIN;
+}
+
+// Make a client speak HTTP/2. An upgraded one takes the settings of its HTTP2-Settings header.
+// Returns the session, NULL if out of memory or the settings are invalid.
+static
+Http2Session *
+StartHttp2( Client *client, bool upgraded, const char *settings, size_t settings_len )
+{
+    ClientExtras *extras = Client_Extras(client);
+    Http2Session *h2 = extras ? Http2_Open(upgraded) : NULL;
+    if (!h2)
+        return NULL;
+    if (upgraded && !Http2_ApplyUpgradeSettings(h2, settings, settings_len))
+    {
+        Http2_Close(h2);
+        return NULL;
+    }
+    extras->h2 = h2;
+    client->http2 = true;
+    pending_out_bytes += Http2_QueuedBytes(h2);
+    Stats_AddOwned(&server_stats.http2_connections, 1);
+    return h2;
+}
+
+// Tell if an HTTP/1.1 request asks to upgrade to HTTP/2, and get its HTTP2-Settings.
+static
+bool
+WantsUpgrade( const RequestLine *line, size_t headers_len, const char **settings, size_t *settings_len )
+{
+    // Only requests without a body are upgraded.
+    if (line->version_major != 1 || line->version_minor < 1 || (line->method != REQUEST_METHOD_GET && line->method != REQUEST_METHOD_HEAD))
+        return false;
+    const char *value = NULL;
+    size_t value_len = 0;
+    if (!Request_FindHeader(line->headers, headers_len, "upgrade", &value, &value_len))
+        return false;
+
+    // Other protocols may be offered along.
+    for (size_t start = 0; start < value_len; )
+    {
+        const char *comma = memchr(value + start, ',', value_len - start);
+        size_t end = comma ? (size_t)(comma - value) : value_len, token_end = end;
+        while (start < token_end && value[start] == ' ')
+            start++;
+        while (token_end > start && value[token_end - 1] == ' ')
+            token_end--;
+        if (token_end - start == 3 && tolower((unsigned char)value[start]) == 'h' && value[start + 1] == '2' &&
+            tolower((unsigned char)value[start + 2]) == 'c')
+            return Request_FindHeader(line->headers, headers_len, "http2-settings", settings, settings_len);
+        start = end + 1;
+    }
+    return false;
+}
+
+// Answer a request of an HTTP/2 client like ClassifyRequest() does for HTTP/1, on its stream.
+static
+void
+AnswerStream( Client *client, Http2Session *h2, const Http2Request *request, uint64_t received_us )
+{
+    ResponseKind kind = RESPONSE_BAD_REQUEST;
+    if (request->path_too_long)
+        kind = RESPONSE_URI_TOO_LONG;
+    else if (request->has_method && request->method == REQUEST_METHOD_OTHER)
+        kind = RESPONSE_BAD_METHOD;
+    else if (request->has_method && request->path)
+        kind = request->method == REQUEST_METHOD_HEAD ? RESPONSE_PAGE_HEAD :
+               request->method == REQUEST_METHOD_OPTIONS ? RESPONSE_OPTIONS : RESPONSE_PAGE;
+    if (!responses[kind].close && !RateLimit_AllowRequest(client->rate_slot))
+        kind = RESPONSE_TOO_MANY_REQUESTS;
+
+    AccessRecord record = { .time_us = received_us, .method = BH2_ACCESS_METHOD_NONE };
+    if (access_log_enabled && request->has_method)
+    {
+        record.method = (uint8_t)request->method;
+        if (request->path)
+            record.path_hash = AccessLog_HashPath(request->path, request->path_len);
+    }
+    if (!Http2_Respond(h2, request->stream_id, kind, &record))
+    {
+        Stats_AddOwned(&server_stats.http2_refused_streams, 1);
+        return;
+    }
+    Stats_AddOwned(&server_stats.requests_received, 1);
+    Stats_AddOwned(&server_stats.http2_streams, 1);
+}
+
+// Answer the requests in the complete frames of an HTTP/2 client.
+// Returns how many bytes are consumed.
+static
+size_t
+ProcessFrames( size_t index, const char *buffer, size_t length )
+{
+    Client *client = ClientVector_At(&clients, index);
+    Http2Session *h2 = client->extras->h2;
+    size_t queued = Http2_QueuedBytes(h2), consumed = 0;
+    uint64_t received_us = access_log_enabled ? Clock_MonotonicUs() : 0;
+
+    for (Http2Result result = HTTP2_REQUEST; result == HTTP2_REQUEST; )
+    {
+        size_t used = 0;
+        Http2Request request;
+        result = Http2_Receive(h2, buffer + consumed, length - consumed, BH2_MAX_TARGET_LENGTH, &used, &request);
+        consumed += used;
+        if (result == HTTP2_REQUEST)
+            AnswerStream(client, h2, &request, received_us);
+        else if (result == HTTP2_FAILED && !client->out_close)
+        {
+            // The connection ends once GOAWAY is written.
+            client->out_close = true;
+            Stats_AddOwned(&server_stats.http2_failed, 1);
+        }
+    }
+
+    // Control frames are queued right away, and reset streams may have taken some out.
+    pending_out_bytes += Http2_QueuedBytes(h2);
+    pending_out_bytes -= queued;
+    return consumed;
+}
+
+// Answer the complete requests in a client's buffer, starting the search for their ends at scan_from.
+// Returns how many bytes are consumed.
+static
+size_t
+ProcessRequests( size_t index, const char *buffer, size_t length, size_t scan_from )
+{
+    Client *client = ClientVector_At(&clients, index);
+    size_t consumed = 0;
+    // Requests in one buffer all count as received now.
+    uint64_t received_us = access_log_enabled ? Clock_MonotonicUs() : 0;
+
+    // I noticed that certain browsers tend to send multiple requests to websites (eg. one for webpage one for icon),
+    // and since we recv() up to a whole buffer at once, it is possible that one recv() contains multiple requests from the same client.
+    // So it's necessary to process every one of them.
+    while (consumed < length && !client->out_close && !client->subscribed && !client->http2)
+    {
+        if (client->recv_skip)
+        {
+            size_t skip = length - consumed < client->recv_skip ? length - consumed : client->recv_skip;
+            client->recv_skip -= skip;
+            consumed += skip;
+            scan_from = consumed;
+            continue;
+        }
+
+        // Clients knowing the server speaks HTTP/2 start with its preface instead of a request.
+        if (options.h2c && buffer[consumed] == 'P')
+        {
+            size_t compared = length - consumed < BH2_HTTP2_PREFACE_SIZE ? length - consumed : BH2_HTTP2_PREFACE_SIZE;
+            if (!memcmp(buffer + consumed, BH2_HTTP2_PREFACE, compared))
+            {
+                if (compared < BH2_HTTP2_PREFACE_SIZE)
+                    break;
+                consumed += BH2_HTTP2_PREFACE_SIZE;
+                if (!StartHttp2(client, false, NULL, 0) && QueueResponse(client, RESPONSE_UNAVAILABLE) && access_log_enabled)
+                    QueueAccess(client, NULL, received_us);
+                break;
+            }
+        }
+
+        if (scan_from < consumed)
+            scan_from = consumed;
+        size_t end = FindRequestEnd(buffer + scan_from, length - scan_from);
+        if (!end)
+            break;
+        end += scan_from;
+
+        bool ignore = false;
+        RequestLine line;
+        RequestRange range;
+        ResponseKind kind = ClassifyRequest(client, buffer + consumed, end - consumed, &ignore, &line, &range);
+        if (!ignore && !responses[kind].close && !RateLimit_AllowRequest(client->rate_slot))
+            kind = RESPONSE_TOO_MANY_REQUESTS;
+
+        // An upgrading request is answered on stream 1, after the 101 and the server's SETTINGS.
+        // Without a valid HTTP2-Settings, it's answered in HTTP/1 like any other.
+        const char *settings = NULL;
+        size_t settings_len = 0;
+        Http2Session *h2 = NULL;
+        if (!ignore && options.h2c && line.target && WantsUpgrade(&line, buffer + end - line.headers, &settings, &settings_len) &&
+            (h2 = StartHttp2(client, true, settings, settings_len)))
+        {
+            AccessRecord record = { .time_us = received_us, .method = (uint8_t)line.method };
+            if (access_log_enabled)
+                record.path_hash = AccessLog_HashPath(line.target, line.target_len);
+            Http2_Respond(h2, 1, kind, &record);
+            Stats_AddOwned(&server_stats.requests_received, 1);
+            Stats_AddOwned(&server_stats.http2_streams, 1);
+            consumed = end;
+            break;
+        }
+
+        if (!ignore && !(kind == RESPONSE_PARTIAL ? QueuePartial(client, &range) : QueueResponse(client, kind)))
+        {
+            // Request is complete, but there's no run left for it. Parse it again later.
+            client->recv_skip = 0;
+            client->recv_paused = true;
+            break;
+        }
+        if (!ignore)
+        {
+            Stats_AddOwned(&server_stats.requests_received, 1);
+            if (access_log_enabled)
+                QueueAccess(client, line.target ? &line : NULL, received_us);
+        }
+        if (!ignore && kind == RESPONSE_EVENTS && !client->out_close)
+            Subscribe(client, &line, buffer + end - line.headers);
+        consumed = end;
+    }
+    // The rest is frames once the client speaks HTTP/2.
+    if (client->http2 && !client->out_close)
+        consumed += ProcessFrames(index, buffer + consumed, length - consumed);
+    // Whatever a subscriber sends is of no use.
+    if (client->subscribed)
+        consumed = length;
+
+    ScheduleClient(index);
+    return consumed;
+}
+
+// Keep the unconsumed part of a buffer with the client, or give the buffer back if nothing is left.
+// Returns false if the client has to be dropped.
+static
+bool
+KeepRemainder( size_t index, char *buffer, size_t length, size_t consumed )
+{
+    Client *client = ClientVector_At(&clients, index);
+    size_t remaining = length - consumed;
+
+    if (!remaining || client->out_close)
+    {
+        // Everything is answered, or the connection ends anyway. The buffer goes back to the pool.
+        if (buffer != recv_fallback)
+            BufferPool_Release(&recv_pool, buffer);
+        client->recv_buf = NULL;
+        client->recv_len = 0;
+        return true;
+    }
+
+    if (buffer == recv_fallback)
+    {
+        // There was no buffer to keep it in.
+        client->recv_buf = NULL;
+        client->recv_len = 0;
+        return false;
+    }
+
+    // Keep the incomplete request for the next read.
+    if (consumed)
+        memmove(buffer, buffer + consumed, remaining);
+    client->recv_buf = buffer;
+    client->recv_len = remaining;
+    return true;
+}
+
+// Answer a buffer filled by a request that doesn't end, then close the connection.
+// Without a run left for the answer, reading pauses until the waiting responses are written.
+static
+void
+RejectOversized( size_t index, const char *buffer, size_t length, size_t consumed )
+{
+    Client *client = ClientVector_At(&clients, index);
+    if (consumed || length < BH2_RECV_BUFFER_SIZE || client->recv_paused || client->out_close || client->http2)
+        return;
+
+    // Tell whether it's the target that's too long.
+    const char *lf = memchr(buffer, '\n', length);
+    if (!QueueResponse(client, !lf || (size_t)(lf - buffer) > BH2_MAX_TARGET_LENGTH ? RESPONSE_URI_TOO_LONG : RESPONSE_BAD_REQUEST))
+        client->recv_paused = true;
+    else
+    {
+        if (access_log_enabled)
+            QueueAccess(client, NULL, Clock_MonotonicUs());
+        atomic_fetch_add_explicit(&server_stats.requests_oversized, 1, memory_order_relaxed);
+        bh2_log_error("[Data] Client #%zu has a request that can not be buffered.", index);
+    }
+    ScheduleClient(index);
+}
+
+static
+ssize_t
+ReceiveRequests( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+
+    // Continue an incomplete request in its own buffer, otherwise borrow one from the pool.
+    char *buffer = client->recv_buf;
+    size_t length = client->recv_len;
+    if (!buffer)
+    {
+        buffer = BufferPool_Acquire(&recv_pool);
+        if (!buffer)
+            buffer = recv_fallback;
+    }
+
+    // A full buffer waits for the answer to the request filling it, a recv() with no room would look like a hangup.
+    if (length == BH2_RECV_BUFFER_SIZE)
+    {
+        RejectOversized(index, buffer, length, 0);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    BH2_TRACE_BEGIN(recv_span);
+    ssize_t recv_result = recv(client->socket_fd, buffer + length, BH2_RECV_BUFFER_SIZE - length, 0);
+    BH2_TRACE_END("recv", recv_span, client->socket_fd);
+    Stats_AddOwned(&server_stats.recv_calls, 1);
+    if (recv_result <= 0)
+    {
+        // Client will be removed by the caller, which gives back the attached buffer.
+        if (!client->recv_buf && buffer != recv_fallback)
+            BufferPool_Release(&recv_pool, buffer);
+        return recv_result;
+    }
+
+    if (capture_enabled)
+        CaptureClient(client, CAPTURE_DATA, buffer + length, (size_t)recv_result);
+
+    // The terminator may straddle the previous read, so look a few bytes back.
+    size_t scan_from = length > 3 ? length - 3 : 0;
+    length += recv_result;
+
+    BH2_TRACE_BEGIN(parse_span);
+    size_t consumed = ProcessRequests(index, buffer, length, scan_from);
+    client = ClientVector_At(&clients, index);
+    BH2_TRACE_END("parse", parse_span, client->socket_fd);
+
+    RejectOversized(index, buffer, length, consumed);
+    if (!KeepRemainder(index, buffer, length, consumed))
+    {
+        atomic_fetch_add_explicit(&server_stats.requests_oversized, 1, memory_order_relaxed);
+        bh2_log_error("[Data] Client #%zu has an incomplete request but no buffer to keep it, dropping it.", index);
+        return -1;
+    }
+
+    return recv_result;
+}
+
+static
+ssize_t
+FlushResponses( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+    client->out_scheduled = false;
+
+    ssize_t written = 0;
+    // Clocks of the access records completed by this flush.
+    uint64_t written_us = 0, written_realtime_us = 0;
+    if (access_log_enabled)
+    {
+        written_us = Clock_MonotonicUs();
+        written_realtime_us = Clock_RealtimeUs();
+    }
+    // Every templated response started by this flush tells the same time.
+    uint64_t second = 0;
+    if (options.templated)
+    {
+        second = (written_realtime_us ? written_realtime_us : Clock_RealtimeUs()) / 1000000ULL;
+        Template_SetTime(second);
+    }
+    while (client->out_runs_len)
+    {
+        // One or two iovecs per response, or one per segment of a template. The first one may be partly written already.
+        size_t batch = 0, waiting = 0, queued = 0, requested = 0, offset = client->out_offset;
+        uint64_t request_id = next_request_id;
+        TemplateScratch scratch = { .ptr = template_scratch, .size = sizeof(template_scratch), .used = 0 };
+        bool full = false;
+        for (size_t r = 0; r < client->out_runs_len; r++)
+        {
+            const Response *response = RunResponse(client, &client->out_runs[r]);
+            waiting += client->out_runs[r].count;
+            for (size_t i = 0; i < client->out_runs[r].count && !full; i++)
+            {
+                if (response->template)
+                {
+                    // A response partly written goes on with the values it was started with.
+                    TemplateValues *values = &response_values[queued];
+                    if (offset && client->extras)
+                        *values = client->extras->out_values;
+                    else
+                        *values = (TemplateValues){ .second = second, .request_id = request_id++ };
+                    size_t added = Template_Fill(response->template, values, offset, response_iov + batch, IOV_MAX - batch, &scratch);
+                    if (!added)
+                    {
+                        full = true;
+                        break;
+                    }
+                    batch += added;
+                    requested += response->head_size - offset;
+                }
+                else
+                {
+                    if (batch + 2 > IOV_MAX)
+                    {
+                        full = true;
+                        break;
+                    }
+                    // A partial response has its header made in the scratch buffer, the same again if it's partly written.
+                    const char *head = response->head;
+                    if (!head && offset < response->head_size)
+                    {
+                        if (scratch.size - scratch.used < BH2_PARTIAL_HEAD_SIZE)
+                        {
+                            full = true;
+                            break;
+                        }
+                        head = scratch.ptr + scratch.used;
+                        scratch.used += Response_FormatPartialHead(response, scratch.ptr + scratch.used);
+                    }
+                    if (offset < response->head_size)
+                    {
+                        response_iov[batch].iov_base = (char *)head + offset;
+                        response_iov[batch].iov_len = response->head_size - offset;
+                        requested += response_iov[batch++].iov_len;
+                        offset = 0;
+                    }
+                    else
+                        offset -= response->head_size;
+                    if (response->body_size)
+                    {
+                        response_iov[batch].iov_base = (char *)response->body + offset;
+                        response_iov[batch].iov_len = response->body_size - offset;
+                        requested += response_iov[batch++].iov_len;
+                    }
+                }
+                offset = 0;
+                queued++;
+            }
+        }
+
+        // Tell the kernel more is coming, so batches are packed into full segments.
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        if (queued < waiting)
+            flags |= MSG_MORE;
+
+        struct msghdr msg = { .msg_iov = response_iov, .msg_iovlen = batch };
+        ssize_t send_result = sendmsg(client->socket_fd, &msg, flags);
+        Stats_AddOwned(&server_stats.send_calls, 1);
+        if (send_result < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            send_result = 0;
+        }
+        written += send_result;
+        pending_out_bytes -= (size_t)send_result;
+
+        // Account the written bytes to the responses, in order.
+        size_t bytes = client->out_offset + (size_t)send_result, completed = 0;
+        while (client->out_runs_len)
+        {
+            const Response *response = RunResponse(client, &client->out_runs[0]);
+            size_t size = response->head_size + response->body_size;
+            if (bytes < size)
+                break;
+            bytes -= size;
+            if (response->template && response_values[completed].request_id >= next_request_id)
+                next_request_id = response_values[completed].request_id + 1;
+            completed++;
+            if (access_log_enabled)
+                CompleteAccess(client, response, written_us, written_realtime_us);
+            if (client->out_runs[0].kind == RESPONSE_MEMORY)
+                memory_reports_pending--;
+            if (!--client->out_runs[0].count)
+                memmove(client->out_runs, client->out_runs + 1, sizeof(ResponseRun) * --client->out_runs_len);
+        }
+        client->out_offset = bytes;
+        if (bytes && RunResponse(client, &client->out_runs[0])->template)
+        {
+            // Without extras, the rest is filled with new values. The sizes match, only the values may be torn.
+            ClientExtras *extras = Client_Extras(client);
+            if (extras)
+                extras->out_values = response_values[completed];
+            if (response_values[completed].request_id >= next_request_id)
+                next_request_id = response_values[completed].request_id + 1;
+        }
+        atomic_fetch_add_explicit(&server_stats.responses_sent, completed, memory_order_relaxed);
+
+        if ((size_t)send_result < requested)
+        {
+            // Socket buffer is full. Wait for POLLOUT instead of spinning on it.
+            struct pollfd *pfd = ClientPfd(index);
+            pfd->events |= POLLOUT;
+            atomic_fetch_add_explicit(&server_stats.send_blocked, 1, memory_order_relaxed);
+            return written;
+        }
+    }
+
+    // Events go out once the stream's header is written.
+    if (client->subscribed)
+    {
+        ssize_t events_written = FlushEvents(index);
+        if (events_written < 0)
+            return -1;
+        written += events_written;
+    }
+
+    // Frames go out once the HTTP/1 responses before the switch to HTTP/2 are written.
+    if (client->http2)
+    {
+        ssize_t frames_written = FlushHttp2(index);
+        if (frames_written < 0)
+            return -1;
+        written += frames_written;
+    }
+
+    // Everything is written. Pick up the requests that were left waiting for a run.
+    if (client->recv_paused && client->recv_buf)
+    {
+        client->recv_paused = false;
+        char *buffer = client->recv_buf;
+        size_t consumed = ProcessRequests(index, buffer, client->recv_len, 0);
+        RejectOversized(index, buffer, client->recv_len, consumed);
+        KeepRemainder(index, buffer, client->recv_len, consumed);
+    }
+
+    return written;
+}
+
+static
+ssize_t
+FlushEvents( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+    ClientExtras *extras = client->extras;
+    ssize_t written = 0;
+    while (extras->events.length)
+    {
+        size_t batch = 0, requested = 0, offset = extras->events_offset;
+        for (; batch < extras->events.length && batch < IOV_MAX; batch++)
+        {
+            EventBuffer *event = *(EventBuffer **)Deque_PtrAt(&extras->events, batch);
+            response_iov[batch].iov_base = event->bytes + offset;
+            response_iov[batch].iov_len = event->size - offset;
+            requested += response_iov[batch].iov_len;
+            offset = 0;
+        }
+
+        struct msghdr msg = { .msg_iov = response_iov, .msg_iovlen = batch };
+        ssize_t send_result = sendmsg(client->socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        Stats_AddOwned(&server_stats.send_calls, 1);
+        if (send_result < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            send_result = 0;
+        }
+        written += send_result;
+        pending_out_bytes -= (size_t)send_result;
+        extras->events_backlog -= (size_t)send_result;
+
+        // Let go of the events written completely.
+        size_t bytes = extras->events_offset + (size_t)send_result, delivered = 0;
+        EventBuffer *event = NULL;
+        while (extras->events.length && bytes >= (event = *(EventBuffer **)Deque_PtrAt(&extras->events, 0))->size)
+        {
+            bytes -= event->size;
+            delivered++;
+            Deque_Pop_Front(&extras->events, NULL);
+            Events_Release(event);
+        }
+        extras->events_offset = bytes;
+        Stats_AddOwned(&server_stats.events_delivered, delivered);
+
+        if ((size_t)send_result < requested)
+        {
+            struct pollfd *pfd = ClientPfd(index);
+            pfd->events |= POLLOUT;
+            atomic_fetch_add_explicit(&server_stats.send_blocked, 1, memory_order_relaxed);
+            return written;
+        }
+    }
+    return written;
+}
+
+static
+ssize_t
+FlushHttp2( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+    Http2Session *h2 = client->extras->h2;
+    ssize_t written = 0;
+    uint64_t written_us = 0, written_realtime_us = 0;
+    if (access_log_enabled)
+    {
+        written_us = Clock_MonotonicUs();
+        written_realtime_us = Clock_RealtimeUs();
+    }
+
+    for (;;)
+    {
+        size_t queued = Http2_QueuedBytes(h2);
+        Http2_QueueFrames(h2);
+        pending_out_bytes += Http2_QueuedBytes(h2) - queued;
+        size_t requested = 0;
+        size_t batch = Http2_Gather(h2, response_iov, IOV_MAX, &requested);
+        if (!batch)
+            break;
+
+        struct msghdr msg = { .msg_iov = response_iov, .msg_iovlen = batch };
+        ssize_t send_result = sendmsg(client->socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        Stats_AddOwned(&server_stats.send_calls, 1);
+        if (send_result < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            send_result = 0;
+        }
+        written += send_result;
+        pending_out_bytes -= (size_t)send_result;
+
+        size_t completed = Http2_Written(h2, (size_t)send_result, http2_written);
+        if (access_log_enabled)
+            for (size_t i = 0; i < completed; i++)
+                AddAccess(client, &http2_written[i].access, written_us, written_realtime_us);
+        atomic_fetch_add_explicit(&server_stats.responses_sent, completed, memory_order_relaxed);
+
+        if ((size_t)send_result < requested)
+        {
+            struct pollfd *pfd = ClientPfd(index);
+            pfd->events |= POLLOUT;
+            atomic_fetch_add_explicit(&server_stats.send_blocked, 1, memory_order_relaxed);
+            return written;
+        }
+    }
+
+    // Gone away, and everything is written.
+    if (Http2_Finished(h2))
+        client->out_close = true;
+    return written;
+}
+
+static
+void
+BroadcastEvents( void )
+{
+    EventBuffer *event = NULL;
+    while ((event = Events_Receive()))
+    {
+        Stats_AddOwned(&server_stats.events_received, 1);
+        for (size_t i = clients.length; i-- > 0; )
+        {
+            Client *client = ClientVector_At(&clients, i);
+            if (client->subscribed && !client->out_close && !QueueEvent(client, event))
+            {
+                RemoveClient(i);
+                Stats_AddOwned(&server_stats.events_dropped_subscribers, 1);
+                bh2_log_info("[Data] Subscriber #%zu fell behind, dropping it. %zu clients left.", i, clients.length);
+            }
+        }
+        Events_Release(event);
+    }
+
+    // Write to every subscriber now rather than a few per cycle, most take all their events in one send.
+    // The ones still waiting for their header or for room in the socket are written in their turn.
+    for (size_t i = clients.length; i-- > 0; )
+    {
+        Client *client = ClientVector_At(&clients, i);
+        if (!client->subscribed || client->out_close || client->out_scheduled || client->out_runs_len ||
+            ClientPfd(i)->events & POLLOUT)
+            continue;
+        if (FlushEvents(i) < 0)
+        {
+            bh2_log_error("[Data] Failed to write events to client %zu: %s.", i, strerror(errno));
+            RemoveClient(i);
+        }
+    }
+}
+
+#ifdef BH2_TLS
+static
+bool
+ContinueHandshake( size_t index )
+{
+    Client *client = ClientVector_At(&clients, index);
+    struct pollfd *pfd = ClientPfd(index);
+    bool resumed = false;
+    switch (Tls_Handshake(client->extras->tls, &resumed))
+    {
+        case TLS_WANT_READ:
+            pfd->events = POLLIN;
+            return true;
+        case TLS_WANT_WRITE:
+            pfd->events = POLLOUT;
+            return true;
+        case TLS_FAILED:
+            Stats_AddOwned(&server_stats.tls_failed, 1);
+            bh2_log_info("[Data] Handshake of client %zu failed: %s.", index, Tls_Error());
+            return false;
+        case TLS_DONE:
+            break;
+    }
+
+    // The socket encrypts by itself now, it's served like any other.
+    Tls_Free(client->extras->tls);
+    client->extras->tls = NULL;
+    Stats_AddOwned(&server_stats.tls_handshakes, 1);
+    if (resumed)
+        Stats_AddOwned(&server_stats.tls_resumed, 1);
+    pfd->events = POLLIN;
+    return true;
+}
+#endif
+
+static
+void
+CaptureClient( Client *client, CaptureEventType type, const char *bytes, size_t length )
+{
+    // Clients without a number were accepted when there was no memory for one.
+    ClientExtras *extras = client->extras;
+    if (!extras || !extras->capture_accepted)
+        return;
+
+    if (!extras->capture_opened)
+    {
+        Capture_Record(extras->capture_id, CAPTURE_OPEN, extras->capture_accepted, NULL, 0);
+        extras->capture_opened = true;
+    }
+    Capture_Record(extras->capture_id, type, Clock_MonotonicUs(), bytes, length);
+}
+
+static
+void
+PublishPoolStats( void )
+{
+    atomic_store_explicit(&server_stats.recv_pool_buffers, recv_pool.allocated, memory_order_relaxed);
+    atomic_store_explicit(&server_stats.recv_pool_in_use, recv_pool.in_use, memory_order_relaxed);
+    atomic_store_explicit(&server_stats.recv_pool_peak, recv_pool.peak_in_use, memory_order_relaxed);
+    atomic_store_explicit(&server_stats.recv_pool_exhausted, recv_pool.exhausted, memory_order_relaxed);
+}
+
+static
+void
+PublishSegment( uint64_t now_us, uint64_t cycle_us, bool force )
+{
+    StatsLoopState loop =
+    {
+        .connections = clients.length,
+        .scheduled_writes = await_writings.length,
+        .draining = drain_started,
+        .last_cycle_us = cycle_us
+    };
+    StatsSegment_Publish(&loop, now_us, force);
+}
+
+// Memory of all TCP sockets of the network namespace, not only this server's, 0 if unknown.
+static
+size_t
+KernelTcpBytes( void )
+{
+    FILE *sockstat = fopen("/proc/net/sockstat", "r");
+    if (!sockstat)
+        return 0;
+
+    char line[256];
+    size_t pages = 0;
+    while (fgets(line, sizeof(line), sockstat))
+        if (sscanf(line, "TCP: inuse %*u orphan %*u tw %*u alloc %*u mem %zu", &pages) == 1)
+            break;
+    fclose(sockstat);
+    return pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static
+void
+BuildMemoryReport( void )
+{
+    size_t extras_clients = 0, extras_bytes = 0;
+    for (size_t i = 0; i < clients.length; i++)
+    {
+        const ClientExtras *extras = ClientVector_At(&clients, i)->extras;
+        if (!extras)
+            continue;
+        extras_clients++;
+        extras_bytes += sizeof(ClientExtras) + extras->access_pending.capacity * extras->access_pending.elem_size;
+        if (extras->h2)
+            extras_bytes += Http2_SessionBytes(extras->h2);
+    }
+
+    size_t clients_bytes = clients.capacity * sizeof(Client);
+    size_t pfds_bytes = client_pfds.capacity * sizeof(struct pollfd);
+    size_t queue_bytes = await_writings.capacity * await_writings.elem_size;
+    size_t recv_bytes = recv_pool.allocated * BH2_RECV_BUFFER_SIZE;
+    size_t total_bytes = clients_bytes + pfds_bytes + queue_bytes + extras_bytes + recv_bytes;
+    size_t connections = clients.length;
+
+    char body[BH2_MEMORY_REPORT_SIZE];
+    int length = snprintf(body, sizeof(body),
+                          "connections %zu\n"
+                          "low_memory %d\n"
+                          "client_size %zu\n"
+                          "clients_bytes %zu\n"
+                          "pollfds_bytes %zu\n"
+                          "write_queue_bytes %zu\n"
+                          "extras_clients %zu\n"
+                          "extras_bytes %zu\n"
+                          "recv_buffers %zu\n"
+                          "recv_buffers_in_use %zu\n"
+                          "recv_buffer_bytes %zu\n"
+                          "total_bytes %zu\n"
+                          "bytes_per_connection %zu\n"
+                          "socket_buffer_limit %d\n"
+                          "kernel_tcp_bytes %zu\n",
+                          connections, options.low_memory, sizeof(Client), clients_bytes, pfds_bytes, queue_bytes,
+                          extras_clients, extras_bytes, recv_pool.allocated, recv_pool.in_use, recv_bytes,
+                          total_bytes, connections ? total_bytes / connections : 0,
+                          options.low_memory ? BH2_LOW_MEMORY_SOCKET_BUFFER : 0, KernelTcpBytes());
+    Response_SetMemoryReport(body, length < 0 ? 0 : (size_t)length >= sizeof(body) ? sizeof(body) - 1 : (size_t)length);
+}
+
+static
+void
+ShrinkClientVectors( void )
+{
+    // Waiting until a vector is down to a quarter keeps a steady load from shrinking and growing it over and over.
+    if (clients.capacity > BH2_LOW_MEMORY_MIN_CLIENTS && clients.length < clients.capacity / 4)
+    {
+        ClientVector_ShrinkToFit(&clients);
+        ClientVector_ExpandUntil(&clients, BH2_LOW_MEMORY_MIN_CLIENTS);
+    }
+    if (client_pfds.capacity > BH2_LOW_MEMORY_MIN_CLIENTS && client_pfds.length < client_pfds.capacity / 4)
+    {
+        PollfdVector_ShrinkToFit(&client_pfds);
+        PollfdVector_ExpandUntil(&client_pfds, BH2_LOW_MEMORY_MIN_CLIENTS);
+    }
 }
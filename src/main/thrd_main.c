@@ -1,7 +1,26 @@
+// accept4()
+#define _GNU_SOURCE
+
 #include <pch.h>
 
+#include "access_log.h"
+#include "capture.h"
+#include "clock.h"
+#include "events.h"
+#include "options.h"
+#include "overload.h"
 #include "shared.h"
+#include "stats.h"
+#include "stats_segment.h"
+#include "trace.h"
 #include "../communication/client.h"
+#include "../communication/handoff.h"
+#include "../communication/http2.h"
+#include "../communication/listener.h"
+#include "../communication/rate_limit.h"
+#include "../communication/response.h"
+#include "../communication/template.h"
+#include "../communication/tls.h"
 
 #include <rxi/log.h>
 
@@ -10,7 +29,9 @@
 #include <netdb.h>
 #include <netinet/ip6.h>
 #include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -48,47 +69,116 @@ extern
 int
 DataThread( void *arg_unused );
 
-// Signal handler for main thread.
+// Accept one client from a listener, and hand it over unless it's refused.
 static
 void
-MainThreadSignalHandler( int );
+AcceptClient( int listen_fd, bool tls );
+
+// Hand a newly accepted client over to the data thread, which starts with the handshake of an HTTPS one.
+static
+void
+AddClient( int client_fd, const struct sockaddr_storage *client_addr, RateLimitSlot *rate_slot, bool tls );
 
 int
 main( int argc, char *argv[] )
 {
-    sigaction(SIGINT, &( struct sigaction ){ .sa_handler = MainThreadSignalHandler }, NULL);
+    // Signals are read from a signalfd by main thread, so block them before any thread is created.
+    // Data thread inherits the mask and never sees them.
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    sigaddset(&signal_mask, SIGUSR1);
+    sigaddset(&signal_mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &signal_mask, NULL);
     // Return result of functions
     int result = 0;
 
-    // Load html content
-    if (argc < 2)
-    {
-        fprintf(stderr, "Specify html file path.\n");
+    if (!Options_Parse(argc, argv))
         exit(EXIT_FAILURE);
+
+    if (options.trace_path)
+    {
+        Trace_Init(options.trace_events);
+        Trace_RegisterThread("main");
     }
 
-    int html_fd = open(argv[1], O_RDONLY);
+    // Load html content
+    int html_fd = open(options.html_path, O_RDONLY);
     if (html_fd == -1)
     {
         perror("Failed to open file");
         exit(EXIT_FAILURE);
     }
 
-    // Load html content
+    // Load html content, and build every response around it
     struct stat html_file_stat = { 0 };
     fstat(html_fd, &html_file_stat);
-    size_t html_head_size = strlen(HTTP_HEAD);
     size_t html_file_size = html_file_stat.st_size;
-    html_content_size = html_head_size + html_file_size + 4;
     char *html_file_map = mmap(NULL, html_file_size, PROT_READ, MAP_PRIVATE, html_fd, 0);
+    if (html_file_map == MAP_FAILED)
+    {
+        perror("Failed to map file");
+        exit(EXIT_FAILURE);
+    }
 
-    html_content = malloc(html_content_size);
-    memcpy(html_content, HTTP_HEAD, html_head_size);
-    memcpy(html_content + html_head_size, html_file_map, html_file_size);
-    memcpy(html_content + html_head_size + html_file_size, "\r\n\r\n", 4);
+    Template_Init(options.instance_name);
+    if (!Response_BuildAll(html_file_map, html_file_size, options.templated))
+    {
+        if (options.templated)
+            fprintf(stderr, "Failed to build responses, check the placeholders of %s.\n", options.html_path);
+        else
+            fprintf(stderr, "Failed to build responses.\n");
+        exit(EXIT_FAILURE);
+    }
     munmap(html_file_map, html_file_stat.st_size);
     close(html_fd);
 
+    if (options.h2c && !Http2_Init())
+    {
+        fprintf(stderr, "Failed to build HTTP/2 responses.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.access_log_path && !AccessLog_Open(options.access_log_path, options.access_log_size))
+    {
+        fprintf(stderr, "Failed to open access log %s: %s\n", options.access_log_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.capture_path && !Capture_Open(options.capture_path, options.capture_size))
+    {
+        fprintf(stderr, "Failed to open capture %s: %s\n", options.capture_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.events_path && !Events_Open(options.events_path))
+    {
+        fprintf(stderr, "Failed to open event socket %s: %s\n", options.events_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.stats_shm_name && !StatsSegment_Open(options.stats_shm_name))
+    {
+        fprintf(stderr, "Failed to create statistics segment %s: %s\n", options.stats_shm_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef BH2_TLS
+    if (options.tls && !Tls_Init(options.tls_cert_path, options.tls_key_path))
+    {
+        fprintf(stderr, "Failed to set HTTPS up with %s: %s\n", options.tls_cert_path, Tls_Error());
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    Overload_Init(&options.overload);
+    if (!RateLimit_Init(&options.rate_limit))
+    {
+        fprintf(stderr, "Failed to allocate the rate limit table.\n");
+        exit(EXIT_FAILURE);
+    }
+
     // Initialize logger
 #ifdef BH2_DEBUG
     log_set_quiet(false);
@@ -109,51 +199,134 @@ main( int argc, char *argv[] )
 #endif
 
     // Initialize multithread variables
-    clients = Vector_CreateS(sizeof(Client), NULL);
-    client_pfds = Vector_CreateS(sizeof(struct pollfd), NULL);
-    Vector_ExpandUntil(&clients, 32);
-    Vector_ExpandUntil(&client_pfds, 32);
+    clients = ClientVector_CreateS();
+    client_pfds = PollfdVector_CreateS();
+    ClientVector_ExpandUntil(&clients, 32);
+    PollfdVector_ExpandUntil(&client_pfds, 32);
     mtx_init(&clients_mtx, mtx_plain);
     cnd_init(&clients_cnd);
 
-    // Initialize sockets
-    int server_socket = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
-    if (server_socket == -1)
+    int signal_fd = signalfd(-1, &signal_mask, SFD_CLOEXEC);
+    data_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (signal_fd == -1 || data_wake_fd == -1)
     {
-        bh2_log_error("[Main] Failed to create a socket: %s", strerror(errno));
+        bh2_log_error("[Main] Failed to create signalfd or eventfd: %s", strerror(errno));
 
         result = EXIT_FAILURE;
-        goto clean_multithread;
+        goto clean_fds;
     }
-    bh2_log_trace("[Main] Created server socket.");
-
-    // Port 80 listening
-    struct sockaddr_in6 addr =
-    {
-        .sin6_family = AF_INET6,
-        .sin6_port = htons(BH2_SERVER_PORT),
-        .sin6_addr = in6addr_any
-    };
-    result = bind(server_socket, (struct sockaddr *)&addr, (socklen_t) sizeof(addr));
-    if (result == -1)
+    PollfdVector_Push(&client_pfds, &(struct pollfd){ .fd = data_wake_fd, .events = POLLIN });
+    // poll() skips the events socket if it's -1.
+    PollfdVector_Push(&client_pfds, &(struct pollfd){ .fd = events_fd, .events = POLLIN });
+
+    // Take the listening sockets over from the running instance, if there's one.
+    // Responses are already built, so clients can be answered as soon as they're ours.
+    int listeners[BH2_MAX_LISTENERS];
+    bool listener_tls[BH2_MAX_LISTENERS] = { false };
+    size_t listener_count = 0;
+    int handoff_socket = -1;
+    if (options.upgrade_socket)
     {
-        bh2_log_error("[Main] Failed to bind socket to port %u: %s", BH2_SERVER_PORT, strerror(errno));
+        Vector taken_fds = Vector_CreateS(sizeof(int), NULL);
+        int taken = Handoff_Receive(options.upgrade_socket, &taken_fds);
+        if (taken < 0)
+        {
+            bh2_log_error("[Main] Failed to take over from %s: %s", options.upgrade_socket, strerror(errno));
+            fprintf(stderr, "Failed to take over from %s: %s\n", options.upgrade_socket, strerror(errno));
+            Vector_DestroyS(&taken_fds);
 
-        result = EXIT_FAILURE;
-        goto clean_socket;
+            result = EXIT_FAILURE;
+            goto clean_fds;
+        }
+        // The sockets are used as they are, --listen only applies to a fresh start.
+        for (size_t i = 0; i < taken_fds.length; i++)
+        {
+            int fd = *(int *)Vector_PtrAt(&taken_fds, i);
+            if (listener_count == BH2_MAX_LISTENERS)
+            {
+                close(fd);
+                continue;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            listeners[listener_count++] = fd;
+        }
+        if (taken)
+        {
+            bh2_log_trace("[Main] Took over %d listening sockets from %s.", taken, options.upgrade_socket);
+        }
+        Vector_DestroyS(&taken_fds);
+
+        // Only the addresses come along, the ones --listen asks HTTPS for are HTTPS here too.
+        for (size_t i = 0; i < options.listen_count; i++)
+        {
+            struct sockaddr_storage addr = { 0 };
+            socklen_t addr_len = 0;
+            bool tls = false;
+            Listener_ParseSpec(options.listen[i], &addr, &addr_len, &tls);
+            for (size_t l = 0; tls && l < listener_count; l++)
+                listener_tls[l] |= Listener_IsBound(listeners[l], &addr);
+        }
+
+        // Then wait for the next upgrade ourselves.
+        handoff_socket = Handoff_Listen(options.upgrade_socket);
+        if (handoff_socket == -1)
+        {
+            bh2_log_error("[Main] Failed to listen on %s: %s", options.upgrade_socket, strerror(errno));
+
+            result = EXIT_FAILURE;
+            goto clean_socket;
+        }
     }
-    bh2_log_trace("[Main] Bound the socket to port %u", BH2_SERVER_PORT);
 
-    // Listen to bound port.
-    result = listen(server_socket, 32);
-    if (result == -1)
+    if (!listener_count)
     {
-        bh2_log_error("[Main] Failed to listen to socket: %s", strerror(errno));
+        // Without any --listen, take every client on port 80.
+        struct sockaddr_storage addrs[BH2_MAX_LISTENERS] = { 0 };
+        socklen_t addr_lens[BH2_MAX_LISTENERS] = { 0 };
+        bool addr_tls[BH2_MAX_LISTENERS] = { false };
+        size_t addr_count = options.listen_count;
+        bool has_ipv4 = false;
+        for (size_t i = 0; i < options.listen_count; i++)
+        {
+            Listener_ParseSpec(options.listen[i], &addrs[i], &addr_lens[i], &addr_tls[i]);
+            has_ipv4 |= addrs[i].ss_family == AF_INET;
+        }
+        if (!addr_count)
+        {
+            struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&addrs[0];
+            addr->sin6_family = AF_INET6;
+            addr->sin6_port = htons(BH2_SERVER_PORT);
+            addr->sin6_addr = in6addr_any;
+            addr_lens[0] = sizeof(*addr);
+            addr_count = 1;
+        }
 
-        result = EXIT_FAILURE;
-        goto clean_socket;
+        // IPv6 listeners take IPv4 clients too, unless IPv4 has listeners of its own.
+        for (size_t i = 0; i < addr_count; i++)
+        {
+            int fd = Listener_Open(&addrs[i], addr_lens[i], has_ipv4);
+            if (fd == -1)
+            {
+                const char *spec = options.listen_count ? options.listen[i] : "tcp6:[::]:80";
+                bh2_log_error("[Main] Failed to listen on %s: %s", spec, strerror(errno));
+                fprintf(stderr, "Failed to listen on %s: %s\n", spec, strerror(errno));
+
+                result = EXIT_FAILURE;
+                goto clean_socket;
+            }
+            listener_tls[listener_count] = addr_tls[i];
+            listeners[listener_count++] = fd;
+        }
     }
-    bh2_log_trace("[Main] Listening port %u.", BH2_SERVER_PORT);
+
+#ifdef BH2_DEBUG
+    for (size_t i = 0; i < listener_count; i++)
+    {
+        char listener_name[128] = { 0 };
+        Listener_Describe(listeners[i], listener_name, sizeof(listener_name));
+        bh2_log_trace("[Main] Listening on %s.", listener_name);
+    }
+#endif
 
     // Create data thread and multithread variables.
     // It seems like after C17, initialization of atomic variables like "atomic_int gg = 1" is allowed,
@@ -161,6 +334,7 @@ main( int argc, char *argv[] )
     atomic_store(&data_mtx_locked, false);
     atomic_store(&new_client_incoming, false);
     atomic_store(&data_thread_block, false);
+    atomic_store(&draining, false);
     atomic_store(&should_exit, false);
     thrd_create(&data_thread, DataThread, NULL);
 
@@ -170,88 +344,100 @@ main( int argc, char *argv[] )
         thrd_sleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 1000 * 200 }, NULL);
     bh2_log_trace("[Main] Data thread is up and running.");
 
-    // Variables for incoming clients' information
-    char clinet_addr_str[INET6_ADDRSTRLEN + 1] = { 0 };
-    Client new_client = { 0 };
-    int client_fd = 0;
-    struct pollfd client_pfd = { 0 };
-    struct sockaddr_storage client_addr = { 0 };
-    socklen_t client_addr_len = sizeof(client_addr);
-    uint16_t client_port = 0;
+    struct signalfd_siginfo signal_info = { 0 };
 
-    while (!atomic_load(&should_exit))
+    // Main thread waits on the signals, the successors and every listener together, so it never hangs in accept().
+    // poll() skips the handoff socket if it's -1.
+    struct pollfd main_pfds[2 + BH2_MAX_LISTENERS] =
     {
-        bh2_log_info("[Main] Waiting for clients...");
-        // Block and wait for new client incoming
-        client_fd = accept(server_socket, (struct sockaddr *) &client_addr, &client_addr_len);
+        { .fd = signal_fd, .events = POLLIN },
+        { .fd = handoff_socket, .events = POLLIN }
+    };
+    for (size_t i = 0; i < listener_count; i++)
+        main_pfds[2 + i] = (struct pollfd){ .fd = listeners[i], .events = POLLIN };
+    bool handed_off = false;
 
-        if (client_fd == -1)
+    while (!atomic_load(&draining))
+    {
+        // While data thread asks for a pause, leave new clients in the listen backlogs,
+        // and look again every 10ms since nobody wakes us up when it's over.
+        bool paused = Overload_State() == OVERLOAD_PAUSE_ACCEPT;
+        for (size_t i = 0; i < listener_count; i++)
+            main_pfds[2 + i].fd = paused ? -1 : listeners[i];
+
+        bh2_log_info("[Main] Waiting for clients...");
+        // Block and wait for new client incoming or a signal
+        if (poll(main_pfds, 2 + listener_count, paused ? 10 : -1) == -1)
         {
-            bh2_log_error("[Main] Failed to accept(): %s", strerror(errno));
+            if (errno != EINTR)
+            {
+                bh2_log_error("[Main] Failed to poll(): %s", strerror(errno));
+            }
             continue;
         }
 
-        if (atomic_load(&should_exit))
+        if (main_pfds[0].revents & POLLIN && read(signal_fd, &signal_info, sizeof(signal_info)) == sizeof(signal_info))
         {
-            bh2_log_debug("[Main] Ending program...");
-            break;
+            if (signal_info.ssi_signo == SIGUSR1)
+                Stats_Print(stderr);
+            else if (signal_info.ssi_signo == SIGUSR2)
+            {
+                if (trace_enabled && !Trace_Dump(options.trace_path))
+                {
+                    bh2_log_error("[Main] Failed to dump trace to %s: %s", options.trace_path, strerror(errno));
+                }
+            }
+            else
+            {
+                // Received Ctrl+C or termination, stop accepting and start draining.
+                bh2_log_info("[Main] Caught signal %u, draining.", signal_info.ssi_signo);
+                atomic_store(&draining, true);
+                break;
+            }
         }
 
-        /*
-            Accepted new client. Add its information to clients vector!
-        */
-
-        if (client_addr.ss_family == AF_INET)
+        if (main_pfds[1].revents & POLLIN)
         {
-            struct sockaddr_in *in_ptr = (struct sockaddr_in *)&client_addr;
-            client_port = in_ptr->sin_port;
-            inet_ntop(AF_INET, &(in_ptr->sin_addr), clinet_addr_str, sizeof(clinet_addr_str));
+            // A newer instance is taking over. Once it holds the listening sockets, drain like on a signal.
+            if (Handoff_Send(handoff_socket, listeners, listener_count))
+            {
+                bh2_log_info("[Main] Handed the listening sockets over, draining.");
+                handed_off = true;
+                atomic_store(&draining, true);
+                break;
+            }
+            bh2_log_error("[Main] Failed to hand the listening sockets over: %s", strerror(errno));
         }
-        else
+
+        for (size_t i = 0; i < listener_count; i++)
         {
-            struct sockaddr_in6 *in6_ptr = (struct sockaddr_in6 *)&client_addr;
-            client_port = in6_ptr->sin6_port;
-            inet_ntop(AF_INET6, &(in6_ptr->sin6_addr), clinet_addr_str, sizeof(clinet_addr_str));
+            if (main_pfds[2 + i].revents & POLLIN)
+                AcceptClient(listeners[i], listener_tls[i]);
         }
-        bh2_log_info("[Main] Accepting new client from <[%s]:%u>.", clinet_addr_str, client_port);
-
-        // New client coming, generate information of it
-        new_client.socket_fd = client_fd;
-        new_client.addr_len = client_addr_len;
-        memcpy(&(new_client.addr), &client_addr, sizeof(client_addr));
-
-        client_pfd.fd = client_fd;
-        client_pfd.events = POLLIN;
-        client_pfd.revents = 0;
-
-        bh2_log_info("[Main] Blocking for data thread to give the mutex.");
-        // Tells data thread that new client is connecting,
-        // and wait for the mutex to be acquired
-        atomic_store(&new_client_incoming, true);
-        mtx_lock(&clients_mtx);
-
-        bh2_log_info("[Main] Acquired mutex. Adding client information...");
-        // Mutex acquired, add client information into the poll list
-        Vector_Push(&clients, &new_client);
-        Vector_Push(&client_pfds, &client_pfd);
-
-        // Done, now unlock the mutex
-        mtx_unlock(&clients_mtx);
-
-        bh2_log_info("[Main] Done adding client information.");
-        // Tell the data thread that the client information has been written
-        atomic_store(&new_client_incoming, false);
-        cnd_broadcast(&clients_cnd);
-
-        /*
-            Done writing new client's information.
-        */
     }
 
     bh2_log_trace("[Main] Main thread received ending signal.");
 
-    if (atomic_load(&data_thread_block))
-        cnd_broadcast(&clients_cnd);
+    // New connections are refused from now on, unless the sockets live on in the successor,
+    // which then also owns the socket files of unix listeners.
+    for (size_t i = 0; i < listener_count; i++)
+        Listener_Close(listeners[i], !handed_off);
+    listener_count = 0;
+
+    // The successor has bound the upgrade socket path again, it's not ours to remove.
+    if (handoff_socket != -1)
+    {
+        close(handoff_socket);
+        if (!handed_off)
+            unlink(options.upgrade_socket);
+        handoff_socket = -1;
+    }
+
+    // Wake the data thread wherever it's waiting. If it's polling, it holds the mutex until it has drained.
+    eventfd_write(data_wake_fd, 1);
+    mtx_lock(&clients_mtx);
+    cnd_broadcast(&clients_cnd);
+    mtx_unlock(&clients_mtx);
 
     result = EXIT_SUCCESS;
 
@@ -259,19 +445,44 @@ main( int argc, char *argv[] )
     thrd_join(data_thread, NULL);
 
     for (size_t i = 0; i < clients.length; i++)
-        close(((Client *)Vector_PtrAt(&clients, i))->socket_fd);
+        close(ClientVector_At(&clients, i)->socket_fd);
 
 clean_socket:
-    close(server_socket);
-    bh2_log_trace("[Main] Closed server socket.");
-clean_multithread:
+    for (size_t i = 0; i < listener_count; i++)
+        Listener_Close(listeners[i], true);
+    if (handoff_socket != -1)
+    {
+        close(handoff_socket);
+        unlink(options.upgrade_socket);
+    }
+    bh2_log_trace("[Main] Closed server sockets.");
+clean_fds:
+    if (signal_fd != -1)
+        close(signal_fd);
+    if (data_wake_fd != -1)
+        close(data_wake_fd);
+
     cnd_destroy(&clients_cnd);
     bh2_log_trace("[Main] Destroyed clients condition variable.");
     mtx_destroy(&clients_mtx);
     bh2_log_trace("[Main] Destroyed clients mutex.");
-    Vector_DestroyS(&client_pfds);
-    Vector_DestroyS(&clients);
-    free(html_content);
+    PollfdVector_DestroyS(&client_pfds);
+    ClientVector_DestroyS(&clients);
+    if (trace_enabled)
+    {
+        if (!Trace_Dump(options.trace_path))
+            fprintf(stderr, "Failed to dump trace to %s: %s\n", options.trace_path, strerror(errno));
+        Trace_Destroy();
+    }
+    AccessLog_Close();
+    Capture_Close();
+    Events_Close();
+    StatsSegment_Close();
+#ifdef BH2_TLS
+    Tls_Cleanup();
+#endif
+    RateLimit_Destroy();
+    Response_DestroyAll();
     bh2_log_trace("[Main] Main has ended. End of log.");
 #ifdef BH2_DEBUG
     if (has_log)
@@ -286,9 +497,158 @@ clean_multithread:
 
 static
 void
-MainThreadSignalHandler( int signum_unused )
+AcceptClient( int listen_fd, bool tls )
+{
+    struct sockaddr_storage client_addr = { 0 };
+    socklen_t client_addr_len = sizeof(client_addr);
+    BH2_TRACE_BEGIN(accept_start);
+    // HTTPS clients are non-blocking: a handshake step or a kTLS record that is not all there yet
+    // would otherwise block the data thread.
+    int client_fd = accept4(listen_fd, (struct sockaddr *) &client_addr, &client_addr_len, SOCK_CLOEXEC | (tls ? SOCK_NONBLOCK : 0));
+    if (client_fd == -1)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            bh2_log_error("[Main] Failed to accept(): %s", strerror(errno));
+        }
+        return;
+    }
+
+    // Data thread is overloaded, answer with the cheapest response there is and keep serving existing clients.
+    // HTTPS clients could not read it, they are only closed.
+    if (Overload_State() == OVERLOAD_SHED)
+    {
+        if (!tls)
+            send(client_fd, responses[RESPONSE_UNAVAILABLE].head, responses[RESPONSE_UNAVAILABLE].head_size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(client_fd);
+        atomic_fetch_add_explicit(&server_stats.shed_connections, 1, memory_order_relaxed);
+        return;
+    }
+
+    // Refuse early, before the client costs the data thread anything.
+    // Unix clients have no address, only the overall connection limit applies to them.
+    RateLimitSlot *rate_slot = NULL;
+    RateLimitVerdict verdict = RateLimit_Admit(&client_addr, &rate_slot);
+    if (verdict != RATE_LIMIT_ADMIT)
+    {
+        bh2_log_info("[Main] Refusing new client, rate limit verdict %d.", verdict);
+        if (!tls)
+            send(client_fd, responses[RESPONSE_UNAVAILABLE].head, responses[RESPONSE_UNAVAILABLE].head_size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(client_fd);
+        return;
+    }
+
+    BH2_TRACE_END("accept", accept_start, client_fd);
+
+    AddClient(client_fd, &client_addr, rate_slot, tls);
+}
+
+static
+void
+AddClient( int client_fd, const struct sockaddr_storage *client_addr, RateLimitSlot *rate_slot, bool tls )
 {
-    // Received Ctrl+C signal, ending program.
-    bh2_log_info("[Main] Caught SIGINT.");
-    atomic_store(&should_exit, true);
+    /*
+        Accepted new client. Add its information to clients vector!
+    */
+
+#ifdef BH2_DEBUG
+    char client_addr_str[INET6_ADDRSTRLEN + 1] = { 0 };
+    uint16_t client_port = 0;
+    if (client_addr->ss_family == AF_INET)
+    {
+        struct sockaddr_in *in_ptr = (struct sockaddr_in *)client_addr;
+        client_port = ntohs(in_ptr->sin_port);
+        inet_ntop(AF_INET, &(in_ptr->sin_addr), client_addr_str, sizeof(client_addr_str));
+    }
+    else if (client_addr->ss_family == AF_INET6)
+    {
+        struct sockaddr_in6 *in6_ptr = (struct sockaddr_in6 *)client_addr;
+        client_port = ntohs(in6_ptr->sin6_port);
+        inet_ntop(AF_INET6, &(in6_ptr->sin6_addr), client_addr_str, sizeof(client_addr_str));
+    }
+    else
+        strcpy(client_addr_str, "unix");
+    bh2_log_info("[Main] Accepting new client from <[%s]:%u>.", client_addr_str, client_port);
+#endif
+
+    // New client coming, generate information of it
+    Client new_client = { 0 };
+    new_client.socket_fd = client_fd;
+    Client_SetPeer(&new_client, client_addr);
+    new_client.rate_slot = rate_slot;
+    new_client.recv_buf = NULL;
+    new_client.recv_len = 0;
+    new_client.recv_skip = 0;
+    new_client.recv_paused = false;
+    new_client.out_runs_len = 0;
+    new_client.out_offset = 0;
+    new_client.out_scheduled = false;
+    new_client.out_close = false;
+    new_client.subscribed = false;
+    new_client.extras = NULL;
+    ClientExtras *extras = capture_enabled ? Client_Extras(&new_client) : NULL;
+    if (extras)
+    {
+        // Only main thread numbers connections.
+        static uint32_t next_capture_id = 0;
+        extras->capture_id = next_capture_id++;
+        extras->capture_accepted = Clock_MonotonicUs();
+    }
+
+#ifdef BH2_TLS
+    if (tls)
+    {
+        extras = Client_Extras(&new_client);
+        if (!extras || !(extras->tls = Tls_Accept(client_fd)))
+        {
+            bh2_log_error("[Main] Out of memory for the handshake of a new client.");
+            Client_FreeExtras(&new_client);
+            RateLimit_Release(rate_slot);
+            close(client_fd);
+            return;
+        }
+    }
+#else
+    (void)tls;
+#endif
+
+    // Idle connections pin little kernel memory, but one that is sent to or sends faster than
+    // it's read grows its buffers up to the kernel's limits. Low memory mode keeps them small.
+    if (options.low_memory)
+    {
+        int buffer_size = BH2_LOW_MEMORY_SOCKET_BUFFER;
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    }
+
+    struct pollfd client_pfd = { 0 };
+    client_pfd.fd = client_fd;
+    client_pfd.events = POLLIN;
+    client_pfd.revents = 0;
+
+    bh2_log_info("[Main] Blocking for data thread to give the mutex.");
+    BH2_TRACE_BEGIN(handoff_start);
+    // Tells data thread that new client is connecting, wake it up from poll(),
+    // and wait for the mutex to be acquired
+    atomic_store(&new_client_incoming, true);
+    eventfd_write(data_wake_fd, 1);
+    mtx_lock(&clients_mtx);
+
+    bh2_log_info("[Main] Acquired mutex. Adding client information...");
+    // Mutex acquired, add client information into the poll list
+    ClientVector_Push(&clients, &new_client);
+    PollfdVector_Push(&client_pfds, &client_pfd);
+
+    // Done, now unlock the mutex
+    mtx_unlock(&clients_mtx);
+
+    bh2_log_info("[Main] Done adding client information.");
+    // Tell the data thread that the client information has been written
+    atomic_store(&new_client_incoming, false);
+    cnd_broadcast(&clients_cnd);
+    BH2_TRACE_END("handoff", handoff_start, client_fd);
+
+    /*
+        Done writing new client's information.
+    */
 }
@@ -0,0 +1,160 @@
+#include "trace.h"
+
+#include <unistd.h>
+
+// One recorded span.
+typedef struct TraceEvent
+{
+    // 2 * n + 2 once the n-th event of the thread is in the slot, odd while it's being written.
+    _Atomic uint64_t seq;
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    int64_t arg;
+} TraceEvent;
+
+// Ring of events of one thread. Only that thread writes it.
+typedef struct TraceRing
+{
+    const char *thread_name;
+    // Events ever recorded, the slot of the n-th event is n % ring_capacity.
+    _Atomic uint64_t head;
+    // Set last when the thread registers, so a dump never sees a ring half set up.
+    _Atomic(TraceEvent *) events;
+} TraceRing;
+
+bool trace_enabled;
+
+static
+TraceRing rings[BH2_TRACE_MAX_THREADS];
+
+static
+atomic_size_t ring_count;
+
+static
+size_t ring_capacity;
+
+// Ring of the calling thread, NULL if it has none.
+static
+_Thread_local TraceRing *own_ring;
+
+void
+Trace_Init( size_t events_per_thread )
+{
+    ring_capacity = events_per_thread ? events_per_thread : 1;
+    atomic_store(&ring_count, 0);
+    trace_enabled = true;
+}
+
+void
+Trace_RegisterThread( const char *name )
+{
+    if (!trace_enabled)
+        return;
+
+    size_t index = atomic_fetch_add(&ring_count, 1);
+    if (index >= BH2_TRACE_MAX_THREADS)
+        return;
+
+    TraceEvent *events = calloc(ring_capacity, sizeof(TraceEvent));
+    if (!events)
+        return;
+    TraceRing *ring = &rings[index];
+    ring->thread_name = name;
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->events, events, memory_order_release);
+    own_ring = ring;
+}
+
+uint64_t
+Trace_Now( void )
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void
+Trace_Span( const char *name, uint64_t start, uint64_t end, int64_t arg )
+{
+    TraceRing *ring = own_ring;
+    if (!ring)
+        return;
+
+    uint64_t index = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceEvent *event = &atomic_load_explicit(&ring->events, memory_order_relaxed)[index % ring_capacity];
+
+    // Seqlock write: odd while the fields change, so a concurrent dump skips the slot.
+    atomic_store_explicit(&event->seq, 2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    event->arg = arg;
+    atomic_store_explicit(&event->seq, 2 * index + 2, memory_order_release);
+    atomic_store_explicit(&ring->head, index + 1, memory_order_release);
+}
+
+bool
+Trace_Dump( const char *path )
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    int pid = (int)getpid();
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    size_t count = atomic_load(&ring_count);
+    for (size_t r = 0; r < count && r < BH2_TRACE_MAX_THREADS; r++)
+    {
+        TraceRing *ring = &rings[r];
+        TraceEvent *events = atomic_load_explicit(&ring->events, memory_order_acquire);
+        if (!events)
+            continue;
+
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", pid, r + 1, ring->thread_name);
+        first = false;
+
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (uint64_t i = head > ring_capacity ? head - ring_capacity : 0; i < head; i++)
+        {
+            // Seqlock read: the copy only counts if the slot held the same event before and after.
+            TraceEvent *slot = &events[i % ring_capacity];
+            uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            if (seq != 2 * i + 2)
+                continue;
+            const char *name = slot->name;
+            uint64_t start = slot->start, end = slot->end;
+            int64_t arg = slot->arg;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+                continue;
+
+            // Chrome wants microseconds.
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64,
+                    name, pid, r + 1, start / 1000, start % 1000, (end - start) / 1000, (end - start) % 1000);
+            if (arg >= 0)
+                fprintf(file, ",\"args\":{\"arg\":%" PRId64 "}", arg);
+            fprintf(file, "}");
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+void
+Trace_Destroy( void )
+{
+    size_t count = atomic_load(&ring_count);
+    for (size_t r = 0; r < count && r < BH2_TRACE_MAX_THREADS; r++)
+    {
+        free(atomic_load(&rings[r].events));
+        atomic_store(&rings[r].events, NULL);
+    }
+    atomic_store(&ring_count, 0);
+    trace_enabled = false;
+}
@@ -0,0 +1,95 @@
+#ifndef BH2_SERVER_TRACE_H
+#define BH2_SERVER_TRACE_H
+
+#include <pch.h>
+
+/*
+
+    Optional tracing of spans for offline profiling, off unless --trace is given.
+
+    Every thread records into its own ring of events, so recording takes no lock and never waits.
+    When a ring is full, the oldest events are overwritten. Each slot carries a sequence number,
+    so a dump taken while a thread is still recording skips the slots it catches being written.
+
+    Dumps are Chrome Trace Event JSON, which chrome://tracing and Perfetto both open.
+
+*/
+
+// Threads that may record spans.
+#define BH2_TRACE_MAX_THREADS 4
+
+// Events kept per thread unless told otherwise.
+#define BH2_TRACE_DEFAULT_EVENTS 65536
+
+// If tracing is on. Set once by Trace_Init() before any thread is created.
+extern
+bool trace_enabled;
+
+// Start a span, taking no time at all while tracing is off.
+#define BH2_TRACE_BEGIN(start) \
+    uint64_t start = trace_enabled ? Trace_Now() : 0
+
+// End a span started by BH2_TRACE_BEGIN(). name must be a string literal.
+#define BH2_TRACE_END(name, start, arg) \
+    do { if (trace_enabled) Trace_Span(name, start, Trace_Now(), arg); } while (0)
+
+///
+/// \brief Initialize tracing
+///
+/// Turn tracing on. Call before any thread is created.
+///
+/// \param events_per_thread Size of the ring of every thread
+///
+void
+Trace_Init( size_t events_per_thread );
+
+///
+/// \brief Register a thread
+///
+/// Give the calling thread a ring to record into. Spans of a thread that has none are dropped.
+///
+/// \param name Name of the thread in dumps, must outlive the tracing
+///
+void
+Trace_RegisterThread( const char *name );
+
+///
+/// \brief Get the trace clock
+///
+/// \return Monotonic nanoseconds
+///
+uint64_t
+Trace_Now( void );
+
+///
+/// \brief Record a span
+///
+/// \param name Name of the span, must outlive the tracing
+/// \param start Start time from \a Trace_Now()
+/// \param end End time from \a Trace_Now()
+/// \param arg Number shown with the span, like the client socket. Negative for none.
+///
+void
+Trace_Span( const char *name, uint64_t start, uint64_t end, int64_t arg );
+
+///
+/// \brief Dump recorded spans
+///
+/// Write every recorded span to a Chrome Trace Event JSON file. Threads may keep recording meanwhile.
+///
+/// \param path File to write, replaced if it exists
+///
+/// \return true on success.
+///
+bool
+Trace_Dump( const char *path );
+
+///
+/// \brief Destroy tracing
+///
+/// Free every ring. No thread may record anymore.
+///
+void
+Trace_Destroy( void );
+
+#endif // !BH2_SERVER_TRACE_H
@@ -0,0 +1,128 @@
+// bh2-logdump: turn binary access logs into CSV or JSON lines.
+//
+// Usage: bh2-logdump [-j] <access log>...
+
+#include <pch.h>
+
+#include "../main/access_log.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+static
+const char *
+MethodName( uint8_t method )
+{
+    // Same order as RequestMethod.
+    static const char *const names[] = { "GET", "HEAD", "OPTIONS", "OTHER" };
+    if (method < sizeof(names) / sizeof(names[0]))
+        return names[method];
+    return "-";
+}
+
+// Write the peer address of a record, "-" for unix clients.
+static
+void
+FormatAddress( const AccessRecord *record, char *text, size_t size )
+{
+    static const uint8_t zero[16] = { 0 };
+    static const uint8_t mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+    if (!memcmp(record->addr, zero, sizeof(zero)))
+        snprintf(text, size, "-");
+    else if (!memcmp(record->addr, mapped, sizeof(mapped)))
+        inet_ntop(AF_INET, record->addr + 12, text, (socklen_t)size);
+    else
+        inet_ntop(AF_INET6, record->addr, text, (socklen_t)size);
+}
+
+static
+bool
+Dump( const char *path, bool json )
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    AccessLogHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, BH2_ACCESS_LOG_MAGIC, sizeof(header.magic)))
+    {
+        fprintf(stderr, "%s: Not an access log.\n", path);
+        fclose(file);
+        return false;
+    }
+    if (header.version != BH2_ACCESS_LOG_VERSION || header.record_size < sizeof(AccessRecord) || header.record_size > 4096)
+    {
+        fprintf(stderr, "%s: Unsupported version %" PRIu32 " with %" PRIu32 " byte records.\n", path, header.version, header.record_size);
+        fclose(file);
+        return false;
+    }
+
+    // Records of a newer writer may be longer, the fields known here come first.
+    char record_bytes[4096];
+    AccessRecord record;
+    char address[INET6_ADDRSTRLEN];
+    while (fread(record_bytes, header.record_size, 1, file) == 1)
+    {
+        memcpy(&record, record_bytes, sizeof(record));
+        FormatAddress(&record, address, sizeof(address));
+        if (json)
+            printf("{\"time_us\":%" PRIu64 ",\"address\":\"%s\",\"port\":%u,\"method\":\"%s\",\"path_hash\":%" PRIu32
+                   ",\"status\":%u,\"bytes\":%" PRIu32 ",\"latency_us\":%" PRIu32 "}\n",
+                   record.time_us, address, record.port, MethodName(record.method), record.path_hash,
+                   record.status, record.bytes, record.latency_us);
+        else
+            printf("%" PRIu64 ",%s,%u,%s,%" PRIu32 ",%u,%" PRIu32 ",%" PRIu32 "\n",
+                   record.time_us, address, record.port, MethodName(record.method), record.path_hash,
+                   record.status, record.bytes, record.latency_us);
+    }
+
+    bool ok = !ferror(file);
+    if (!ok)
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    fclose(file);
+    return ok;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    bool json = false;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "jh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                json = true;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-j] <access log>...\n"
+                        "\n"
+                        "Print the records of blackhole2 access logs as CSV, or as JSON lines with -j.\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc)
+    {
+        fprintf(stderr, "Specify access log paths.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!json)
+        printf("time_us,address,port,method,path_hash,status,bytes,latency_us\n");
+
+    int result = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++)
+    {
+        if (!Dump(argv[i], json))
+            result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,476 @@
+// bh2-replay: send the connections of a capture to a server again, keeping their timing.
+//
+// Usage: bh2-replay [-s speed] [-c copies] <capture> <target>
+
+// getaddrinfo()
+#define _GNU_SOURCE
+
+#include <pch.h>
+
+#include "../main/capture.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// One thing a connection did, at its time.
+typedef struct Step
+{
+    uint64_t time_us;
+    // Bytes sent, NULL for the close.
+    const char *bytes;
+    size_t length;
+} Step;
+
+// A captured connection.
+typedef struct Connection
+{
+    bool opened;
+    uint64_t open_us;
+    Step *steps;
+    size_t steps_len, steps_capacity;
+} Connection;
+
+// A copy of a connection being replayed.
+typedef struct Replay
+{
+    const Connection *connection;
+    int fd;
+    // If the connection is established, and if the replay is over.
+    bool connected, done;
+    // Next step, and bytes of it already sent.
+    size_t step;
+    size_t offset;
+    // If nothing has been received since bytes were last sent, and when they were.
+    bool awaiting_response;
+    uint64_t sent_us;
+} Replay;
+
+// Longest time a close waits for the response to the last bytes sent.
+#define BH2_REPLAY_CLOSE_LINGER_US 1000000ULL
+
+static
+Connection *connections;
+static
+size_t connections_len;
+
+// Start of the capture, every time is replayed relative to it.
+static
+uint64_t capture_start_us = UINT64_MAX;
+
+static
+struct sockaddr_storage target_addr;
+static
+socklen_t target_addr_len;
+
+// Totals printed at the end.
+static
+size_t opened, failed, closed_by_server;
+static
+uint64_t bytes_sent, bytes_received;
+
+static
+uint64_t
+NowUs( void )
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+static
+bool
+AddStep( Connection *connection, Step step )
+{
+    if (connection->steps_len == connection->steps_capacity)
+    {
+        size_t capacity = connection->steps_capacity ? connection->steps_capacity * 2 : 8;
+        Step *steps = realloc(connection->steps, capacity * sizeof(Step));
+        if (!steps)
+            return false;
+        connection->steps = steps;
+        connection->steps_capacity = capacity;
+    }
+    connection->steps[connection->steps_len++] = step;
+    return true;
+}
+
+// Read the whole capture and sort its events into connections. The bytes of the steps point into it.
+static
+char *
+LoadCapture( const char *path )
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *capture = size > 0 ? malloc((size_t)size) : NULL;
+    if (!capture || fread(capture, (size_t)size, 1, file) != 1)
+    {
+        fprintf(stderr, "%s: Failed to read.\n", path);
+        free(capture);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    CaptureHeader header;
+    if ((size_t)size < sizeof(header) || (memcpy(&header, capture, sizeof(header)), memcmp(header.magic, BH2_CAPTURE_MAGIC, sizeof(header.magic))) || header.version != BH2_CAPTURE_VERSION)
+    {
+        fprintf(stderr, "%s: Not a capture of this version.\n", path);
+        free(capture);
+        return NULL;
+    }
+
+    // A capture cut short by its size limit may end in the middle of an event, which is left out.
+    size_t offset = sizeof(header);
+    CaptureEvent event;
+    while (offset + sizeof(event) <= (size_t)size)
+    {
+        memcpy(&event, capture + offset, sizeof(event));
+        if (offset + sizeof(event) + event.length > (size_t)size)
+            break;
+        const char *bytes = capture + offset + sizeof(event);
+        offset += sizeof(event) + event.length;
+
+        if (event.connection >= connections_len)
+        {
+            size_t length = (size_t)event.connection + 1;
+            Connection *grown = realloc(connections, length * sizeof(Connection));
+            if (!grown)
+                break;
+            memset(grown + connections_len, 0, (length - connections_len) * sizeof(Connection));
+            connections = grown;
+            connections_len = length;
+        }
+        Connection *connection = &connections[event.connection];
+
+        switch (event.type)
+        {
+            case CAPTURE_OPEN:
+                connection->opened = true;
+                connection->open_us = event.time_us;
+                if (event.time_us < capture_start_us)
+                    capture_start_us = event.time_us;
+                break;
+            case CAPTURE_DATA:
+                AddStep(connection, (Step){ .time_us = event.time_us, .bytes = bytes, .length = event.length });
+                break;
+            case CAPTURE_CLOSE:
+                AddStep(connection, (Step){ .time_us = event.time_us, .bytes = NULL, .length = 0 });
+                break;
+        }
+    }
+
+    return capture;
+}
+
+// Parse host:port, [ipv6]:port, unix:<path> or unix:@<abstract name>.
+static
+bool
+ParseTarget( const char *target )
+{
+    if (!strncmp(target, "unix:", 5))
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)&target_addr;
+        const char *path = target + 5;
+        size_t path_len = strlen(path);
+        if (!path_len || path_len >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, path_len);
+        target_addr_len = sizeof(*un);
+        if (path[0] == '@')
+        {
+            un->sun_path[0] = '\0';
+            target_addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len);
+        }
+        return true;
+    }
+
+    char host[256] = { 0 };
+    const char *colon = strrchr(target, ':');
+    if (!colon || (size_t)(colon - target) >= sizeof(host))
+        return false;
+    memcpy(host, target, colon - target);
+    char *node = host;
+    if (node[0] == '[' && node[strlen(node) - 1] == ']')
+    {
+        node[strlen(node) - 1] = '\0';
+        node++;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *result = NULL;
+    if (getaddrinfo(node, colon + 1, &hints, &result) || !result)
+        return false;
+    memcpy(&target_addr, result->ai_addr, result->ai_addrlen);
+    target_addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+static
+void
+Finish( Replay *replay )
+{
+    if (replay->fd != -1)
+        close(replay->fd);
+    replay->fd = -1;
+    replay->done = true;
+}
+
+// Send the steps that are due. Returns false once the replay is over.
+static
+bool
+Advance( Replay *replay, uint64_t capture_now )
+{
+    const Connection *connection = replay->connection;
+    while (replay->step < connection->steps_len && connection->steps[replay->step].time_us <= capture_now)
+    {
+        const Step *step = &connection->steps[replay->step];
+        if (!step->bytes)
+        {
+            // The client hung up after its responses, so don't cut them short when playing faster.
+            if (replay->awaiting_response && NowUs() - replay->sent_us < BH2_REPLAY_CLOSE_LINGER_US)
+                return true;
+            Finish(replay);
+            return false;
+        }
+
+        ssize_t sent = send(replay->fd, step->bytes + replay->offset, step->length - replay->offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            failed++;
+            Finish(replay);
+            return false;
+        }
+        bytes_sent += (uint64_t)sent;
+        replay->offset += (size_t)sent;
+        replay->awaiting_response = true;
+        replay->sent_us = NowUs();
+        if (replay->offset < step->length)
+            return true;
+        replay->step++;
+        replay->offset = 0;
+    }
+
+    // A connection still open when the capture stopped ends with its last bytes.
+    if (replay->step == connection->steps_len)
+    {
+        Finish(replay);
+        return false;
+    }
+    return true;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    double speed = 1.0;
+    unsigned long copies = 1;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "s:c:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                speed = strtod(optarg, NULL);
+                break;
+            case 'c':
+                copies = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if (argc - optind != 2 || speed <= 0.0 || !copies)
+    {
+        fprintf(stderr,
+                "Usage: %s [-s speed] [-c copies] <capture> <target>\n"
+                "\n"
+                "Replay the connections of a blackhole2 capture against target, which is host:port, [ipv6]:port,\n"
+                "unix:<path> or unix:@<abstract name>.\n"
+                "  -s speed   Play this many times faster than captured, 1 by default.\n"
+                "  -c copies  Play every connection this many times at once, 1 by default.\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char *capture = LoadCapture(argv[optind]);
+    if (!capture)
+        return EXIT_FAILURE;
+    if (!ParseTarget(argv[optind + 1]))
+    {
+        fprintf(stderr, "Invalid target: %s\n", argv[optind + 1]);
+        free(capture);
+        return EXIT_FAILURE;
+    }
+
+    size_t replays_len = 0;
+    for (size_t i = 0; i < connections_len; i++)
+        replays_len += connections[i].opened ? copies : 0;
+    Replay *replays = calloc(replays_len ? replays_len : 1, sizeof(Replay));
+    // Only open sockets are polled, owners maps them back to their replays.
+    struct pollfd *pfds = calloc(replays_len ? replays_len : 1, sizeof(struct pollfd));
+    size_t *owners = calloc(replays_len ? replays_len : 1, sizeof(size_t));
+    if (!replays || !pfds || !owners)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0, r = 0; i < connections_len; i++)
+    {
+        for (size_t c = 0; connections[i].opened && c < copies; c++, r++)
+            replays[r] = (Replay){ .connection = &connections[i], .fd = -1 };
+    }
+
+    // Many copies need many sockets.
+    struct rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max)
+    {
+        fd_limit.rlim_cur = fd_limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fd_limit);
+    }
+
+    uint64_t start = NowUs();
+    size_t remaining = replays_len;
+    while (remaining)
+    {
+        uint64_t capture_now = capture_start_us + (uint64_t)((double)(NowUs() - start) * speed);
+        // Capture time of the next thing due, to sleep until then.
+        uint64_t next_due = UINT64_MAX;
+        // If a close is waiting for a response, which must be looked at again once its linger is over.
+        bool lingering = false;
+        size_t pfds_len = 0;
+
+        for (size_t r = 0; r < replays_len; r++)
+        {
+            Replay *replay = &replays[r];
+            if (replay->done)
+                continue;
+
+            if (replay->fd == -1)
+            {
+                if (replay->connection->open_us > capture_now)
+                {
+                    if (replay->connection->open_us < next_due)
+                        next_due = replay->connection->open_us;
+                    continue;
+                }
+                replay->fd = socket(target_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (replay->fd == -1 || (connect(replay->fd, (struct sockaddr *)&target_addr, target_addr_len) == -1 && errno != EINPROGRESS))
+                {
+                    failed++;
+                    Finish(replay);
+                    remaining--;
+                    continue;
+                }
+                opened++;
+            }
+
+            if (replay->connected && !Advance(replay, capture_now))
+            {
+                remaining--;
+                continue;
+            }
+
+            // Wait for the connection, room to send, or responses to throw away.
+            struct pollfd *pfd = &pfds[pfds_len];
+            owners[pfds_len++] = r;
+            *pfd = (struct pollfd){ .fd = replay->fd, .events = POLLIN };
+            const Step *step = &replay->connection->steps[replay->step];
+            if (!replay->connected || replay->offset)
+                pfd->events |= POLLOUT;
+            else if (step->time_us <= capture_now)
+                lingering = true;
+            else if (step->time_us < next_due)
+                next_due = step->time_us;
+        }
+        if (!remaining)
+            break;
+
+        int timeout = -1;
+        if (next_due != UINT64_MAX)
+        {
+            double wait_ms = (double)(next_due > capture_now ? next_due - capture_now : 0) / speed / 1000.0;
+            timeout = wait_ms > 1000.0 ? 1000 : (int)wait_ms;
+        }
+        if (lingering && (timeout < 0 || timeout > 10))
+            timeout = 10;
+        if (poll(pfds, pfds_len, timeout) < 0 && errno != EINTR)
+        {
+            perror("poll()");
+            break;
+        }
+
+        for (size_t p = 0; p < pfds_len; p++)
+        {
+            Replay *replay = &replays[owners[p]];
+            if (!pfds[p].revents)
+                continue;
+
+            if (!replay->connected && pfds[p].revents & (POLLOUT | POLLERR | POLLHUP))
+            {
+                int error = 0;
+                socklen_t error_len = sizeof(error);
+                getsockopt(replay->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+                if (error)
+                {
+                    failed++;
+                    Finish(replay);
+                    remaining--;
+                    continue;
+                }
+                replay->connected = true;
+            }
+
+            if (pfds[p].revents & (POLLIN | POLLHUP))
+            {
+                char discard[65536];
+                ssize_t received = recv(replay->fd, discard, sizeof(discard), MSG_DONTWAIT);
+                if (received > 0)
+                {
+                    bytes_received += (uint64_t)received;
+                    replay->awaiting_response = false;
+                }
+                else if (!received || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    // The server hung up first, what's left of the connection can't be played.
+                    closed_by_server++;
+                    Finish(replay);
+                    remaining--;
+                }
+            }
+        }
+    }
+
+    double seconds = (double)(NowUs() - start) / 1000000.0;
+    printf("connections %zu\nfailed %zu\nclosed_by_server %zu\nbytes_sent %" PRIu64 "\nbytes_received %" PRIu64 "\nseconds %.3f\n",
+           opened, failed, closed_by_server, bytes_sent, bytes_received, seconds);
+
+    for (size_t r = 0; r < replays_len; r++)
+    {
+        if (replays[r].fd != -1)
+            close(replays[r].fd);
+    }
+    for (size_t i = 0; i < connections_len; i++)
+        free(connections[i].steps);
+    free(connections);
+    free(replays);
+    free(pfds);
+    free(owners);
+    free(capture);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+// bh2-top: show the statistics a running server publishes in shared memory, refreshed like top.
+//
+// Usage: bh2-top [-1] [-a] [-i interval_ms] <name>
+//
+// Reads the segment of --stats-shm <name> without the server doing anything for it. Every value is shown
+// with how much it changed per second since the last refresh, values that are still 0 are left out unless -a.
+// -1 prints one snapshot as "name value" lines instead, for scripts.
+
+#include <pch.h>
+
+#include "../main/stats_segment.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Snapshots taken while the server writes are tried again this many times before giving up on a refresh.
+#define TOP_READ_ATTEMPTS 1000
+
+// A snapshot older than this may be of an instance that was replaced, the name is opened again.
+#define TOP_STALE_US 2000000ULL
+
+typedef struct Snapshot
+{
+    uint64_t published_us;
+    uint64_t values[BH2_STATS_SEGMENT_VALUES];
+} Snapshot;
+
+static
+uint64_t
+NowRealtimeUs( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+// Map the segment of name, NULL if there's none or it's not one this reader knows.
+static
+const StatsSegment *
+OpenSegment( const char *name, bool quiet )
+{
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        if (!quiet)
+            fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    struct stat segment_stat;
+    if (fstat(fd, &segment_stat) == -1 || (size_t)segment_stat.st_size < sizeof(StatsSegment))
+    {
+        if (!quiet)
+            fprintf(stderr, "%s: Not a statistics segment.\n", name);
+        close(fd);
+        return NULL;
+    }
+    const StatsSegment *segment = mmap(NULL, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        if (!quiet)
+            fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    // The magic is written last, the header is complete once it's there.
+    bool valid = !memcmp(segment->magic, BH2_STATS_SEGMENT_MAGIC, sizeof(segment->magic));
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || segment->version != BH2_STATS_SEGMENT_VERSION || segment->count > BH2_STATS_SEGMENT_VALUES)
+    {
+        if (!quiet)
+            fprintf(stderr, "%s: Not a statistics segment of version %d.\n", name, BH2_STATS_SEGMENT_VERSION);
+        munmap((void *)segment, sizeof(StatsSegment));
+        return NULL;
+    }
+    return segment;
+}
+
+// Copy the values out of the segment. Returns false if the server kept writing them.
+static
+bool
+ReadSnapshot( const StatsSegment *segment, Snapshot *snapshot )
+{
+    for (size_t attempt = 0; attempt < TOP_READ_ATTEMPTS; attempt++)
+    {
+        // Seqlock read: the copy only counts if the sequence was the same even number before and after it.
+        uint64_t sequence = atomic_load_explicit(&((StatsSegment *)segment)->sequence, memory_order_acquire);
+        if (sequence & 1)
+            continue;
+        snapshot->published_us = segment->published_us;
+        memcpy(snapshot->values, segment->values, sizeof(uint64_t) * segment->count);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&((StatsSegment *)segment)->sequence, memory_order_relaxed) == sequence)
+            return true;
+    }
+    return false;
+}
+
+static
+void
+PrintOnce( const StatsSegment *segment, const Snapshot *snapshot )
+{
+    for (size_t i = 0; i < segment->count; i++)
+        printf("%.*s %" PRIu64 "\n", BH2_STATS_NAME_SIZE, segment->names[i], snapshot->values[i]);
+}
+
+// Draw a screen, with rates against previous unless it's NULL.
+static
+void
+PrintScreen( const StatsSegment *segment, const Snapshot *snapshot, const Snapshot *previous, bool all )
+{
+    uint64_t now_us = NowRealtimeUs();
+    uint64_t age_us = now_us > snapshot->published_us ? now_us - snapshot->published_us : 0;
+    uint64_t up_s = now_us > segment->started_us ? (now_us - segment->started_us) / 1000000ULL : 0;
+    double elapsed = previous && snapshot->published_us > previous->published_us ?
+                     (double)(snapshot->published_us - previous->published_us) / 1e6 : 0.0;
+
+    // Home and clear, like top.
+    printf("\033[H\033[2J");
+    printf("blackhole2 pid %" PRIu64 ", up %" PRIu64 "s, snapshot %.1f ms old\n\n", segment->pid, up_s, (double)age_us / 1000.0);
+    printf("%-32s %20s %14s\n", "name", "value", "per second");
+    for (size_t i = 0; i < segment->count; i++)
+    {
+        if (!all && !snapshot->values[i])
+            continue;
+        printf("%-32.*s %20" PRIu64, BH2_STATS_NAME_SIZE, segment->names[i], snapshot->values[i]);
+        if (elapsed > 0.0 && snapshot->values[i] != previous->values[i])
+            printf(" %14.1f", ((double)snapshot->values[i] - (double)previous->values[i]) / elapsed);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int
+main( int argc, char *argv[] )
+{
+    bool once = false, all = false;
+    unsigned long interval_ms = 1000;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "1ai:h")) != -1)
+    {
+        switch (opt)
+        {
+            case '1':
+                once = true;
+                break;
+            case 'a':
+                all = true;
+                break;
+            case 'i':
+                interval_ms = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if (argc - optind != 1 || !interval_ms)
+    {
+        fprintf(stderr,
+                "Usage: %s [-1] [-a] [-i interval_ms] <name>\n"
+                "\n"
+                "Show the statistics a blackhole2 started with --stats-shm <name> publishes.\n"
+                "  -1              Print one snapshot as \"name value\" lines and exit.\n"
+                "  -a              Also show values that are 0.\n"
+                "  -i interval_ms  Time between refreshes, 1000 by default.\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *name = argv[optind];
+
+    const StatsSegment *segment = OpenSegment(name, false);
+    if (!segment)
+        return EXIT_FAILURE;
+
+    static Snapshot snapshot, previous;
+    bool has_previous = false;
+    struct timespec interval = { .tv_sec = (time_t)(interval_ms / 1000), .tv_nsec = (long)(interval_ms % 1000) * 1000000L };
+    for (;;)
+    {
+        if (!ReadSnapshot(segment, &snapshot))
+        {
+            if (once)
+            {
+                fprintf(stderr, "%s: The server kept writing, try again.\n", name);
+                return EXIT_FAILURE;
+            }
+            nanosleep(&interval, NULL);
+            continue;
+        }
+        if (once)
+        {
+            PrintOnce(segment, &snapshot);
+            return EXIT_SUCCESS;
+        }
+
+        PrintScreen(segment, &snapshot, has_previous ? &previous : NULL, all);
+        previous = snapshot;
+        has_previous = true;
+        nanosleep(&interval, NULL);
+
+        // A newer instance publishes under the same name in a segment of its own.
+        if (NowRealtimeUs() - segment->published_us > TOP_STALE_US)
+        {
+            const StatsSegment *newer = OpenSegment(name, true);
+            if (newer && (newer->pid != segment->pid || newer->started_us != segment->started_us))
+            {
+                munmap((void *)segment, sizeof(StatsSegment));
+                segment = newer;
+                has_previous = false;
+            }
+            else if (newer)
+                munmap((void *)newer, sizeof(StatsSegment));
+        }
+    }
+}